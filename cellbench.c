@@ -0,0 +1,149 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<pthread.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<errno.h>
+#include "mill.h"
+
+/* Measures how many cell updates per second actors can make in each lock mode as the number of actors grows
+ * Every actor drops pellets on random columns and moves them down to the last row, like pellet.c does
+ * Output is CSV: mode,actors,updates,seconds,updates_per_sec
+ */
+
+#define ROW 256 // Default number of rows
+#define COL 256 // Default number of columns
+#define MAX_ACTORS 8 // Default max number of actors (runs 1, 2, 4, ... up to this)
+#define DURATION_MS 1000 // Default time each configuration runs for
+
+struct millHeader *mill; // Private mill shared by the actor threads
+volatile bool stop; // Tells the actors to finish
+
+// Prototype Functions (Comments on details are made after the main function)
+static void *actor( void *arg );
+void lockRows( int first, int last, bool lock );
+double now( void );
+
+int main( int argc, char *argv[] ){
+    int rows = ROW;
+    int cols = COL;
+    int maxActors = MAX_ACTORS;
+    int duration = DURATION_MS;
+    int option;
+    const char *modeNames[] = { "global", "striped", "cas" };
+
+    while( (option = getopt(argc, argv, "r:c:a:t:")) != -1 ){
+        switch( option ){
+            case 'r':
+                rows = atoi( optarg );
+                break;
+            case 'c':
+                cols = atoi( optarg );
+                break;
+            case 'a':
+                maxActors = atoi( optarg );
+                break;
+            case 't':
+                duration = atoi( optarg );
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-r rows] [-c cols] [-a max actors] [-t milliseconds]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( rows < 2 || cols < 1 || maxActors < 1 || duration < 1 ){
+        fprintf( stderr, "Invalid arguments.\n" );
+        exit(EXIT_FAILURE);
+    }
+
+    mill = aligned_alloc( MILL_ALIGN, millSegmentSize(rows, cols) );
+    if( mill == NULL ){
+        fprintf( stderr, "Error allocating the mill: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    printf( "mode,actors,updates,seconds,updates_per_sec\n" );
+    for( int mode = MILL_LOCK_GLOBAL; mode <= MILL_LOCK_CAS; mode++ ){
+        for( int actors = 1; actors <= maxActors; actors *= 2 ){
+            pthread_t threads[actors];
+            unsigned long counts[actors];
+            unsigned long total = 0;
+            millInit( mill, rows, cols, mode, 0, 0 );
+            millClear( mill );
+            stop = false;
+            double start = now();
+            for( int i = 0; i < actors; i++ ){
+                counts[i] = i + 1; // Doubles as the seed of the actor
+                pthread_create( &threads[i], NULL, actor, &counts[i] );
+            }
+            usleep( duration * 1000 );
+            stop = true;
+            for( int i = 0; i < actors; i++ ){
+                pthread_join( threads[i], NULL );
+                total += counts[i];
+            }
+            double seconds = now() - start;
+            printf( "%s,%d,%lu,%.3f,%.0f\n", modeNames[mode], actors, total, seconds, total / seconds );
+        }
+    }
+    free( mill );
+    return 0;
+}
+
+/* Drops pellets on random columns and moves each one down until it leaves the matrix
+ * arg holds the seed on the way in and the number of cell updates made on the way out
+ */
+static void *actor( void *arg ){
+    unsigned long *count = arg;
+    unsigned int seed = *count;
+    unsigned long updates = 0;
+    while( !stop ){
+        int row = 0;
+        int col = rand_r( &seed ) % mill->cols;
+        lockRows( row, row, true );
+        int outcome = millPlacePellet( mill, row, col );
+        lockRows( row, row, false );
+        if( outcome != MILL_MOVED ){
+            continue;
+        }
+        updates++;
+        while( outcome == MILL_MOVED && !stop ){
+            int last = (row + 1 < (int)mill->rows) ? row + 1 : row;
+            lockRows( row, last, true );
+            outcome = millMovePellet( mill, row, col );
+            lockRows( row, last, false );
+            row++;
+            updates += (outcome != MILL_STAYED);
+        }
+    }
+    *count = updates;
+    return NULL;
+}
+
+/* Locks/unlocks rows first through last with whatever the mill's lock mode is
+ */
+void lockRows( int first, int last, bool lock ){
+    if( mill->lockMode == MILL_LOCK_GLOBAL ){
+        if( lock ){
+            millLockGlobal( mill );
+        } else {
+            millUnlockGlobal( mill );
+        }
+    } else if( mill->lockMode == MILL_LOCK_STRIPED ){
+        if( lock ){
+            millLockRows( mill, first, last );
+        } else {
+            millUnlockRows( mill, first, last );
+        }
+    }
+}
+
+/* Returns the current time in seconds
+ */
+double now( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
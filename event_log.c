@@ -0,0 +1,158 @@
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<sched.h>
+#include<errno.h>
+#include "event_log.h"
+#include "pellet_engine.h"
+
+#define EVENT_BATCH 4096 // Most events the writer takes from the ring before handing them to stdio
+#define EVENT_IDLE_NS 500000 // How long the writer sleeps when the ring is empty (0.5ms)
+
+// Prototype Functions (Comments on details are made with each function)
+static void *eventWriter( void *arg );
+static int drainRing( struct eventLog *log );
+
+/* Creates the log file at path, writes its header and starts the writer thread
+ */
+struct eventLog *eventLogOpen( const char *path, uint16_t flags ){
+    struct eventLog *log = calloc( 1, sizeof(*log) );
+    if( log == NULL ){
+        fprintf( stderr, "Error allocating the event log: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    log->slots = calloc( EVENT_RING, sizeof(struct eventSlot) );
+    if( log->slots == NULL ){
+        fprintf( stderr, "Error allocating the event ring: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( uint64_t i = 0; i < EVENT_RING; i++ ){
+        log->slots[i].sequence = i; // Slot i is free for the producer that claims position i
+    }
+    log->file = fopen( path, "w" );
+    if( log->file == NULL ){
+        fprintf( stderr, "File failed to open.\n" );
+        exit(EXIT_FAILURE);
+    }
+    setvbuf( log->file, NULL, _IOFBF, 1 << 20 ); // Big stdio buffer, the writer thread is the only one waiting on it
+    uint16_t version = EVENT_VERSION;
+    fwrite( EVENT_MAGIC, 1, 4, log->file );
+    fwrite( &version, sizeof(version), 1, log->file );
+    fwrite( &flags, sizeof(flags), 1, log->file );
+
+    int code = pthread_create( &log->writer, NULL, eventWriter, log );
+    if( code ){
+        fprintf( stderr, "pthread_create failed with code %d.\n", code );
+        exit(EXIT_FAILURE);
+    }
+    return log;
+}
+
+/* Hands an event to the writer thread
+ * Any number of threads may call this at once, it never takes a lock and only waits if the ring is full
+ */
+void eventLogWrite( struct eventLog *log, const struct eventRecord *record ){
+    uint64_t position = __atomic_load_n( &log->tail, __ATOMIC_RELAXED );
+    struct eventSlot *slot;
+    while( 1 ){
+        slot = &log->slots[position & (EVENT_RING - 1)];
+        uint64_t sequence = __atomic_load_n( &slot->sequence, __ATOMIC_ACQUIRE );
+        int64_t difference = (int64_t)(sequence - position);
+        if( difference == 0 ){
+            // The slot is free, claim it (another producer may claim it first)
+            if( __atomic_compare_exchange_n(&log->tail, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ){
+                break;
+            }
+        } else if( difference < 0 ){
+            sched_yield(); // The ring is full, give the writer thread a chance to catch up
+            position = __atomic_load_n( &log->tail, __ATOMIC_RELAXED );
+        } else {
+            position = __atomic_load_n( &log->tail, __ATOMIC_RELAXED ); // Another producer took this slot
+        }
+    }
+    slot->record = *record;
+    __atomic_store_n( &slot->sequence, position + 1, __ATOMIC_RELEASE ); // Publishes the event to the writer thread
+}
+
+/* Waits for every event handed to the log to be written, then stops the writer thread and closes the file
+ */
+void eventLogClose( struct eventLog *log ){
+    __atomic_store_n( &log->stopping, true, __ATOMIC_RELEASE );
+    pthread_join( log->writer, NULL );
+    fclose( log->file );
+    free( log->slots );
+    free( log );
+}
+
+/* Writes the text swim_mill used to write to swim_mill_results.txt for one event
+ */
+void eventLogFormat( FILE *out, uint16_t flags, const struct eventRecord *record ){
+    const char *label = (flags & EVENT_IDS) ? "ID" : "PID"; // Engine pellets have an ID instead of a PID
+    unsigned long long id = eventActor( record );
+    int count = record->actor;
+    // Cheks the event type to print the appropriate messages
+    if( record->type == PELLET_EATEN && record->fish > 0 ){
+      fprintf( out, "pellet %s %llu has been eaten by fish %d.\n", label, id, record->fish );
+    } else if( record->type == PELLET_EATEN ){
+      fprintf( out, "pellet %s %llu has been eaten by the fish.\n", label, id );
+    } else if( record->type == PELLET_ERROR ){
+      fprintf( out, "pellet %s %llu has terminated due to an error.\n", label, id );
+    } else if( record->type == PELLET_PASSED ){
+      fprintf( out, "pellet %s %llu has passed the fish.\n", label, id );
+    } else if( record->type == PELLET_COLLISION ){
+      fprintf( out, "pellet %s %llu has terminated due to initializing on top of an already exisiting pellet.\n", label, id );
+    } else if( record->type == EVENT_EATEN_COUNT ){
+      fprintf( out, "%d pellet%s been eaten by the fish.\n", count, (count > 1) ? "s have" : " has" );
+    } else if( record->type == EVENT_PASSED_COUNT ){
+      fprintf( out, "%d pellet%s passed the fish.\n", count, (count > 1) ? "s have" : " has" );
+    } else if( record->type == EVENT_COLLISION_COUNT ){
+      fprintf( out, "%d pellet%s terminated due to initializing on top of an already exisiting pellet.\n", count, (count > 1) ? "s have" : " has" );
+    } else {
+      fprintf( out, "pellet %s %llu has terminated due to an unknown reason. Figure it out.\n", label, id );
+    }
+}
+
+/* Writer thread: moves events from the ring to the file until the log is closed and the ring is empty
+ */
+static void *eventWriter( void *arg ){
+    struct eventLog *log = arg;
+    struct timespec idle = { 0, EVENT_IDLE_NS };
+    while( 1 ){
+        bool stopping = __atomic_load_n( &log->stopping, __ATOMIC_ACQUIRE ); // Read before draining so nothing handed over before close is missed
+        if( drainRing(log) > 0 ){
+            continue;
+        }
+        if( stopping ){
+            break;
+        }
+        fflush( log->file ); // Nothing to do, so get what there is onto the disk
+        nanosleep( &idle, NULL );
+    }
+    return NULL;
+}
+
+/* Writes up to EVENT_BATCH events from the ring to the file
+ * Returns the number of events written
+ */
+static int drainRing( struct eventLog *log ){
+    // Every record is written length prefixed
+    struct {
+        uint16_t length;
+        struct eventRecord record;
+    } __attribute__((packed)) batch[EVENT_BATCH];
+    int count = 0;
+    while( count < EVENT_BATCH ){
+        struct eventSlot *slot = &log->slots[log->head & (EVENT_RING - 1)];
+        if( __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != log->head + 1 ){
+            break; // Empty (or the next event is still being copied in)
+        }
+        batch[count].length = sizeof(struct eventRecord);
+        batch[count++].record = slot->record;
+        __atomic_store_n( &slot->sequence, log->head + EVENT_RING, __ATOMIC_RELEASE ); // Frees the slot for the next lap
+        log->head++;
+    }
+    if( count > 0 && fwrite(batch, sizeof(batch[0]), count, log->file) != (size_t)count ){
+        fprintf( stderr, "Error writing the event log: %s\n", strerror(errno) );
+    }
+    return count;
+}
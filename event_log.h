@@ -0,0 +1,68 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<pthread.h>
+
+/* Binary event log written by a dedicated thread
+ * Actors hand events to eventLogWrite, which only copies them into a lock-free ring buffer, and the writer thread
+ * drains the ring to the file in large blocks, so a slow disk never holds up the thread that made the event
+ *
+ * File format (little endian, as written by the machine that ran swim_mill):
+ *   header: "MEVT", uint16_t version, uint16_t flags
+ *   then one record after another: uint16_t length, then length bytes of struct eventRecord
+ * A reader skips the bytes of a record past the fields it knows, so fields can be added at the end later on
+ * mill_decode turns a log back into the text swim_mill_results.txt used to hold
+ */
+
+#define EVENT_MAGIC "MEVT"
+#define EVENT_VERSION 2 // 2 added high
+#define EVENT_RING 65536 // Events the ring buffer holds (a power of two)
+
+// Header flags
+#define EVENT_IDS 0x1 // Pellets are numbered by the pellet engine (IDs) rather than by process (PIDs)
+
+// Event types: 0 to 255 is a pellet that finished with that exit code (see PELLET_ in pellet_engine.h)
+#define EVENT_EATEN_COUNT 0x100 // actor pellets were eaten this tick (planes mode, where pellets have no ID)
+#define EVENT_PASSED_COUNT 0x101 // actor pellets passed the fish this tick
+#define EVENT_COLLISION_COUNT 0x102 // actor pellets were dropped on top of another pellet this tick
+
+struct eventRecord {
+    uint32_t tick; // Tick the event happened on
+    int32_t actor; // Pellet PID or ID (its low 32 bits, or the number of pellets for the _COUNT types)
+    uint16_t type; // Exit code of the pellet or one of the EVENT_ types
+    uint16_t fish; // Number of the fish that ate the pellet (0 if none or not known)
+    int32_t row; // Where the pellet was when it finished (-1 if not known)
+    int32_t col;
+    uint32_t high; // High 32 bits of a pellet ID (always 0 in a version 1 log, see eventActor)
+};
+
+// One slot of the ring buffer, sequence says whether the slot is free for a writer or holds an event for the reader
+struct eventSlot {
+    uint64_t sequence;
+    struct eventRecord record;
+};
+
+struct eventLog {
+    FILE *file; // The log file
+    struct eventSlot *slots; // EVENT_RING slots
+    uint64_t tail; // Next slot a producer claims
+    uint64_t head; // Next slot the writer thread reads (only the writer thread touches it)
+    bool stopping; // Set once the writer should drain the ring and exit
+    pthread_t writer; // Thread writing the ring to the file
+};
+
+/* Returns the whole pellet PID or ID (or count) of record
+ */
+static inline uint64_t eventActor( const struct eventRecord *record ){
+    return ((uint64_t)record->high << 32) | (uint32_t)record->actor;
+}
+
+struct eventLog *eventLogOpen( const char *path, uint16_t flags );
+void eventLogWrite( struct eventLog *log, const struct eventRecord *record );
+void eventLogClose( struct eventLog *log );
+void eventLogFormat( FILE *out, uint16_t flags, const struct eventRecord *record );
+
+#endif
@@ -5,141 +5,96 @@
 #include<signal.h>
 #include<string.h>
 #include<unistd.h>
-#include<sys/sem.h>
-#include<sys/shm.h>
-#include<sys/stat.h>
 #include<errno.h>
+#include "mill.h"
+#include "mill_ipc.h"
+#include "mill_stats.h"
+#include "fish_plan.h"
+#include "rng.h"
 
-#define SHM_KEY 0x1234 // Shared memory segment key
-#define SEM_KEY 0x5678 // Semaphore key
-#define OBJ_PERMS ( S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP ) // Read/Write permissions for owner or group owner
-#define ROW 16 // Max number of rows for the matrix shmp
-#define COL 16 // Max number of columns for the matrix shmp
+// The following global variable will be in all three source files
+struct millHeader *shmp; // Shared segment (header with the geometry followed by the 2D char array)
 
-// The following four global variables will be in all three source files
-char (*shmp)[ROW][COL]; // Initialize a 2D char array
-int shmid; // Initialize the shared memory ID
-int semid; // For use with the semaphore set
+// Geometry of the matrix, read from the header swim_mill wrote
+int rows;
+int cols;
+struct rng fishRng; // Random number stream of the fish (seeded from the run seed)
 
 // Prototype Functions (Comments on details are made after the main function)
-void shmgetErrorDet( void );
-void shmatErrorDet( void );
-int findPellet( int *col );
 void movement( int *col, int direction );
-void semgetctlErrorDet( void );
-void semopErrorDet( bool lock );
+void lockRows( int first, int last, bool lock );
 
 int main( int argc, char *argv[] ){
     printf( "fish process has begun. fish PID = %d.\n", getpid() );
-    shmgetErrorDet( ); // Gets shared memory
-    shmatErrorDet( ); // Attaches shared memory
-    semgetctlErrorDet(); // Initializes the semaphore set
+    shmp = millIpcAttach( getenv(MILL_IPC_ENV) ); // Attaches the shared memory swim_mill created
+    rows = shmp->rows;
+    cols = shmp->cols;
+    millStatsAttach( getenv(MILL_IPC_ENV) ); // Hot path timings go to swim_mill (only with make STATS=1)
     struct timespec ts; // For creating a slight delay in the case of an eaten pellet
-    srand( time(NULL) ); // For use in some random cases
+    rngSeed( &fishRng, shmp->seed, MILL_STREAM_FISH ); // For use in some random cases
+    // swim_mill -P hands the fish how many ticks to plan ahead (0 heads for the closest pellet)
+    int horizon = (argc > 1) ? atoi( argv[1] ) : 0;
+    struct fishPlan *plan = (horizon > 0) ? fishPlanCreate( shmp, horizon ) : NULL;
+
+    uint32_t tick = millTickNow( shmp ); // swim_mill registered the fish for the tick it was forked on
 
     // Initial location of fish is bottom row in the middle column
-    int row = ROW-1;
-    int col = COL/2;
-    semopErrorDet( true ); // Lock acccess to the shared memory 2D char array
-    (*shmp)[row][col] = 'F';
-    semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
-    sleep(1);
+    int row = rows-1;
+    int col = cols/2;
+    lockRows( row, row, true ); // Lock acccess to the fish row of the shared memory 2D char array
+    millFishEnter( shmp, col, 1 ); // The only fish is fish 1
+    lockRows( row, row, false ); // Unlock acccess to the shared memory 2D char array
+    millTickFishDone( shmp, tick ); // Lets the pellets take their step
+    tick = millTickArrive( shmp, tick ); // Waits for the next tick
 
     int direction; // Will be used to determine which way the fish moves
 
-    // Will continually update location of the fish
-    while(1){
+    // Will continually update location of the fish until swim_mill stops the run
+    while( !millStopped(shmp) && !millTickOver(shmp, tick) ){
         direction = 0; // direction = 0 means stay in the same position
-        semopErrorDet( true ); // Lock acccess to the shared memory 2D char array
-        (*shmp)[row][col] = 'x'; // Update current location with x
-        semopErrorDet( false ); // Lock acccess to the shared memory 2D char array
-        direction = findPellet( &col ); // fish determines the closest pellet
-        semopErrorDet( true ); // Lock acccess to the shared memory 2D char array
+        lockRows( row, row, true ); // Lock acccess to the fish row of the shared memory 2D char array
+        millFishLeave( shmp, col ); // Update current location with x
+        lockRows( row, row, false ); // Unlock acccess to the shared memory 2D char array
+        MILL_STAT_START( decide );
+        if( plan != NULL ){
+            fishPlanUpdate( plan, shmp ); // Takes in the pellets that appeared or went missing since the last tick
+            direction = fishPlanFind( plan, shmp, col, cols/2, &fishRng ); // fish determines the step catching the most pellets
+        } else {
+            direction = millFindPellet( shmp, col, cols/2, &fishRng ); // fish determines the closest pellet
+        }
+        MILL_STAT_END( MILL_STAT_FISH_DECIDE, decide );
+        lockRows( row, row, true ); // Lock acccess to the fish row of the shared memory 2D char array
         movement( &col, direction ); // fish moves in that direction determined by findPellet
-        (*shmp)[ROW-1][col] = 'F'; // Updates that location with an 'F'
-        semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
-        sleep(1);
-    }
-    exit(EXIT_FAILURE); // Exit with an error (If it managed to reach this)
-}
-
-/* Gets shared memory with key
- */
-void shmgetErrorDet( void ){
-    shmid = shmget( SHM_KEY, sizeof(shmp), IPC_CREAT | OBJ_PERMS );
-    // If a -1 is returned, then there is an issue
-    if( shmid == -1 ){
-        fprintf( stderr, "Error with shmget %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
+        millFishEnter( shmp, col, 1 ); // Updates that location with an 'F'
+        lockRows( row, row, false ); // Unlock acccess to the shared memory 2D char array
+        millTickFishDone( shmp, tick ); // Lets the pellets take their step
+        tick = millTickArrive( shmp, tick ); // Waits for the next tick
     }
+    millWaitStop( shmp ); // The run is over, swim_mill stops it once every thread of its own is done
+    exit(EXIT_SUCCESS); // swim_mill stopped the run
 }
 
-/* Attaches shared memory
+/* Locks/unlocks rows first through last of the shared memory 2D char array with whatever the mill's lock mode is
  */
-void shmatErrorDet( void ){
-    shmp = shmat( shmid, NULL, 0 );
-    // If a -1 is returned, then there is an issue
-    if( shmp == (void *) -1 ){
-        fprintf( stderr, "Error with shmat: %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
-    }
-}
-
-/* Finds the closest pellet based on current location of the fish
- */
-int findPellet( int *col ){
-    int i, j, searchLeft, searchRight, distanceLeft, distanceRight;
-    // Will limit the view to the rows above the fish
-    for( i = (ROW - 2); i >= 0; i-- ){
-        distanceLeft = COL;
-        distanceRight = COL;
-        searchLeft = *col - ((ROW - 1) - i); // Determines how many number of columns the fish should look at on the left side
-        searchRight = *col + ((ROW - 1) - i); // Determines how many number of columns the fish should look at on the right side
-        searchLeft = (searchLeft < 0) ? 0 : searchLeft; // Limits how far left the fish can look to column 0
-        searchRight = (searchRight >= COL) ? (COL-1) : searchRight; // Limits how far right the fish can look to column COL-1
-        // The following if statment and two for loops will limit the view to only what can potentially be eaten (Imagine a V)
-        j = *col; // Start by setting j equal to the same column as the fish
-        // This if statement checks the column the fish is in for the pellet (closest pellet at that point) at row i
-        if( (*shmp)[i][j] == 'P' || (*shmp)[i + 1][j] == 'E' ){
-          return 0; // Stay in same position
-        }
-        // This particular for loop searches the left side
-        for( j = (*col - 1); j >= searchLeft; j-- ){
-            // If a pellet is found, will return a number that determines the direction to move
-            if( (*shmp)[i][j] == 'P' ){
-                distanceLeft = (*col) % j; // Distance to the first found pellet on the left side
-                break;
-            }
-        }
-        // This particular for loop searches the right side
-        for( j = (*col + 1); j <= searchRight; j++ ){
-            if( (*shmp)[i][j] == 'P' ){
-                distanceRight = j % (*col); // Distance to the first found pellet on the right side
-                break;
-            }
+void lockRows( int first, int last, bool lock ){
+    MILL_STAT_START( start );
+    if( shmp->lockMode == MILL_LOCK_GLOBAL ){
+        if( lock ){
+            millLockGlobal( shmp );
+        } else {
+            millUnlockGlobal( shmp );
         }
-        // This set of if/else determines whether to go left or right based on the distances of the pellets
-        if( distanceLeft < distanceRight ){
-            return -1;
-        } else if( distanceLeft > distanceRight ){
-            return 1;
-        } else if( distanceLeft == distanceRight && distanceLeft < COL ){
-            // If they're the same distance, randomly choose left or right direction
-            // srand( time(NULL) );
-            int randomDir = rand() % 2; // Either 0 or 1
-            randomDir = (randomDir == 0 ) ? -1 : 1; // if 0, then choose left else right
-            return randomDir;
+    } else if( shmp->lockMode == MILL_LOCK_STRIPED ){
+        if( lock ){
+            millLockRows( shmp, first, last );
+        } else {
+            millUnlockRows( shmp, first, last );
         }
     }
-    // If a pellet isn't found, this section will have the fish return to the center of the row
-    if( *col < (COL/2) ){
-        return 1; // Go right
-    } else if( *col > (COL/2) ){
-        return -1; // Go left
-    } else {
-        return 0; // Stay in the same position
+    // MILL_LOCK_CAS has nothing to lock, cells change with atomic stores and compare and swap
+    if( lock && shmp->lockMode != MILL_LOCK_CAS ){
+        MILL_STAT_END( MILL_STAT_LOCK_WAIT, start ); // How long it took to get the lock
     }
-    return 0; // If it makes it here (shouldn't) then stay in the same spot
 }
 
 /* Will cause the fish to move in the direction returned by the findPellet function
@@ -149,7 +104,7 @@ void movement( int *col, int direction ){
     // direction = 1 means go right
     // direction = -1 means go left
     if( direction == 1){
-        if( *col < (COL-1) ){
+        if( *col < (cols-1) ){
             *col = *col + 1; // Go right
         } else {
             *col = *col; // Stay in the same spot (so the fish doesn't leave the last row)
@@ -165,44 +120,3 @@ void movement( int *col, int direction ){
     }
 }
 
-/* Creates the semaphore set and intializes them
- */
-void semgetctlErrorDet( void ){
-    semid = semget( SEM_KEY, 1, IPC_CREAT | OBJ_PERMS ); // Creates semaphore ID with appropriate permissions
-    // Error Detection
-    if( semid == -1 ){
-        fprintf( stderr, "Error with semget %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
-    }
-    // Initializes semaphore as well as perform error detection
-    if( semctl(semid, 0, SETVAL, 1) == -1 ){
-        fprintf( stderr, "Error with semctl initialization %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
-    }
-}
-
-/* Perform lock/unlock operations on the opened semaphore set
- */
-void semopErrorDet( bool lock ){
-    struct sembuf sops; // struct with data members needed for semop system call
-    // Locking blocks any other process from accessing critical region (shared 2D array)
-    if( lock ){
-        sops.sem_num = 0;
-        sops.sem_op = -1;
-        sops.sem_flg = 0;
-        if( semop(semid, &sops, 1) == -1 ){
-            fprintf( stderr, "Error with semop lock operation. %s\n", strerror(errno) );
-        }
-    // Unlocking allows further access to critical region (shared 2D array)
-    } else if( !lock ){
-        sops.sem_num = 0;
-        sops.sem_op = 1;
-        sops.sem_flg = 0;
-        if( semop(semid, &sops, 1) == -1 ){
-            fprintf( stderr, "Error with semop unlock operation. %s\n", strerror(errno) );
-        }
-    // Should not get to this else statement (debugging)
-    } else {
-        printf( "How did you wind up here?\n" );
-    }
-}
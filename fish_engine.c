@@ -0,0 +1,234 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "fish_engine.h"
+#include "mill_stats.h"
+
+// Prototype Functions (Comments on details are made with each function)
+static void *fishWorker( void *arg );
+static void chooseDirections( struct fishEngine *engine, int index );
+
+/* Creates the fish pool, puts every fish on the last row and starts the worker threads that steer them
+ * Fish are spread evenly over the row (a single fish starts in the middle column like ./fish does)
+ */
+struct fishEngine *fishEngineCreate( struct millHeader *mill, int count, int workers, uint64_t seed,
+                                     void (*lock)( int first, int last, bool lock ) ){
+    struct fishEngine *engine = calloc( 1, sizeof(*engine) );
+    if( engine == NULL ){
+        fprintf( stderr, "Error allocating the fish engine: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    engine->mill = mill;
+    engine->rows = mill->rows;
+    engine->cols = mill->cols;
+    engine->lock = lock;
+    engine->count = count;
+    engine->workers = (workers > count) ? count : workers; // A worker without a fish would never have work
+    engine->workers = (engine->workers < 0) ? 0 : engine->workers;
+    engine->fish = calloc( count, sizeof(struct fishRecord) );
+    engine->taken = calloc( engine->cols, sizeof(bool) );
+    if( engine->fish == NULL || engine->taken == NULL ){
+        fprintf( stderr, "Error allocating the fish pool: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    engine->lock( engine->rows - 1, engine->rows - 1, true ); // Lock acccess to the fish row of the shared memory 2D char array
+    for( int i = 0; i < count; i++ ){
+        struct fishRecord *fish = &engine->fish[i];
+        fish->id = i + 1;
+        fish->home = (int)((2L * i + 1) * engine->cols / (2L * count)); // Middle of the fish's share of the row
+        fish->col = fish->home;
+        rngSeed( &fish->rng, seed, (i == 0) ? MILL_STREAM_FISH : MILL_STREAM_FISHES + fish->id );
+        millFishEnter( mill, fish->col, fish->id );
+    }
+    engine->lock( engine->rows - 1, engine->rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+
+    pthread_mutex_init( &engine->mutex, NULL );
+    pthread_cond_init( &engine->start, NULL );
+    pthread_cond_init( &engine->done, NULL );
+    engine->threads = calloc( engine->workers + 1, sizeof(pthread_t) );
+    engine->workerArgs = calloc( engine->workers + 1, sizeof(struct fishWorkerArg) );
+    if( engine->threads == NULL || engine->workerArgs == NULL ){
+        fprintf( stderr, "Error allocating the fish workers: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < engine->workers; i++ ){
+        engine->workerArgs[i].engine = engine;
+        engine->workerArgs[i].index = i;
+        int code = pthread_create( &engine->threads[i], NULL, fishWorker, &engine->workerArgs[i] );
+        if( code ){
+            fprintf( stderr, "pthread_create failed with code %d.\n", code );
+            exit(EXIT_FAILURE);
+        }
+    }
+    return engine;
+}
+
+/* Moves every fish one step, the same step ./fish takes each tick
+ * Every fish leaves its cell first, then the workers pick a direction for their share of the fish in parallel
+ * (only reading the matrix), and finally the moves are made one fish at a time in fish number order:
+ * a fish can't move onto a column another fish was on or has already claimed, so when two fish go for the
+ * same pellet the lower numbered one gets there and the other one stays where it is
+ */
+void fishEngineStep( struct fishEngine *engine ){
+    engine->lock( engine->rows - 1, engine->rows - 1, true ); // Lock acccess to the fish row of the shared memory 2D char array
+    for( int i = 0; i < engine->count; i++ ){
+        millFishLeave( engine->mill, engine->fish[i].col ); // Update current location with x
+    }
+    engine->lock( engine->rows - 1, engine->rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+
+    if( engine->plan != NULL ){
+        fishPlanUpdate( engine->plan, engine->mill ); // Once for every fish, before any of them looks at it
+    }
+    if( engine->workers == 0 ){
+        chooseDirections( engine, 0 ); // Without worker threads the caller steers every fish itself
+    } else {
+        pthread_mutex_lock( &engine->mutex );
+        engine->pending = engine->workers;
+        engine->generation++;
+        pthread_cond_broadcast( &engine->start );
+        while( engine->pending > 0 ){
+            pthread_cond_wait( &engine->done, &engine->mutex );
+        }
+        pthread_mutex_unlock( &engine->mutex );
+    }
+
+    memset( engine->taken, 0, engine->cols * sizeof(bool) );
+    for( int i = 0; i < engine->count; i++ ){
+        engine->taken[engine->fish[i].col] = true; // Nobody moves onto a column a fish started the step on
+    }
+    engine->lock( engine->rows - 1, engine->rows - 1, true );
+    for( int i = 0; i < engine->count; i++ ){
+        struct fishRecord *fish = &engine->fish[i];
+        int target = fish->col + fish->direction;
+        target = (target < 0) ? 0 : target; // So the fish doesn't leave the last row
+        target = (target >= engine->cols) ? (engine->cols - 1) : target;
+        if( target != fish->col && !engine->taken[target] ){
+            engine->taken[target] = true;
+            fish->col = target;
+            fish->travel++;
+        }
+        millFishEnter( engine->mill, fish->col, fish->id ); // Updates that location with an 'F'
+    }
+    engine->lock( engine->rows - 1, engine->rows - 1, false );
+}
+
+/* Moves every fish by moves[i] columns (-1, 0 or 1, the move fish i made in a recorded step, see mill_trace.h)
+ * instead of having the fish look for pellets
+ * A move that would take a fish off the last row leaves it at the edge, the way fishEngineStep keeps it there
+ */
+void fishEngineReplay( struct fishEngine *engine, const int8_t *moves ){
+    engine->lock( engine->rows - 1, engine->rows - 1, true ); // Lock acccess to the fish row of the shared memory 2D char array
+    for( int i = 0; i < engine->count; i++ ){
+        millFishLeave( engine->mill, engine->fish[i].col );
+    }
+    for( int i = 0; i < engine->count; i++ ){
+        struct fishRecord *fish = &engine->fish[i];
+        int target = fish->col + moves[i];
+        target = (target < 0) ? 0 : target; // So the fish doesn't leave the last row
+        target = (target >= engine->cols) ? (engine->cols - 1) : target;
+        fish->travel += (target != fish->col);
+        fish->col = target;
+        millFishEnter( engine->mill, fish->col, fish->id );
+    }
+    engine->lock( engine->rows - 1, engine->rows - 1, false );
+}
+
+/* Makes every fish steer by a look-ahead plan of horizon ticks (see fish_plan.h) instead of heading for the
+ * closest pellet, 0 turns planning off
+ * Must be called before the first step
+ */
+void fishEnginePlan( struct fishEngine *engine, int horizon ){
+    if( engine->plan != NULL ){
+        fishPlanDestroy( engine->plan );
+        engine->plan = NULL;
+    }
+    if( horizon > 0 ){
+        engine->plan = fishPlanCreate( engine->mill, horizon );
+    }
+}
+
+/* Puts back the fish saved by a checkpoint: where they are, their home columns, distance travelled and random
+ * number streams (the matrix itself comes back with millRestore, which already has them on the last row)
+ * Must be called before the first step
+ */
+void fishEngineRestore( struct fishEngine *engine, const struct fishRecord *fish, int count ){
+    if( count != engine->count ){
+        fprintf( stderr, "The checkpoint holds %d fish, the pool has %d.\n", count, engine->count );
+        exit(EXIT_FAILURE);
+    }
+    memcpy( engine->fish, fish, count * sizeof(struct fishRecord) );
+}
+
+/* Stops the worker threads and frees the pool
+ * The fish stay where they are on the matrix (like ./fish when it exits), so the final matrix still shows them
+ */
+void fishEngineDestroy( struct fishEngine *engine ){
+    pthread_mutex_lock( &engine->mutex );
+    engine->stopping = true;
+    pthread_cond_broadcast( &engine->start );
+    pthread_mutex_unlock( &engine->mutex );
+    for( int i = 0; i < engine->workers; i++ ){
+        pthread_join( engine->threads[i], NULL );
+    }
+    pthread_mutex_destroy( &engine->mutex );
+    pthread_cond_destroy( &engine->start );
+    pthread_cond_destroy( &engine->done );
+    free( engine->threads );
+    free( engine->workerArgs );
+    if( engine->plan != NULL ){
+        fishPlanDestroy( engine->plan );
+    }
+    free( engine->taken );
+    free( engine->fish );
+    free( engine );
+}
+
+/* Worker thread that picks directions for its own share of the fish once per step
+ */
+static void *fishWorker( void *arg ){
+    struct fishWorkerArg *worker = arg;
+    struct fishEngine *engine = worker->engine;
+    unsigned long seen = 0; // Last step this worker has run
+
+    pthread_mutex_lock( &engine->mutex );
+    while( 1 ){
+        while( engine->generation == seen && !engine->stopping ){
+            pthread_cond_wait( &engine->start, &engine->mutex );
+        }
+        if( engine->stopping ){
+            break;
+        }
+        seen = engine->generation;
+        pthread_mutex_unlock( &engine->mutex );
+
+        chooseDirections( engine, worker->index );
+
+        pthread_mutex_lock( &engine->mutex );
+        if( --engine->pending == 0 ){
+            pthread_cond_signal( &engine->done );
+        }
+    }
+    pthread_mutex_unlock( &engine->mutex );
+    return NULL;
+}
+
+/* Picks the direction of every fish in worker index's share (a contiguous run of fish numbers, so neighbouring
+ * fish that look at the same part of the matrix are usually handled by the same worker)
+ */
+static void chooseDirections( struct fishEngine *engine, int index ){
+    int workers = (engine->workers > 0) ? engine->workers : 1;
+    int first = (int)((long)engine->count * index / workers);
+    int last = (int)((long)engine->count * (index + 1) / workers);
+    for( int i = first; i < last; i++ ){
+        struct fishRecord *fish = &engine->fish[i];
+        MILL_STAT_START( decide );
+        if( engine->plan != NULL ){
+            fish->direction = fishPlanFind( engine->plan, engine->mill, fish->col, fish->home, &fish->rng );
+        } else {
+            fish->direction = millFindPellet( engine->mill, fish->col, fish->home, &fish->rng );
+        }
+        MILL_STAT_END( MILL_STAT_FISH_DECIDE, decide );
+    }
+}
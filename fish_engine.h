@@ -0,0 +1,56 @@
+#ifndef FISH_ENGINE_H
+#define FISH_ENGINE_H
+
+#include<stdbool.h>
+#include<pthread.h>
+#include "mill.h"
+#include "rng.h"
+#include "fish_plan.h"
+
+// A single fish kept inside the pool instead of a separate ./fish process
+struct fishRecord {
+    int id; // Fish number (counting from 1, the same number millFishAt returns)
+    int col; // Current column of the fish (fish always swim on the last row)
+    int home; // Column the fish returns to when there is no pellet to chase
+    int direction; // Direction picked during the current step (-1 left, 0 stay, 1 right)
+    long travel; // Number of columns the fish has moved so far
+    struct rng rng; // Random number stream of the fish (breaks ties between equally close pellets)
+};
+
+struct fishEngine;
+
+// Handed to each worker thread so it knows which fish it owns
+struct fishWorkerArg {
+    struct fishEngine *engine;
+    int index;
+};
+
+struct fishEngine {
+    struct millHeader *mill; // The shared segment holding the 2D char array being simulated
+    int rows; // Number of rows in the matrix
+    int cols; // Number of columns in the matrix
+    void (*lock)( int first, int last, bool lock ); // Locks/unlocks rows first through last of the matrix
+    int count; // Number of fish
+    struct fishRecord *fish; // Every fish, in fish number order
+    bool *taken; // Columns already claimed by a fish during the current step
+    struct fishPlan *plan; // Look-ahead plan every fish steers by (NULL to head for the closest pellet instead)
+    int workers; // Number of worker threads (0 means the caller looks for pellets for every fish itself)
+    pthread_t *threads; // Worker threads
+    struct fishWorkerArg *workerArgs; // Argument given to each worker thread
+    pthread_mutex_t mutex; // Protects the fields below
+    pthread_cond_t start; // Signaled when a new step begins
+    pthread_cond_t done; // Signaled when the last worker finishes a step
+    unsigned long generation; // Incremented once per step
+    int pending; // Workers that haven't finished the current step
+    bool stopping; // Set when the workers should exit
+};
+
+struct fishEngine *fishEngineCreate( struct millHeader *mill, int count, int workers, uint64_t seed,
+                                     void (*lock)( int first, int last, bool lock ) );
+void fishEngineStep( struct fishEngine *engine );
+void fishEngineReplay( struct fishEngine *engine, const int8_t *moves );
+void fishEnginePlan( struct fishEngine *engine, int horizon );
+void fishEngineRestore( struct fishEngine *engine, const struct fishRecord *fish, int count );
+void fishEngineDestroy( struct fishEngine *engine );
+
+#endif
@@ -0,0 +1,152 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "fish_plan.h"
+
+// Prototype Functions (Comments on details are made with each function)
+static int planSlot( const struct fishPlan *plan, long time );
+
+/* Creates the plan of a mill looking horizon ticks ahead (no further than the top row)
+ * It starts out seeing no pellet, so the first update takes in every pellet in view
+ */
+struct fishPlan *fishPlanCreate( const struct millHeader *mill, int horizon ){
+    struct fishPlan *plan = calloc( 1, sizeof(*plan) );
+    if( plan == NULL ){
+        fprintf( stderr, "Error allocating the fish plan: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    plan->rows = mill->rows;
+    plan->cols = mill->cols;
+    plan->words = mill->words;
+    plan->horizon = (horizon > plan->rows - 1) ? plan->rows - 1 : horizon; // Nothing lands from above the top row
+    plan->horizon = (plan->horizon > FISH_PLAN_MAX_HORIZON) ? FISH_PLAN_MAX_HORIZON : plan->horizon;
+    plan->horizon = (plan->horizon < 0) ? 0 : plan->horizon;
+    plan->slots = plan->horizon + 1;
+    plan->bits = calloc( (size_t)plan->slots * plan->words, sizeof(uint64_t) );
+    plan->counts = calloc( plan->slots, sizeof(uint32_t) );
+    plan->value = calloc( (size_t)plan->slots * plan->cols, sizeof(uint16_t) );
+    plan->dirty = calloc( (size_t)plan->slots * plan->words, sizeof(uint64_t) );
+    plan->changed = calloc( 2 * (size_t)plan->words, sizeof(uint64_t) );
+    if( plan->bits == NULL || plan->counts == NULL || plan->value == NULL || plan->dirty == NULL || plan->changed == NULL ){
+        fprintf( stderr, "Error allocating the fish plan: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    return plan;
+}
+
+/* Brings the plan up to the next tick: called once per tick, before any fish picks its step
+ * The time past the horizon takes the slot of the time the fish are on now (which no plan needs any more), the
+ * rows above the fish are compared with the pellets seen last tick, and the values are worked out again from the
+ * latest time down, only for the columns under a changed pellet and the columns next to a changed value (kept as
+ * bit masks, so far apart changes never make the columns between them work out again)
+ */
+void fishPlanUpdate( struct fishPlan *plan, const struct millHeader *mill ){
+    int cols = plan->cols;
+    int words = plan->words;
+    long now = ++plan->now;
+    int past = planSlot( plan, now + plan->horizon + 1 ); // Nothing is caught past the horizon
+    memset( &plan->bits[(size_t)past * words], 0, words * sizeof(uint64_t) );
+    memset( &plan->value[(size_t)past * cols], 0, cols * sizeof(uint16_t) );
+    plan->counts[past] = 0;
+
+    // A pellet d rows above the fish lands d ticks from now, so only a pellet that appeared or went missing changes anything
+    for( int d = 1; d <= plan->horizon; d++ ){
+        int row = plan->rows - 1 - d;
+        int slot = planSlot( plan, now + d );
+        uint64_t *seen = &plan->bits[(size_t)slot * words];
+        uint64_t *dirty = &plan->dirty[(size_t)slot * words];
+        uint32_t pellets = millRowPellets( mill, row );
+        if( pellets == 0 && plan->counts[slot] == 0 ){
+            memset( dirty, 0, words * sizeof(uint64_t) ); // No pellet then or now
+            continue;
+        }
+        uint32_t count = 0;
+        for( int w = 0; w < words; w++ ){
+            uint64_t bits = (pellets == 0) ? 0 : millPelletBits( mill, row, w, 0, cols - 1 );
+            dirty[w] = bits ^ seen[w];
+            seen[w] = bits;
+            count += __builtin_popcountll( bits );
+        }
+        plan->counts[slot] = count;
+    }
+
+    uint64_t *later = plan->changed; // Columns whose value changed at the time after the one being worked out
+    uint64_t *changed = plan->changed + words;
+    memset( later, 0, words * sizeof(uint64_t) ); // Nothing changes past the horizon
+    uint64_t lastMask = (cols % 64 == 0) ? ~(uint64_t)0 : ((uint64_t)1 << (cols % 64)) - 1; // Columns in the last word
+    for( int d = plan->horizon; d >= 1; d-- ){
+        int slot = planSlot( plan, now + d );
+        const uint16_t *next = &plan->value[(size_t)planSlot(plan, now + d + 1) * cols];
+        uint16_t *value = &plan->value[(size_t)slot * cols];
+        const uint64_t *bits = &plan->bits[(size_t)slot * words];
+        const uint64_t *dirty = &plan->dirty[(size_t)slot * words];
+        for( int w = 0; w < words; w++ ){
+            // A changed value reaches the columns next to it one time earlier
+            uint64_t spread = later[w] | (later[w] << 1) | (later[w] >> 1);
+            spread |= (w > 0) ? later[w - 1] >> 63 : 0;
+            spread |= (w + 1 < words) ? later[w + 1] << 63 : 0;
+            uint64_t todo = (spread | dirty[w]) & ((w + 1 < words) ? ~(uint64_t)0 : lastMask);
+            changed[w] = 0;
+            while( todo ){
+                int c = w * 64 + __builtin_ctzll( todo );
+                todo &= todo - 1;
+                uint16_t best = next[c];
+                if( c > 0 && next[c - 1] > best ){
+                    best = next[c - 1];
+                }
+                if( c + 1 < cols && next[c + 1] > best ){
+                    best = next[c + 1];
+                }
+                uint16_t caught = best + (uint16_t)((bits[w] >> (c % 64)) & 1);
+                if( caught != value[c] ){
+                    value[c] = caught;
+                    changed[w] |= (uint64_t)1 << (c % 64);
+                }
+            }
+        }
+        uint64_t *swap = later;
+        later = changed;
+        changed = swap;
+    }
+}
+
+/* Returns the direction a fish at column col should move in: -1 for left, 1 for right and 0 to stay
+ * The fish takes the step with the most pellets still catchable behind it, staying put when that is as good as
+ * moving and picking a side at random when left and right are equally good
+ * With no pellet it can catch within the horizon it falls back on millFindPellet (heading for a pellet further up,
+ * or back to column home)
+ */
+int fishPlanFind( const struct fishPlan *plan, struct millHeader *mill, int col, int home, struct rng *rng ){
+    const uint16_t *next = &plan->value[(size_t)planSlot(plan, plan->now + 1) * plan->cols];
+    uint16_t stay = next[col];
+    uint16_t left = (col > 0) ? next[col - 1] : 0;
+    uint16_t right = (col + 1 < plan->cols) ? next[col + 1] : 0;
+    if( stay == 0 && left == 0 && right == 0 ){
+        return millFindPellet( mill, col, home, rng );
+    }
+    if( stay >= left && stay >= right ){
+        return 0; // Stay in same position
+    }
+    if( left == right ){
+        return (rngBelow(rng, 2) == 0) ? -1 : 1; // Equally good, randomly choose left or right
+    }
+    return (left > right) ? -1 : 1;
+}
+
+/* Frees the plan
+ */
+void fishPlanDestroy( struct fishPlan *plan ){
+    free( plan->bits );
+    free( plan->counts );
+    free( plan->value );
+    free( plan->dirty );
+    free( plan->changed );
+    free( plan );
+}
+
+/* Returns the slot of landing time time in the plan's rows
+ */
+static int planSlot( const struct fishPlan *plan, long time ){
+    return (int)(time % plan->slots);
+}
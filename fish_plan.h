@@ -0,0 +1,43 @@
+#ifndef FISH_PLAN_H
+#define FISH_PLAN_H
+
+#include<stdint.h>
+#include "mill.h"
+#include "rng.h"
+
+/* Look-ahead planner for the fish: instead of heading for the closest pellet (millFindPellet) a planning fish
+ * takes the step that starts the path catching the most pellets over the next horizon ticks
+ * Every pellet falls one row per tick, so a pellet d rows above the fish lands on the fish row after the fish has
+ * taken d more steps, and it is caught if the fish is under it then. For every landing time L and column c the
+ * plan keeps the most pellets a fish on column c at time L can still catch:
+ *   value[L][c] = (pellet landing on c at L) + max(value[L + 1][c - 1], value[L + 1][c], value[L + 1][c + 1])
+ * None of it depends on where the fish is, so one plan serves every fish of a pool and is kept across ticks:
+ * landing times are counted from the start of the run, so a pellet that keeps falling never changes its entry.
+ * Each tick the rows above the fish are compared with the pellets the plan last saw, and only the values under
+ * a pellet that appeared or went missing (a new pellet, or one another fish ate) are worked out again, going
+ * down the cone of earlier times it reaches and stopping as soon as the values no longer change
+ * New pellets can't be foreseen, and fish of a pool each follow the plan on their own
+ */
+
+#define FISH_PLAN_MAX_HORIZON 65535 // Values are 16 bits, and a fish can't catch more pellets than ticks looked ahead
+
+struct fishPlan {
+    int rows; // Number of rows in the matrix
+    int cols; // Number of columns in the matrix
+    int words; // 64 bit words per row of pellets
+    int horizon; // Ticks looked ahead (rows above the fish row taken into account)
+    int slots; // Landing times kept (horizon, plus the time past the horizon whose values are all 0)
+    long now; // Ticks the plan has been brought up to (landing times are counted in ticks from the start)
+    uint64_t *bits; // Pellets landing at each time as last seen (slots rows of words, indexed by time % slots)
+    uint32_t *counts; // Number of pellets in each row of bits
+    uint16_t *value; // Most pellets a fish on each column can still catch from each time (slots rows of cols)
+    uint64_t *dirty; // Columns of each time whose pellets changed during the current update (slots rows of words)
+    uint64_t *changed; // Columns whose value changed at the time worked out last, and at the one being worked out (2 rows of words)
+};
+
+struct fishPlan *fishPlanCreate( const struct millHeader *mill, int horizon );
+void fishPlanUpdate( struct fishPlan *plan, const struct millHeader *mill );
+int fishPlanFind( const struct fishPlan *plan, struct millHeader *mill, int col, int home, struct rng *rng );
+void fishPlanDestroy( struct fishPlan *plan );
+
+#endif
@@ -0,0 +1,162 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<pthread.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<sys/ipc.h>
+#include<sys/mman.h>
+#include<sys/sem.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<errno.h>
+#include "mill.h"
+#include "mill_ipc.h"
+
+/* Measures what one lock/unlock pair costs with each way the actors have had of locking the matrix
+ * "semop" is the SysV semaphore swim_mill, fish and pellet used to share, "futex" is the MILL_LOCK_GLOBAL lock
+ * inside a POSIX shared memory mill (millLockGlobal), and "mutex" is a process-shared pthread mutex in shared memory
+ * Every configuration forks 1, 2, 4, ... processes that each take and release the lock pairs times, bumping a
+ * shared counter while they hold it (the counter is checked at the end, so a lock that doesn't exclude is caught)
+ * Output is CSV: primitive,processes,pairs,seconds,ns_per_pair
+ */
+
+#define PAIRS 200000 // Default number of lock/unlock pairs each process makes
+#define MAX_PROCESSES 4 // Default max number of processes (runs 1, 2, 4, ... up to this)
+
+#define PRIMITIVE_SEMOP 0
+#define PRIMITIVE_FUTEX 1
+#define PRIMITIVE_MUTEX 2
+
+// Everything the processes share besides the mill
+struct benchShared {
+    pthread_mutex_t mutex; // Process-shared mutex of the "mutex" primitive
+    long counter; // Bumped under the lock
+};
+
+struct millHeader *mill; // POSIX shared memory mill holding the futex lock
+struct benchShared *shared; // Anonymous shared mapping inherited by every forked process
+int semid; // Private SysV semaphore of the "semop" primitive
+
+// Prototype Functions (Comments on details are made after the main function)
+void run( int primitive, long pairs );
+void lockPrimitive( int primitive, bool lock );
+double now( void );
+
+int main( int argc, char *argv[] ){
+    long pairs = PAIRS;
+    int maxProcesses = MAX_PROCESSES;
+    int option;
+    const char *primitiveNames[] = { "semop", "futex", "mutex" };
+
+    while( (option = getopt(argc, argv, "n:p:")) != -1 ){
+        switch( option ){
+            case 'n':
+                pairs = atol( optarg );
+                break;
+            case 'p':
+                maxProcesses = atoi( optarg );
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-n pairs per process] [-p max processes]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( pairs < 1 || maxProcesses < 1 ){
+        fprintf( stderr, "Invalid arguments.\n" );
+        exit(EXIT_FAILURE);
+    }
+
+    char name[MILL_IPC_NAME_MAX];
+    millIpcName( name, sizeof(name), getpid() );
+    mill = millIpcCreate( name, millSegmentSize(2, 1) );
+    millInit( mill, 2, 1, MILL_LOCK_GLOBAL, 0, 0 );
+    semid = semget( IPC_PRIVATE, 1, IPC_CREAT | S_IRUSR | S_IWUSR );
+    if( semid == -1 || semctl(semid, 0, SETVAL, 1) == -1 ){
+        fprintf( stderr, "Error with semget %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    shared = mmap( NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( shared == MAP_FAILED ){
+        fprintf( stderr, "Error with mmap: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+    pthread_mutex_init( &shared->mutex, &attr );
+    pthread_mutexattr_destroy( &attr );
+
+    printf( "primitive,processes,pairs,seconds,ns_per_pair\n" );
+    for( int primitive = PRIMITIVE_SEMOP; primitive <= PRIMITIVE_MUTEX; primitive++ ){
+        for( int processes = 1; processes <= maxProcesses; processes *= 2 ){
+            shared->counter = 0;
+            double start = now();
+            for( int i = 0; i < processes; i++ ){
+                pid_t child = fork();
+                if( child < 0 ){
+                    fprintf( stderr, "Error with fork: %s\n", strerror(errno) );
+                    exit(EXIT_FAILURE);
+                } else if( child == 0 ){
+                    run( primitive, pairs );
+                    _exit(EXIT_SUCCESS); // Leaves the parent's stdio buffer alone
+                }
+            }
+            for( int i = 0; i < processes; i++ ){
+                wait( NULL );
+            }
+            double seconds = now() - start;
+            if( shared->counter != pairs * processes ){
+                fprintf( stderr, "%s let %ld of %ld increments race.\n", primitiveNames[primitive], pairs * processes - shared->counter, pairs * processes );
+            }
+            printf( "%s,%d,%ld,%.3f,%.1f\n", primitiveNames[primitive], processes, pairs * processes, seconds, seconds * 1e9 / (pairs * processes) );
+        }
+    }
+
+    pthread_mutex_destroy( &shared->mutex );
+    munmap( shared, sizeof(*shared) );
+    semctl( semid, 0, IPC_RMID );
+    millIpcDetach( mill );
+    millIpcRemove( name );
+    return 0;
+}
+
+/* Takes and releases the lock pairs times, bumping the shared counter while holding it
+ */
+void run( int primitive, long pairs ){
+    for( long i = 0; i < pairs; i++ ){
+        lockPrimitive( primitive, true );
+        shared->counter++;
+        lockPrimitive( primitive, false );
+    }
+}
+
+/* Locks/unlocks with the given primitive
+ */
+void lockPrimitive( int primitive, bool lock ){
+    if( primitive == PRIMITIVE_SEMOP ){
+        struct sembuf sops = { 0, lock ? -1 : 1, 0 };
+        if( semop(semid, &sops, 1) == -1 ){
+            fprintf( stderr, "Error with semop. %s\n", strerror(errno) );
+        }
+    } else if( primitive == PRIMITIVE_FUTEX ){
+        if( lock ){
+            millLockGlobal( mill );
+        } else {
+            millUnlockGlobal( mill );
+        }
+    } else if( lock ){
+        pthread_mutex_lock( &shared->mutex );
+    } else {
+        pthread_mutex_unlock( &shared->mutex );
+    }
+}
+
+/* Returns the current time in seconds
+ */
+double now( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,1019 @@
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<linux/futex.h>
+#include<linux/mempolicy.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include "mill.h"
+
+/* Rounds n up to the next multiple of MILL_ALIGN
+ */
+static size_t millAlign( size_t n ){
+    return (n + MILL_ALIGN - 1) / MILL_ALIGN * MILL_ALIGN;
+}
+
+/* Rounds n up to the next multiple of a tile's size, so every tile has a page of its own
+ */
+static size_t millTileAlign( size_t n ){
+    return (n + MILL_TILE_CELLS - 1) / MILL_TILE_CELLS * MILL_TILE_CELLS;
+}
+
+/* Returns the number of stripe locks used for a matrix with the given number of rows
+ */
+static uint32_t millStripeCount( int rows ){
+    uint32_t stripes = 1;
+    while( stripes < (uint32_t)rows && stripes < MILL_MAX_STRIPES ){
+        stripes *= 2;
+    }
+    return stripes;
+}
+
+/* Works out where everything goes in a segment with the given geometry
+ */
+static void millLayout( struct millHeader *mill, int rows, int cols ){
+    mill->rows = rows;
+    mill->cols = cols;
+    mill->stripes = millStripeCount( rows );
+    mill->words = (cols + 63) / 64;
+    mill->blocks = (rows + MILL_BLOCK_ROWS - 1) / MILL_BLOCK_ROWS;
+    mill->tiles = mill->blocks * mill->words;
+    mill->bitPages = (mill->words + MILL_PAGE_WORDS - 1) / MILL_PAGE_WORDS;
+    size_t plane = (size_t)mill->blocks * mill->bitPages * MILL_TILE_CELLS; // Bytes in the pellet bitmap and in each bit-plane
+    mill->stripeOffset = millAlign( sizeof(struct millHeader) );
+    mill->blockPelletOffset = mill->stripeOffset + (size_t)(mill->stripes + 2) * MILL_ALIGN; // Stripe locks, the global lock, then the contention count
+    mill->rowPelletOffset = millAlign( mill->blockPelletOffset + (size_t)mill->blocks * sizeof(uint32_t) );
+    mill->tilePelletOffset = millAlign( mill->rowPelletOffset + (size_t)rows * sizeof(uint32_t) );
+    mill->pelletOffset = millTileAlign( mill->tilePelletOffset + (size_t)mill->tiles * sizeof(uint32_t) );
+    mill->fishOffset = mill->pelletOffset + plane;
+    mill->eatenOffset = mill->fishOffset + plane;
+    mill->fishIdOffset = mill->eatenOffset + plane;
+    mill->headerSize = millTileAlign( mill->fishIdOffset + (size_t)cols * sizeof(uint32_t) );
+    mill->size = mill->headerSize + (size_t)mill->tiles * MILL_TILE_CELLS;
+}
+
+/* Returns the number of bytes a segment with the given geometry needs (header, locks and index included)
+ */
+size_t millSegmentSize( int rows, int cols ){
+    struct millHeader layout;
+    millLayout( &layout, rows, cols );
+    return layout.size;
+}
+
+/* Fills in the header of a freshly created segment (the cells are left for initializeMatrix)
+ */
+void millInit( struct millHeader *mill, int rows, int cols, int lockMode, int tickRate, uint64_t seed ){
+    memset( mill, 0, sizeof(*mill) );
+    millLayout( mill, rows, cols );
+    mill->lockMode = lockMode;
+    mill->tickRate = tickRate;
+    mill->seed = seed;
+    mill->lastTick = UINT32_MAX; // The run has no end until swim_mill sets one
+    memset( (char *)mill + mill->stripeOffset, 0, (mill->stripes + 2) * MILL_ALIGN ); // Every stripe and the global lock start unlocked, nothing waited yet
+    mill->version = MILL_VERSION;
+    mill->magic = MILL_MAGIC; // Written last so a reader never sees a half filled header as valid
+}
+
+/* Zeroes size bytes of mill starting at offset
+ * On a shared segment the whole pages in the range are handed back to the system (they read back as zeros), so
+ * nothing is written and the memory is freed, only the partial pages at either end are written (if write is set,
+ * otherwise the caller knows they already hold zeros)
+ * A private mill can't hand pages back, so it is simply written (if write is set)
+ */
+static void millZero( struct millHeader *mill, size_t offset, size_t size, bool write ){
+    static uintptr_t page; // System page size, looked up on first use
+    if( page == 0 ){
+        page = sysconf( _SC_PAGESIZE );
+    }
+    char *start = (char *)mill + offset;
+    char *end = start + size;
+    char *first = (char *)(((uintptr_t)start + page - 1) & ~(page - 1)); // First whole page in the range
+    char *last = (char *)((uintptr_t)end & ~(page - 1)); // End of the last whole page in the range
+    if( first < last && madvise(first, last - first, MADV_REMOVE) == 0 ){
+        if( write ){
+            memset( start, 0, first - start );
+            memset( last, 0, end - last );
+        }
+    } else if( write ){
+        memset( start, 0, size );
+    }
+}
+
+/* Copies a segment saved by a checkpoint over mill, which has the same geometry
+ * The actors registered with mill's barrier stay registered, the run keeps the end set with millTickEnd, and every
+ * lock is left free
+ * Nobody else may be using mill
+ */
+void millRestore( struct millHeader *mill, const struct millHeader *saved ){
+    uint32_t barrier = mill->barrier;
+    uint32_t lastTick = mill->lastTick;
+    millClear( mill );
+    millCopy( mill, saved );
+    mill->barrier = barrier;
+    mill->lastTick = lastTick;
+}
+
+/* Returns true if none of the tiles under page of the pellet bitmap holds a pellet
+ */
+static bool millBitPageEmpty( const struct millHeader *mill, size_t page ){
+    const uint32_t *tilePellets = (const uint32_t *)((const char *)mill + mill->tilePelletOffset);
+    size_t block = page / mill->bitPages;
+    uint32_t first = (page % mill->bitPages) * MILL_PAGE_WORDS;
+    uint32_t last = (first + MILL_PAGE_WORDS < mill->words) ? first + MILL_PAGE_WORDS : mill->words;
+    for( uint32_t w = first; w < last; w++ ){
+        if( __atomic_load_n(&tilePellets[block * mill->words + w], __ATOMIC_RELAXED) > 0 ){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Copies the header, the pellet index, the bit-planes and the cells of from into to, which has the same geometry
+ * and is all zeros past its header (fresh memory, or a mill just cleared), leaving the locks of to alone
+ * Tiles without a pellet are neither read nor written, so a copy of a sparse mill stays sparse on both sides
+ * Nobody may change either mill while it runs
+ */
+void millCopy( struct millHeader *to, const struct millHeader *from ){
+    const uint32_t *tilePellets = (const uint32_t *)((const char *)from + from->tilePelletOffset);
+    size_t lastTiles = (size_t)(from->blocks - 1) * from->words; // First tile of the last block
+    size_t lastPages = (size_t)(from->blocks - 1) * from->bitPages; // First bitmap page of the last block
+    memcpy( to, from, sizeof(*from) );
+    memcpy( (char *)to + from->blockPelletOffset, (const char *)from + from->blockPelletOffset,
+            from->pelletOffset - from->blockPelletOffset ); // Block, row and tile counts
+    for( size_t t = 0; t < from->tiles; t++ ){
+        // Tiles of the last block are always copied, the fish are there
+        if( t >= lastTiles || __atomic_load_n(&tilePellets[t], __ATOMIC_RELAXED) > 0 ){
+            memcpy( (char *)to + from->headerSize + t * MILL_TILE_CELLS, (const char *)from + from->headerSize + t * MILL_TILE_CELLS, MILL_TILE_CELLS );
+        }
+    }
+    for( size_t p = 0; p < (size_t)from->blocks * from->bitPages; p++ ){
+        if( p >= lastPages || !millBitPageEmpty(from, p) ){
+            memcpy( (char *)to + from->pelletOffset + p * MILL_TILE_CELLS, (const char *)from + from->pelletOffset + p * MILL_TILE_CELLS, MILL_TILE_CELLS );
+        }
+    }
+    size_t planeTail = (size_t)from->bitPages * MILL_TILE_CELLS; // The last block's part of a bit-plane
+    memcpy( (char *)to + from->fishOffset + lastPages * MILL_TILE_CELLS, (const char *)from + from->fishOffset + lastPages * MILL_TILE_CELLS, planeTail );
+    memcpy( (char *)to + from->eatenOffset + lastPages * MILL_TILE_CELLS, (const char *)from + from->eatenOffset + lastPages * MILL_TILE_CELLS, planeTail );
+    memcpy( (char *)to + from->fishIdOffset, (const char *)from + from->fishIdOffset, (size_t)from->cols * sizeof(uint32_t) );
+}
+
+/* Sets every cell to 'x', empties the pellet index and the fish and eaten planes
+ * A shared segment gives all of their memory back, so clearing costs the same however big the mill is
+ * The caller holds the lock of every row
+ */
+void millClear( struct millHeader *mill ){
+    // The index, the planes, the fish numbers and the cells follow each other to the end of the segment
+    millZero( mill, mill->blockPelletOffset, mill->size - mill->blockPelletOffset, true );
+    __atomic_store_n( &mill->freeCount, (uint64_t)mill->rows * mill->cols, __ATOMIC_RELEASE );
+}
+
+/* Hands the memory of every tile without a pellet (and every page of the pellet bitmap over such tiles) back to
+ * the system, where it reads back as 'x' cells without a pellet bit, so memory is only held where there are pellets
+ * The last block (where the fish swim) is kept
+ * Does nothing on a private mill. Nobody may change the mill while it runs
+ */
+void millReleaseEmpty( struct millHeader *mill ){
+    const uint32_t *tilePellets = (const uint32_t *)((const char *)mill + mill->tilePelletOffset);
+    size_t lastTiles = (size_t)(mill->blocks - 1) * mill->words; // First tile of the last block
+    size_t lastPages = (size_t)(mill->blocks - 1) * mill->bitPages; // First bitmap page of the last block
+    size_t first = 0;
+    while( first < lastTiles ){
+        if( tilePellets[first] > 0 ){
+            first++;
+            continue;
+        }
+        size_t end = first + 1; // One past the run of empty tiles that starts at first
+        while( end < lastTiles && tilePellets[end] == 0 ){
+            end++;
+        }
+        millZero( mill, mill->headerSize + first * MILL_TILE_CELLS, (end - first) * MILL_TILE_CELLS, false );
+        first = end;
+    }
+    first = 0;
+    while( first < lastPages ){
+        if( !millBitPageEmpty(mill, first) ){
+            first++;
+            continue;
+        }
+        size_t end = first + 1; // One past the run of empty bitmap pages that starts at first
+        while( end < lastPages && millBitPageEmpty(mill, end) ){
+            end++;
+        }
+        millZero( mill, mill->pelletOffset + first * MILL_TILE_CELLS, (end - first) * MILL_TILE_CELLS, false );
+        first = end;
+    }
+}
+
+/* Asks for the memory of row blocks first through last (their tiles and their pages of the pellet bitmap and the
+ * bit-planes) to come from NUMA node node, whichever thread first touches it, and moves the pages already there
+ * The policy stays with the segment, so tiles handed back by millReleaseEmpty come back on the same node
+ * Returns false if the system didn't take it (no NUMA support, or node out of range)
+ */
+bool millBindBlocks( struct millHeader *mill, int first, int last, int node ){
+    if( node < 0 || node >= MILL_MAX_NODES || first > last ){
+        return false;
+    }
+    unsigned long mask = 1UL << node;
+    size_t blocks = (size_t)(last - first + 1);
+    size_t planePart = (size_t)mill->bitPages * MILL_TILE_CELLS; // One block's part of the bitmap or of a bit-plane
+    size_t tilePart = (size_t)mill->words * MILL_TILE_CELLS; // One block's tiles
+    size_t starts[] = { mill->pelletOffset, mill->fishOffset, mill->eatenOffset };
+    bool bound = true;
+    for( int i = 0; i < 4; i++ ){
+        size_t offset = (i < 3) ? starts[i] + first * planePart : mill->headerSize + first * tilePart;
+        size_t size = blocks * ((i < 3) ? planePart : tilePart);
+        bound &= syscall( SYS_mbind, (char *)mill + offset, size, MPOL_PREFERRED, &mask, MILL_MAX_NODES + 1, MPOL_MF_MOVE ) == 0;
+    }
+    return bound;
+}
+
+/* Records that row, col just lost its pellet or got one
+ * Every counter changes atomically so any lock mode can use it
+ */
+static void millPelletUpdate( struct millHeader *mill, int row, int col, bool pellet ){
+    uint32_t *blockPellets = (uint32_t *)((char *)mill + mill->blockPelletOffset);
+    uint32_t *rowPellets = (uint32_t *)((char *)mill + mill->rowPelletOffset);
+    uint32_t *tilePellets = (uint32_t *)((char *)mill + mill->tilePelletOffset);
+    uint64_t *word = (uint64_t *)((char *)mill + mill->pelletOffset) + millWord( mill, row, col / 64 );
+    uint64_t bit = 1ULL << (col % 64);
+    if( pellet ){
+        __atomic_or_fetch( word, bit, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &rowPellets[row], 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &tilePellets[millTile(mill, row, col / 64)], 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &blockPellets[row / MILL_BLOCK_ROWS], 1, __ATOMIC_RELAXED );
+        __atomic_sub_fetch( &mill->freeCount, 1, __ATOMIC_RELAXED );
+    } else {
+        __atomic_and_fetch( word, ~bit, __ATOMIC_RELAXED );
+        __atomic_sub_fetch( &rowPellets[row], 1, __ATOMIC_RELAXED );
+        __atomic_sub_fetch( &tilePellets[millTile(mill, row, col / 64)], 1, __ATOMIC_RELAXED );
+        __atomic_sub_fetch( &blockPellets[row / MILL_BLOCK_ROWS], 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &mill->freeCount, 1, __ATOMIC_RELAXED );
+    }
+}
+
+/* Moves the pellet on row, col down to row + 1 in the index (millMovePellet has already moved it in the cells)
+ * Cheaper than the two updates of millSet: the total stays the same, and so do the block and tile counts unless
+ * the pellet crosses into the next block. The new bit is set before the old one is cleared so an unlocked reader
+ * never misses the pellet
+ */
+static void millPelletDown( struct millHeader *mill, int row, int col ){
+    uint32_t *blockPellets = (uint32_t *)((char *)mill + mill->blockPelletOffset);
+    uint32_t *rowPellets = (uint32_t *)((char *)mill + mill->rowPelletOffset);
+    uint32_t *tilePellets = (uint32_t *)((char *)mill + mill->tilePelletOffset);
+    uint64_t *bits = (uint64_t *)((char *)mill + mill->pelletOffset);
+    uint64_t bit = 1ULL << (col % 64);
+    __atomic_or_fetch( &bits[millWord(mill, row + 1, col / 64)], bit, __ATOMIC_RELAXED );
+    __atomic_and_fetch( &bits[millWord(mill, row, col / 64)], ~bit, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &rowPellets[row + 1], 1, __ATOMIC_RELAXED );
+    __atomic_sub_fetch( &rowPellets[row], 1, __ATOMIC_RELAXED );
+    if( (row + 1) % MILL_BLOCK_ROWS == 0 ){
+        __atomic_add_fetch( &blockPellets[(row + 1) / MILL_BLOCK_ROWS], 1, __ATOMIC_RELAXED );
+        __atomic_sub_fetch( &blockPellets[row / MILL_BLOCK_ROWS], 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &tilePellets[millTile(mill, row + 1, col / 64)], 1, __ATOMIC_RELAXED );
+        __atomic_sub_fetch( &tilePellets[millTile(mill, row, col / 64)], 1, __ATOMIC_RELAXED );
+    }
+}
+
+/* Keeps the pellet index and the fish and eaten planes in step with a cell that changed from old to value
+ * Called by millSet and millCas
+ */
+void millCellChanged( struct millHeader *mill, int row, int col, char old, char value ){
+    size_t word = millWord( mill, row, col / 64 );
+    uint64_t bit = 1ULL << (col % 64);
+    uint64_t *fish = (uint64_t *)((char *)mill + mill->fishOffset);
+    uint64_t *eaten = (uint64_t *)((char *)mill + mill->eatenOffset);
+    if( (old == 'P') != (value == 'P') ){
+        millPelletUpdate( mill, row, col, value == 'P' );
+    }
+    if( old == 'F' ){
+        __atomic_and_fetch( &fish[word], ~bit, __ATOMIC_RELAXED );
+    } else if( old == 'E' ){
+        __atomic_and_fetch( &eaten[word], ~bit, __ATOMIC_RELAXED );
+    }
+    if( value == 'F' ){
+        __atomic_or_fetch( &fish[word], bit, __ATOMIC_RELAXED );
+    } else if( value == 'E' ){
+        __atomic_or_fetch( &eaten[word], bit, __ATOMIC_RELAXED );
+    }
+}
+
+/* Picks a uniformly random cell without a pellet, like pellet.c's old retry loop but in a fixed number of steps
+ * however full the matrix is: a random rank among the free cells is walked down through the block counts,
+ * the row counts and the popcount of each bitmap word (a row or a tile without a pellet is free all the way across,
+ * so its part of the bitmap isn't read at all)
+ * Needs no lock, the caller locks the row and checks the cell again before placing (see millPlacePellet)
+ * Returns -1 if there is no free cell (or the index changed under it), 0 otherwise
+ */
+int millFreeCell( struct millHeader *mill, struct rng *rng, int *row, int *col ){
+    uint32_t *blockPellets = (uint32_t *)((char *)mill + mill->blockPelletOffset);
+    uint32_t *rowPellets = (uint32_t *)((char *)mill + mill->rowPelletOffset);
+    uint32_t *tilePellets = (uint32_t *)((char *)mill + mill->tilePelletOffset);
+    uint64_t *bits = (uint64_t *)((char *)mill + mill->pelletOffset);
+    uint64_t total = __atomic_load_n( &mill->freeCount, __ATOMIC_RELAXED );
+    if( total == 0 ){
+        return -1;
+    }
+    uint64_t rank = (total > UINT32_MAX) ? rngNext( rng ) % total : rngBelow( rng, total );
+
+    uint32_t b = 0;
+    for( ; b < mill->blocks; b++ ){
+        uint32_t blockRows = mill->rows - b * MILL_BLOCK_ROWS;
+        blockRows = (blockRows < MILL_BLOCK_ROWS) ? blockRows : MILL_BLOCK_ROWS;
+        uint32_t count = blockRows * mill->cols - __atomic_load_n( &blockPellets[b], __ATOMIC_RELAXED );
+        if( rank < count ){
+            break;
+        }
+        rank -= count;
+    }
+    uint32_t last = (b + 1) * MILL_BLOCK_ROWS;
+    last = (last > mill->rows) ? mill->rows : last;
+    for( uint32_t i = b * MILL_BLOCK_ROWS; i < last; i++ ){
+        uint32_t pellets = __atomic_load_n( &rowPellets[i], __ATOMIC_RELAXED );
+        uint32_t count = mill->cols - pellets;
+        if( rank >= count ){
+            rank -= count;
+            continue;
+        }
+        if( pellets == 0 ){
+            *row = i;
+            *col = rank;
+            return 0;
+        }
+        for( uint32_t w = 0; w < mill->words; w++ ){
+            uint32_t used = mill->cols - w * 64; // Columns that fall in this word
+            uint64_t word = ~0ULL;
+            if( __atomic_load_n(&tilePellets[millTile(mill, i, w)], __ATOMIC_RELAXED) > 0 ){
+                word = ~__atomic_load_n( &bits[millWord(mill, i, w)], __ATOMIC_RELAXED );
+            }
+            word &= (used >= 64) ? ~0ULL : ((1ULL << used) - 1);
+            uint32_t ones = __builtin_popcountll( word );
+            if( rank >= ones ){
+                rank -= ones;
+                continue;
+            }
+            // Select the rank'th set bit of the word
+            while( rank-- > 0 ){
+                word &= word - 1;
+            }
+            *row = i;
+            *col = w * 64 + __builtin_ctzll( word );
+            return 0;
+        }
+        return -1; // The row count and its bits disagreed (another actor was in the middle of an update)
+    }
+    return -1;
+}
+
+/* Orders ranks for qsort
+ */
+static int millRankOrder( const void *a, const void *b ){
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Returns a uniformly distributed number from 0 to n - 1 (n may be past 32 bits on the largest grids)
+ */
+static uint64_t millRandomRank( struct rng *rng, uint64_t n ){
+    return (n > UINT32_MAX) ? rngNext( rng ) % n : rngBelow( rng, n );
+}
+
+/* Returns the free cells of word w of row (a set bit for every column without a pellet)
+ */
+static uint64_t millFreeBits( const struct millHeader *mill, int row, uint32_t w ){
+    const uint32_t *tilePellets = (const uint32_t *)((const char *)mill + mill->tilePelletOffset);
+    const uint64_t *bits = (const uint64_t *)((const char *)mill + mill->pelletOffset);
+    uint32_t used = mill->cols - w * 64; // Columns that fall in this word
+    uint64_t word = ~0ULL;
+    if( __atomic_load_n(&tilePellets[millTile(mill, row, w)], __ATOMIC_RELAXED) > 0 ){
+        word = ~__atomic_load_n( &bits[millWord(mill, row, w)], __ATOMIC_RELAXED );
+    }
+    return word & ((used >= 64) ? ~0ULL : ((1ULL << used) - 1));
+}
+
+/* Picks count different uniformly random cells without a pellet in one pass over the pellet index, for dropping a
+ * whole tick's worth of pellets at once (millFreeCell walks the index again for every pellet)
+ * Up to half of the free cells, count random ranks are drawn (drawing again for the few that came up twice), sorted,
+ * and walked down the block, row and word counts together, so blocks and rows none of them falls in are skipped
+ * whole. Past half, every free cell is walked and kept with the chance that leaves exactly count of them
+ * cells gets the picked cells as row * cols + col, top to bottom and left to right
+ * Needs no lock, like millFreeCell, the caller locks and checks each cell again before placing
+ * Returns the number of cells picked: count, or fewer if fewer cells are free (or the index changed under it)
+ */
+int millFreeCells( struct millHeader *mill, struct rng *rng, uint64_t *cells, int count ){
+    uint32_t *blockPellets = (uint32_t *)((char *)mill + mill->blockPelletOffset);
+    uint32_t *rowPellets = (uint32_t *)((char *)mill + mill->rowPelletOffset);
+    uint64_t total = __atomic_load_n( &mill->freeCount, __ATOMIC_RELAXED );
+    int picked = 0;
+    if( count <= 0 || total == 0 ){
+        return 0;
+    }
+
+    if( (uint64_t)count > total / 2 ){
+        // Selection sampling: every free cell is kept with the chance (still needed) / (still to be seen)
+        uint64_t needed = ((uint64_t)count < total) ? (uint64_t)count : total; // count is positive here
+        uint64_t left = total;
+        for( uint32_t i = 0; i < mill->rows && needed > 0; i++ ){
+            if( mill->cols == __atomic_load_n(&rowPellets[i], __ATOMIC_RELAXED) ){
+                continue; // No free cell in the row
+            }
+            for( uint32_t w = 0; w < mill->words && needed > 0; w++ ){
+                for( uint64_t word = millFreeBits(mill, i, w); word != 0 && left > 0; word &= word - 1 ){
+                    if( millRandomRank(rng, left--) < needed ){
+                        cells[picked++] = (uint64_t)i * mill->cols + w * 64 + __builtin_ctzll( word );
+                        needed--;
+                    }
+                }
+            }
+        }
+        return picked;
+    }
+
+    // count different ranks among the free cells, in order
+    while( picked < count ){
+        for( int n = picked; n < count; n++ ){
+            cells[n] = millRandomRank( rng, total );
+        }
+        qsort( cells, count, sizeof(uint64_t), millRankOrder );
+        picked = 1;
+        for( int n = 1; n < count; n++ ){
+            if( cells[n] != cells[picked - 1] ){
+                cells[picked++] = cells[n];
+            }
+        }
+    }
+
+    // Each rank is turned into its cell in place, the ranks still to come are all further along
+    uint64_t base = 0; // Free cells before the block, row or word being looked at
+    int next = 0;
+    for( uint32_t b = 0; b < mill->blocks && next < count; b++ ){
+        uint32_t blockRows = mill->rows - b * MILL_BLOCK_ROWS;
+        blockRows = (blockRows < MILL_BLOCK_ROWS) ? blockRows : MILL_BLOCK_ROWS;
+        uint32_t blockFree = blockRows * mill->cols - __atomic_load_n( &blockPellets[b], __ATOMIC_RELAXED );
+        if( cells[next] - base >= blockFree ){
+            base += blockFree;
+            continue;
+        }
+        for( uint32_t i = b * MILL_BLOCK_ROWS; i < b * MILL_BLOCK_ROWS + blockRows && next < count; i++ ){
+            uint32_t rowFree = mill->cols - __atomic_load_n( &rowPellets[i], __ATOMIC_RELAXED );
+            if( cells[next] - base >= rowFree ){
+                base += rowFree;
+                continue;
+            }
+            for( uint32_t w = 0; w < mill->words && next < count; w++ ){
+                uint64_t word = millFreeBits( mill, i, w );
+                uint32_t ones = __builtin_popcountll( word );
+                while( next < count && cells[next] - base < ones ){
+                    // Select the rank'th set bit of the word
+                    uint64_t left = word;
+                    for( uint64_t rank = cells[next] - base; rank > 0; rank-- ){
+                        left &= left - 1;
+                    }
+                    cells[next++] = (uint64_t)i * mill->cols + w * 64 + __builtin_ctzll( left );
+                }
+                base += ones;
+            }
+        }
+    }
+    return next; // Short of count only if the counts and the bits disagreed (another actor was in the middle of an update)
+}
+
+/* Drops count new pellets on the matrix at once, on different random cells without a pellet (see millFreeCells)
+ * Pellets past the number of free cells land on a random cell that already holds one
+ * cells has room for count cells and is left holding the cell every pellet went to (row * cols + col)
+ * The caller holds the lock of every row unless the mill is in MILL_LOCK_CAS mode
+ * Adds the pellets that landed on a fish to eaten and the ones that landed on another pellet to collided
+ */
+void millDropPellets( struct millHeader *mill, struct rng *rng, uint64_t *cells, int count, uint32_t *eaten, uint32_t *collided ){
+    for( int n = millFreeCells(mill, rng, cells, count); n < count; n++ ){
+        uint64_t row = rngBelow( rng, mill->rows ); // Every cell holds a pellet, so this one will collide
+        cells[n] = row * mill->cols + rngBelow( rng, mill->cols );
+    }
+    millPlacePellets( mill, cells, count, eaten, collided );
+}
+
+/* Puts a new pellet on each of count cells (row * cols + col) in order, like millDropPellets once it has its cells
+ * The caller holds the lock of every row unless the mill is in MILL_LOCK_CAS mode
+ * Adds the pellets that landed on a fish to eaten and the ones that landed on another pellet to collided
+ */
+void millPlacePellets( struct millHeader *mill, const uint64_t *cells, int count, uint32_t *eaten, uint32_t *collided ){
+    for( int n = 0; n < count; n++ ){
+        int outcome = millPlacePellet( mill, cells[n] / mill->cols, cells[n] % mill->cols );
+        *eaten += (outcome == MILL_EATEN);
+        *collided += (outcome == MILL_COLLISION);
+    }
+}
+
+/* Returns a 64 bit FNV-1a hash of every cell of the matrix as printMatrix shows it, row by row
+ * Two mills with the same digest hold the same pellets and fish (used to check a replayed trace, see mill_trace.h)
+ */
+uint64_t millDigest( struct millHeader *mill ){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for( uint32_t i = 0; i < mill->rows; i++ ){
+        for( uint32_t j = 0; j < mill->cols; j++ ){
+            hash ^= (unsigned char)millGet( mill, i, j );
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+/* Returns the number of pellets in row (according to the pellet index)
+ */
+uint32_t millRowPellets( const struct millHeader *mill, int row ){
+    const uint32_t *rowPellets = (const uint32_t *)((const char *)mill + mill->rowPelletOffset);
+    return __atomic_load_n( &rowPellets[row], __ATOMIC_RELAXED );
+}
+
+/* Returns the number of pellets in rows block * MILL_BLOCK_ROWS up to the end of that block
+ */
+uint32_t millBlockPellets( const struct millHeader *mill, int block ){
+    const uint32_t *blockPellets = (const uint32_t *)((const char *)mill + mill->blockPelletOffset);
+    return __atomic_load_n( &blockPellets[block], __ATOMIC_RELAXED );
+}
+
+/* Returns the number of pellets in the tile holding row and the 64 columns of word w
+ */
+uint32_t millTilePellets( const struct millHeader *mill, int row, int w ){
+    const uint32_t *tilePellets = (const uint32_t *)((const char *)mill + mill->tilePelletOffset);
+    return __atomic_load_n( &tilePellets[millTile(mill, row, w)], __ATOMIC_RELAXED );
+}
+
+/* Returns the bits of the 64 bit word w of row that are set for a pellet and fall within columns first through last
+ */
+uint64_t millPelletBits( const struct millHeader *mill, int row, int w, int first, int last ){
+    const uint64_t *bits = (const uint64_t *)((const char *)mill + mill->pelletOffset);
+    if( millTilePellets(mill, row, w) == 0 ){
+        return 0; // Keeps away from the bitmap of an empty tile
+    }
+    uint64_t word = __atomic_load_n( &bits[millWord(mill, row, w)], __ATOMIC_RELAXED );
+    if( first > w * 64 ){
+        word &= ~0ULL << (first - w * 64);
+    }
+    if( last < w * 64 + 63 ){
+        word &= ~0ULL >> (63 - (last - w * 64));
+    }
+    return word;
+}
+
+/* Returns the column of the pellet in row closest to the left of from (from itself included), looking no further than to
+ * Returns -1 if there is no pellet in columns to through from
+ */
+int millPelletLeft( const struct millHeader *mill, int row, int from, int to ){
+    for( int w = from / 64; from >= to && w >= to / 64; w-- ){
+        uint64_t word = millPelletBits( mill, row, w, to, from );
+        if( word ){
+            return w * 64 + 63 - __builtin_clzll( word );
+        }
+    }
+    return -1;
+}
+
+/* Returns the column of the pellet in row closest to the right of from (from itself included), looking no further than to
+ * Returns -1 if there is no pellet in columns from through to
+ */
+int millPelletRight( const struct millHeader *mill, int row, int from, int to ){
+    for( int w = from / 64; from <= to && w <= to / 64; w++ ){
+        uint64_t word = millPelletBits( mill, row, w, from, to );
+        if( word ){
+            return w * 64 + __builtin_ctzll( word );
+        }
+    }
+    return -1;
+}
+
+/* Finds the closest pellet a fish at column col of the last row can still reach (imagine a V) and returns the
+ * direction to move in: -1 for left, 1 for right and 0 to stay (heading back to column home if there is no pellet)
+ * Pellets are looked up in the pellet index that every pellet keeps up to date as it moves, so rows and
+ * whole blocks of rows without a pellet are skipped and a row is searched a word of columns at a time
+ */
+int millFindPellet( struct millHeader *mill, int col, int home, struct rng *rng ){
+    int rows = mill->rows;
+    int cols = mill->cols;
+    int i, j, searchLeft, searchRight, distanceLeft, distanceRight;
+    // Will limit the view to the rows above the fish
+    for( i = (rows - 2); i >= 0; i-- ){
+        // 'E' only ever shows up on the fish row (pellets only turn an 'F' or an 'E' into one), so it is checked once
+        if( i == rows - 2 && millGet(mill, i + 1, col) == 'E' ){
+            return 0; // Stay in same position
+        }
+        // Skips the rest of a block of rows that has no pellet in it at all
+        if( millBlockPellets(mill, i / MILL_BLOCK_ROWS) == 0 ){
+            i -= i % MILL_BLOCK_ROWS;
+            continue;
+        }
+        if( millRowPellets(mill, i) == 0 ){
+            continue;
+        }
+        searchLeft = col - ((rows - 1) - i); // Determines how many number of columns the fish should look at on the left side
+        searchRight = col + ((rows - 1) - i); // Determines how many number of columns the fish should look at on the right side
+        searchLeft = (searchLeft < 0) ? 0 : searchLeft; // Limits how far left the fish can look to column 0
+        searchRight = (searchRight >= cols) ? (cols-1) : searchRight; // Limits how far right the fish can look to column cols-1
+        // The following checks limit the view to only what can potentially be eaten (Imagine a V)
+        // This checks the column the fish is in for the pellet (closest pellet at that point) at row i
+        if( millPelletRight(mill, i, col, col) != -1 ){
+          return 0; // Stay in same position
+        }
+        // Closest pellet on the left side
+        j = millPelletLeft( mill, i, col - 1, searchLeft );
+        distanceLeft = (j == -1) ? cols : col - j;
+        // Closest pellet on the right side
+        j = millPelletRight( mill, i, col + 1, searchRight );
+        distanceRight = (j == -1) ? cols : j - col;
+        // This set of if/else determines whether to go left or right based on the distances of the pellets
+        if( distanceLeft < distanceRight ){
+            return -1;
+        } else if( distanceLeft > distanceRight ){
+            return 1;
+        } else if( distanceLeft == distanceRight && distanceLeft < cols ){
+            // If they're the same distance, randomly choose left or right direction
+            int randomDir = rngBelow( rng, 2 ); // Either 0 or 1
+            randomDir = (randomDir == 0 ) ? -1 : 1; // if 0, then choose left else right
+            return randomDir;
+        }
+    }
+    // If a pellet isn't found, this section will have the fish return to its home column (the center of the row for one fish)
+    if( col < home ){
+        return 1; // Go right
+    } else if( col > home ){
+        return -1; // Go left
+    } else {
+        return 0; // Stay in the same position
+    }
+    return 0; // If it makes it here (shouldn't) then stay in the same spot
+}
+
+/* Puts fish number fish (counting from 1) on column col of the last row
+ * The caller holds the lock of the last row
+ */
+void millFishEnter( struct millHeader *mill, int col, uint32_t fish ){
+    uint32_t *ids = (uint32_t *)((char *)mill + mill->fishIdOffset);
+    __atomic_store_n( &ids[col], fish, __ATOMIC_RELAXED );
+    millSet( mill, mill->rows - 1, col, 'F' );
+}
+
+/* Takes the fish off column col of the last row (the cell goes back to 'x', whether or not the fish had eaten)
+ * The caller holds the lock of the last row
+ */
+void millFishLeave( struct millHeader *mill, int col ){
+    uint32_t *ids = (uint32_t *)((char *)mill + mill->fishIdOffset);
+    millSet( mill, mill->rows - 1, col, 'x' );
+    __atomic_store_n( &ids[col], 0, __ATOMIC_RELAXED );
+}
+
+/* Returns the number of the fish on column col of the last row, or 0 if there is none
+ */
+uint32_t millFishAt( const struct millHeader *mill, int col ){
+    const uint32_t *ids = (const uint32_t *)((const char *)mill + mill->fishIdOffset);
+    return __atomic_load_n( &ids[col], __ATOMIC_RELAXED );
+}
+
+/* Returns 0 if the segment was laid out by a matching swim_mill, -1 otherwise
+ */
+int millCheck( const struct millHeader *mill ){
+    if( mill->magic != MILL_MAGIC || mill->version != MILL_VERSION ){
+        return -1;
+    }
+    if( mill->rows < 2 || mill->cols < 1 || mill->words * 64 < mill->cols || mill->tiles != mill->blocks * mill->words ||
+        mill->bitPages * MILL_PAGE_WORDS < mill->words || mill->lockMode > MILL_LOCK_CAS ){
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns the futex word of a stripe lock (0 unlocked, 1 locked, 2 locked with waiters)
+ */
+static uint32_t *millStripe( struct millHeader *mill, uint32_t stripe ){
+    return (uint32_t *)((char *)mill + mill->stripeOffset + (size_t)stripe * MILL_ALIGN);
+}
+
+/* Returns the number of lock takes that found the lock held (on a cache line of its own after the global lock)
+ */
+static uint64_t *millContended( struct millHeader *mill ){
+    return (uint64_t *)((char *)mill + mill->stripeOffset + (size_t)(mill->stripes + 1) * MILL_ALIGN);
+}
+
+/* Takes a stripe lock, only making a system call when another actor holds it
+ * Counts the take in contended when it has to wait
+ */
+static void millStripeLock( uint32_t *lock, uint64_t *contended ){
+    uint32_t state = 0;
+    if( __atomic_compare_exchange_n(lock, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ){
+        return; // Uncontended
+    }
+    __atomic_add_fetch( contended, 1, __ATOMIC_RELAXED );
+    if( state != 2 ){
+        state = __atomic_exchange_n( lock, 2, __ATOMIC_ACQUIRE );
+    }
+    while( state != 0 ){
+        syscall( SYS_futex, lock, FUTEX_WAIT, 2, NULL, NULL, 0 ); // Sleeps only while the lock is still 2
+        state = __atomic_exchange_n( lock, 2, __ATOMIC_ACQUIRE );
+    }
+}
+
+/* Releases a stripe lock, waking one waiter if there is any
+ */
+static void millStripeUnlock( uint32_t *lock ){
+    if( __atomic_exchange_n(lock, 0, __ATOMIC_RELEASE) == 2 ){
+        syscall( SYS_futex, lock, FUTEX_WAKE, 1, NULL, NULL, 0 );
+    }
+}
+
+/* Returns true if stripe is used by one of the rows first through last
+ */
+static bool millStripeCovers( struct millHeader *mill, uint32_t stripe, int first, int last ){
+    uint32_t mask = mill->stripes - 1;
+    return ((stripe - (uint32_t)first) & mask) <= (uint32_t)(last - first);
+}
+
+/* Locks the stripes of rows first through last (MILL_LOCK_STRIPED)
+ * Stripes are always taken in ascending order so two actors can't deadlock
+ */
+void millLockRows( struct millHeader *mill, int first, int last ){
+    uint32_t mask = mill->stripes - 1;
+    if( last - first >= (int)mill->stripes ){
+        for( uint32_t s = 0; s < mill->stripes; s++ ){
+            millStripeLock( millStripe(mill, s), millContended(mill) );
+        }
+    } else if( last - first <= 1 ){
+        // The common case (one row, or a pellet moving from one row to the next)
+        uint32_t a = first & mask;
+        uint32_t b = last & mask;
+        millStripeLock( millStripe(mill, a < b ? a : b), millContended(mill) );
+        if( a != b ){
+            millStripeLock( millStripe(mill, a < b ? b : a), millContended(mill) );
+        }
+    } else {
+        for( uint32_t s = 0; s < mill->stripes; s++ ){
+            if( millStripeCovers(mill, s, first, last) ){
+                millStripeLock( millStripe(mill, s), millContended(mill) );
+            }
+        }
+    }
+}
+
+/* Unlocks the stripes of rows first through last (MILL_LOCK_STRIPED)
+ */
+void millUnlockRows( struct millHeader *mill, int first, int last ){
+    uint32_t mask = mill->stripes - 1;
+    if( last - first >= (int)mill->stripes ){
+        for( uint32_t s = 0; s < mill->stripes; s++ ){
+            millStripeUnlock( millStripe(mill, s) );
+        }
+    } else if( last - first <= 1 ){
+        millStripeUnlock( millStripe(mill, first & mask) );
+        if( (first & mask) != (last & mask) ){
+            millStripeUnlock( millStripe(mill, last & mask) );
+        }
+    } else {
+        for( uint32_t s = 0; s < mill->stripes; s++ ){
+            if( millStripeCovers(mill, s, first, last) ){
+                millStripeUnlock( millStripe(mill, s) );
+            }
+        }
+    }
+}
+
+/* Takes the lock around the whole matrix (MILL_LOCK_GLOBAL)
+ * It is a futex word on its own cache line after the stripes, so like a stripe it costs no system call unless
+ * another actor holds it (the SysV semaphore it replaces made a semop call for every lock and unlock)
+ */
+void millLockGlobal( struct millHeader *mill ){
+    millStripeLock( millStripe(mill, mill->stripes), millContended(mill) );
+}
+
+/* Releases the lock around the whole matrix (MILL_LOCK_GLOBAL)
+ */
+void millUnlockGlobal( struct millHeader *mill ){
+    millStripeUnlock( millStripe(mill, mill->stripes) );
+}
+
+/* Returns the number of times an actor found the lock it wanted (a stripe or the global lock) held by another and
+ * had to wait, counted by every process of the run since the segment was made
+ */
+uint64_t millLockContention( struct millHeader *mill ){
+    return __atomic_load_n( millContended(mill), __ATOMIC_RELAXED );
+}
+
+/* Puts a new pellet on row, col
+ * The caller holds the lock of row unless the mill is in MILL_LOCK_CAS mode
+ * Returns MILL_MOVED when placed, MILL_EATEN when it landed on the fish or MILL_COLLISION on another pellet
+ */
+int millPlacePellet( struct millHeader *mill, int row, int col ){
+    while( 1 ){
+        char cell = millGet( mill, row, col );
+        if( cell == 'x' ){
+            if( mill->lockMode != MILL_LOCK_CAS ){
+                millSet( mill, row, col, 'P' );
+                return MILL_MOVED;
+            } else if( millCas(mill, row, col, 'x', 'P') ){
+                return MILL_MOVED; // CAS 'x' -> 'P'
+            }
+        } else if( cell == 'F' || cell == 'E' ){
+            if( mill->lockMode != MILL_LOCK_CAS ){
+                millSet( mill, row, col, 'E' ); // Updates the fish location to 'E' (for eaten)
+                return MILL_EATEN;
+            } else if( millCas(mill, row, col, cell, 'E') ){
+                return MILL_EATEN;
+            }
+        } else {
+            return MILL_COLLISION; // Already holds a pellet
+        }
+        // Someone changed the cell between the read and the swap, so look at it again
+    }
+}
+
+/* Moves the pellet on row, col down one row, following the rules of pellet.c's main loop
+ * The caller holds the locks of row and row + 1 unless the mill is in MILL_LOCK_CAS mode
+ * Returns MILL_MOVED, MILL_STAYED, MILL_EATEN or MILL_PASSED
+ */
+int millMovePellet( struct millHeader *mill, int row, int col ){
+    bool cas = (mill->lockMode == MILL_LOCK_CAS);
+    int next = row + 1;
+    if( next >= (int)mill->rows ){
+        // The pellet leaves the last row, so it has passed the fish
+        // Ensure that the fish char isn't overwritten with an x if the passing pellet was next to it
+        if( cas ){
+            millCas( mill, row, col, 'P', 'x' );
+        } else if( millGet(mill, row, col) != 'F' && millGet(mill, row, col) != 'E' ){
+            millSet( mill, row, col, 'x' );
+        }
+        return MILL_PASSED;
+    }
+    while( 1 ){
+        char cell = millGet( mill, next, col );
+        if( cell == 'x' || cell == 'P' ){
+            // The next row is an 'x' or 'P', so the pellet moves there (CAS 'x' -> 'P' then 'P' -> 'x')
+            if( !cas && cell == 'x' && millGet(mill, row, col) == 'P' ){
+                // The common case, only the index of the two rows changes
+                __atomic_store_n( millCell(mill, row, col), MILL_EMPTY, __ATOMIC_RELAXED );
+                __atomic_store_n( millCell(mill, next, col), 'P', __ATOMIC_RELAXED );
+                millPelletDown( mill, row, col );
+                return MILL_MOVED;
+            } else if( !cas ){
+                millSet( mill, row, col, 'x' );
+                millSet( mill, next, col, 'P' );
+                return MILL_MOVED;
+            } else if( cell == 'P' || millCas(mill, next, col, 'x', 'P') ){
+                millCas( mill, row, col, 'P', 'x' );
+                return MILL_MOVED;
+            }
+        } else if( cell == 'F' || cell == 'E' ){
+            // The next row is the fish, so the pellet is eaten
+            if( !cas ){
+                millSet( mill, row, col, 'x' );
+                millSet( mill, next, col, 'E' );
+                return MILL_EATEN;
+            } else if( millCas(mill, next, col, cell, 'E') ){
+                millCas( mill, row, col, 'P', 'x' );
+                return MILL_EATEN;
+            }
+        } else {
+            return MILL_STAYED; // Unknown cell, the pellet stays where it is
+        }
+        // Someone changed the cell between the read and the swap, so look at it again
+    }
+}
+
+/* Waits on a futex word while it still holds value, for at most milliseconds
+ */
+static void millFutexWait( uint32_t *word, uint32_t value, int milliseconds ){
+    struct timespec timeout = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
+    syscall( SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0 );
+}
+
+/* Wakes everyone waiting on a futex word
+ */
+static void millFutexWake( uint32_t *word ){
+    syscall( SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0 );
+}
+
+/* Registers one more actor with the tick barrier
+ * The tick only advances once every registered actor has arrived, so the new actor takes part in the current tick
+ * swim_mill calls this before forking a fish or pellet so the new process can't miss its first tick
+ */
+void millTickJoin( struct millHeader *mill ){
+    __atomic_add_fetch( &mill->barrier, MILL_ACTOR_ONE, __ATOMIC_ACQ_REL );
+}
+
+/* Removes an actor that hasn't arrived for the current tick (e.g. a pellet that just finished)
+ */
+void millTickLeave( struct millHeader *mill ){
+    uint32_t barrier = __atomic_sub_fetch( &mill->barrier, MILL_ACTOR_ONE, __ATOMIC_ACQ_REL );
+    if( (barrier & (MILL_ACTOR_ONE - 1)) >= (barrier / MILL_ACTOR_ONE) ){
+        millFutexWake( &mill->barrier ); // Everyone left has arrived, so let the tick advance
+    }
+}
+
+/* Called by an actor once it has finished its step for tick
+ * Blocks until the tick advances (or the run is stopped) and returns the new tick
+ */
+uint32_t millTickArrive( struct millHeader *mill, uint32_t tick ){
+    uint32_t barrier = __atomic_add_fetch( &mill->barrier, 1, __ATOMIC_ACQ_REL );
+    if( (barrier & (MILL_ACTOR_ONE - 1)) >= (barrier / MILL_ACTOR_ONE) ){
+        millFutexWake( &mill->barrier ); // Last one to arrive
+    }
+    while( __atomic_load_n(&mill->tick, __ATOMIC_ACQUIRE) == tick && !millStopped(mill) ){
+        millFutexWait( &mill->tick, tick, MILL_TICK_TIMEOUT_MS );
+    }
+    return __atomic_load_n( &mill->tick, __ATOMIC_ACQUIRE );
+}
+
+/* Waits for every registered actor to arrive (giving up on stragglers after MILL_TICK_TIMEOUT_MS)
+ * then starts the next tick and wakes the actors
+ * Returns the new tick
+ */
+uint32_t millTickAdvance( struct millHeader *mill ){
+    millTickSettle( mill );
+    return millTickStart( mill );
+}
+
+/* First half of millTickAdvance: waits for every registered actor to arrive (giving up on stragglers after
+ * MILL_TICK_TIMEOUT_MS), after which nobody touches the mill until millTickStart
+ * Returns false if it gave up on a straggler (which may still be changing the mill)
+ */
+bool millTickSettle( struct millHeader *mill ){
+    struct timespec start, now;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    uint32_t barrier = __atomic_load_n( &mill->barrier, __ATOMIC_ACQUIRE );
+    while( 1 ){
+        if( (barrier & (MILL_ACTOR_ONE - 1)) >= (barrier / MILL_ACTOR_ONE) ){
+            // Everyone has arrived, so clear the arrivals (keeping the actors) for the next tick
+            if( __atomic_compare_exchange_n(&mill->barrier, &barrier, barrier & ~(MILL_ACTOR_ONE - 1),
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ){
+                return true;
+            }
+            continue; // An actor joined or arrived in between, look again
+        }
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        long waited = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if( waited >= MILL_TICK_TIMEOUT_MS ){
+            // An actor died without leaving, don't let it stall the mill
+            __atomic_and_fetch( &mill->barrier, ~(MILL_ACTOR_ONE - 1), __ATOMIC_ACQ_REL );
+            return false;
+        }
+        millFutexWait( &mill->barrier, barrier, MILL_TICK_TIMEOUT_MS - waited );
+        barrier = __atomic_load_n( &mill->barrier, __ATOMIC_ACQUIRE );
+    }
+}
+
+/* Second half of millTickAdvance: starts the next tick and wakes the actors
+ * Returns the new tick
+ */
+uint32_t millTickStart( struct millHeader *mill ){
+    uint32_t tick = __atomic_add_fetch( &mill->tick, 1, __ATOMIC_ACQ_REL );
+    millFutexWake( &mill->tick );
+    return tick;
+}
+
+/* Called by the fish once it has moved on tick, letting the pellets take their step
+ */
+void millTickFishDone( struct millHeader *mill, uint32_t tick ){
+    __atomic_store_n( &mill->fishDone, tick + 1, __ATOMIC_RELEASE );
+    millFutexWake( &mill->fishDone );
+}
+
+/* Waits until the fish has moved on tick (giving up after MILL_TICK_TIMEOUT_MS)
+ * Moving pellets only after the fish keeps every tick in the same order, so seeded runs repeat exactly
+ */
+void millTickAfterFish( struct millHeader *mill, uint32_t tick ){
+    struct timespec start, now;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    uint32_t done = __atomic_load_n( &mill->fishDone, __ATOMIC_ACQUIRE );
+    while( (int32_t)(done - tick) <= 0 && !millStopped(mill) ){
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        long waited = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if( waited >= MILL_TICK_TIMEOUT_MS ){
+            return; // The fish is gone, don't let it stall the pellets
+        }
+        millFutexWait( &mill->fishDone, done, MILL_TICK_TIMEOUT_MS - waited );
+        done = __atomic_load_n( &mill->fishDone, __ATOMIC_ACQUIRE );
+    }
+}
+
+/* Ends the run before tick: an actor handed tick (or a later one) by millTickArrive stops instead of stepping
+ * Must be called while the clock is still before tick, so that every actor sees it before it could step there
+ */
+void millTickEnd( struct millHeader *mill, uint32_t tick ){
+    __atomic_store_n( &mill->lastTick, tick, __ATOMIC_RELEASE );
+}
+
+/* Stops the run: every actor waiting on the tick or on the fish wakes up, and fish and pellet processes exit the
+ * next time they look (millStopped), so swim_mill only has to reap them instead of signalling each one
+ */
+void millStop( struct millHeader *mill ){
+    __atomic_store_n( &mill->stop, 1, __ATOMIC_RELEASE );
+    millFutexWake( &mill->tick );
+    millFutexWake( &mill->fishDone );
+    millFutexWake( &mill->stop );
+}
+
+/* Waits until swim_mill stops the run (see millStop)
+ * Fish and pellet processes that reached the last tick wait here, so swim_mill reaps them like before
+ */
+void millWaitStop( struct millHeader *mill ){
+    while( !millStopped(mill) ){
+        millFutexWait( &mill->stop, 0, MILL_TICK_TIMEOUT_MS );
+    }
+}
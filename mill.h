@@ -0,0 +1,239 @@
+#ifndef MILL_H
+#define MILL_H
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include "rng.h"
+
+#define MILL_MAGIC 0x4c4c494d // "MILL" in memory, marks a shared segment laid out by swim_mill
+#define MILL_VERSION 12 // Bumped whenever the layout of struct millHeader or the cells changes
+#define MILL_ALIGN 64 // Stripe locks and the pellet index start on a cache line boundary
+#define MILL_MAX_STRIPES 1024 // Max number of row stripe locks
+#define MILL_TICK_TIMEOUT_MS 1000 // Longest the tick advance waits for an actor that hasn't finished its step
+#define MILL_MAX_NODES 64 // NUMA nodes millBindBlocks can place memory on
+#define MILL_BLOCK_ROWS 64 // Rows summed together in the pellet index, and the height of a tile
+#define MILL_TILE_CELLS (MILL_BLOCK_ROWS * 64) // Cells in a tile: a block of rows by 64 columns (4 KB, one page)
+#define MILL_PAGE_WORDS 8 // Words of a row in one page of the pellet bitmap or a bit-plane (a block of rows by 512 columns, 4 KB)
+#define MILL_ACTOR_ONE 0x10000 // One registered actor in the barrier word (the low 16 bits count arrivals)
+#define MILL_EMPTY 0 // How an 'x' cell is stored, so untouched memory reads back as empty cells
+
+// How actors keep their cell updates from racing each other
+#define MILL_LOCK_GLOBAL 0 // One futex lock around every access (the original behavior, once a SysV semaphore)
+#define MILL_LOCK_STRIPED 1 // One futex lock per stripe of rows, no syscall unless contended
+#define MILL_LOCK_CAS 2 // No locks, cells change with atomic compare and swap
+
+// Random number streams (see rng.h), every actor draws from its own
+#define MILL_STREAM_SPAWNER 0 // swim_mill's pellet thread
+#define MILL_STREAM_FISH 1 // The fish
+#define MILL_STREAM_ENGINE 2 // Pellet placement in engine mode
+#define MILL_STREAM_PELLET 3 // First pellet process (pellet number n uses MILL_STREAM_PELLET + n)
+#define MILL_STREAM_FISHES 0x100000000ULL // Fish number n > 1 of the fish engine uses MILL_STREAM_FISHES + n (fish 1 uses MILL_STREAM_FISH)
+
+// What happened when a pellet was placed or moved
+#define MILL_MOVED 0 // Pellet was placed or moved down one row
+#define MILL_STAYED 1 // Pellet couldn't move this time and stays where it is
+#define MILL_EATEN 2 // Pellet landed on the fish
+#define MILL_PASSED 3 // Pellet left the last row
+#define MILL_COLLISION 4 // Pellet was placed on top of another pellet
+
+/* Layout of the shared memory segment: this header, the stripe locks, the global lock and the count of contended
+ * lock takes, the pellet index, then the tiles of cells
+ * swim_mill fills it in at runtime and fish/pellet read the geometry from it
+ *
+ * The cells are stored in tiles of MILL_BLOCK_ROWS rows by 64 columns, left to right and then block by block down
+ * the matrix (see millCellRun), so a pellet falling down its column stays in one tile for a whole block of rows
+ *
+ * The pellet index tracks every cell holding a pellet: one bit per cell, a count per row, per tile and per
+ * MILL_BLOCK_ROWS rows, so a uniformly random cell without a pellet is found without looking at the cells
+ * (see millFreeCell), and the same bits tell the fish where the pellets are without reading the rows cell by
+ * cell (see millPelletLeft/millPelletRight)
+ *
+ * Next to it are a fish plane and an eaten plane (one bit per 'F' and per 'E' cell), so every cell type has
+ * a bit-plane and a whole row of pellets can be advanced with word and vector operations (see millAdvancePellets)
+ *
+ * The bitmap and the planes are laid out in pages the same way, each MILL_BLOCK_ROWS rows by MILL_PAGE_WORDS words
+ * (see millWord), so the words of a row still share cache lines
+ *
+ * Every column of the last row also records which fish is on it (fish are numbered from 1, 0 means no fish),
+ * so an eaten pellet can be credited to the fish that ate it
+ *
+ * An empty mill is all zero bytes (an 'x' is stored as MILL_EMPTY and every index starts at zero), so the
+ * segment is sparse: the system only gives it memory for a page once something is written there, a fresh mill
+ * costs nothing however big it is, and the tiles the pellets have left are handed back by millReleaseEmpty, so
+ * the memory a run uses follows the number of pellets rather than the size of the matrix
+ * Tiles without a pellet (but those of the last block, where the fish swim) are never read, since reading a page
+ * that was never written makes the system allocate it too
+ */
+struct millHeader {
+    uint32_t magic; // Always MILL_MAGIC
+    uint32_t version; // Always MILL_VERSION
+    uint32_t rows; // Number of rows in the matrix
+    uint32_t cols; // Number of columns in the matrix
+    uint32_t tiles; // Number of tiles of cells (blocks * words)
+    uint32_t headerSize; // Bytes from the start of the segment to the first cell
+    uint64_t size; // Total size of the segment in bytes
+    uint32_t lockMode; // One of the MILL_LOCK_ modes
+    uint32_t stripes; // Number of stripe locks (a power of two, row r uses stripe r % stripes)
+    uint32_t stripeOffset; // Bytes from the start of the segment to the first stripe lock (the global lock and the contention count follow the last stripe)
+    uint32_t tickRate; // Ticks per second (0 means as fast as the actors can go)
+    uint32_t tick; // Global simulation clock, actors futex wait on it for the next tick
+    uint32_t barrier; // Registered actors (high 16 bits) and actors done with this tick (low 16 bits)
+    uint32_t fishDone; // One past the last tick the fish has finished moving on (pellets move after the fish)
+    uint32_t stop; // Set by millStop once the run is over, every actor finishes as soon as it sees it
+    uint32_t lastTick; // No actor steps on this tick or later (set with millTickEnd, UINT32_MAX until then)
+    uint64_t seed; // Seed every actor derives its random number stream from
+    uint32_t words; // 64 bit words per row in the pellet bitmap (and tiles per row block)
+    uint32_t blocks; // Number of MILL_BLOCK_ROWS row blocks
+    uint32_t bitPages; // Pages of the pellet bitmap (and of each bit-plane) per row block
+    uint64_t freeCount; // Number of cells without a pellet
+    uint64_t blockPelletOffset; // Bytes to the pellet count of every row block (uint32_t each)
+    uint64_t rowPelletOffset; // Bytes to the pellet count of every row (uint32_t each)
+    uint64_t tilePelletOffset; // Bytes to the pellet count of every tile (uint32_t each)
+    uint64_t pelletOffset; // Bytes to the pellet bitmap (blocks * bitPages pages of uint64_t, bit set = 'P')
+    uint64_t fishOffset; // Bytes to the fish plane (same shape as the pellet bitmap, bit set = 'F')
+    uint64_t eatenOffset; // Bytes to the eaten plane (same shape as the pellet bitmap, bit set = 'E')
+    uint64_t fishIdOffset; // Bytes to the number of the fish on every column of the last row (cols uint32_t)
+};
+
+size_t millSegmentSize( int rows, int cols );
+void millInit( struct millHeader *mill, int rows, int cols, int lockMode, int tickRate, uint64_t seed );
+int millCheck( const struct millHeader *mill );
+void millClear( struct millHeader *mill );
+void millRestore( struct millHeader *mill, const struct millHeader *saved );
+void millCopy( struct millHeader *to, const struct millHeader *from );
+void millReleaseEmpty( struct millHeader *mill );
+bool millBindBlocks( struct millHeader *mill, int first, int last, int node );
+void millCellChanged( struct millHeader *mill, int row, int col, char old, char value );
+int millFreeCell( struct millHeader *mill, struct rng *rng, int *row, int *col );
+int millFreeCells( struct millHeader *mill, struct rng *rng, uint64_t *cells, int count );
+void millDropPellets( struct millHeader *mill, struct rng *rng, uint64_t *cells, int count, uint32_t *eaten, uint32_t *collided );
+void millPlacePellets( struct millHeader *mill, const uint64_t *cells, int count, uint32_t *eaten, uint32_t *collided );
+uint64_t millDigest( struct millHeader *mill );
+uint32_t millRowPellets( const struct millHeader *mill, int row );
+uint32_t millBlockPellets( const struct millHeader *mill, int block );
+uint32_t millTilePellets( const struct millHeader *mill, int row, int w );
+uint64_t millPelletBits( const struct millHeader *mill, int row, int w, int first, int last );
+int millPelletLeft( const struct millHeader *mill, int row, int from, int to );
+int millPelletRight( const struct millHeader *mill, int row, int from, int to );
+int millFindPellet( struct millHeader *mill, int col, int home, struct rng *rng );
+void millFishEnter( struct millHeader *mill, int col, uint32_t fish );
+void millFishLeave( struct millHeader *mill, int col );
+uint32_t millFishAt( const struct millHeader *mill, int col );
+void millLockRows( struct millHeader *mill, int first, int last );
+void millUnlockRows( struct millHeader *mill, int first, int last );
+void millLockGlobal( struct millHeader *mill );
+void millUnlockGlobal( struct millHeader *mill );
+uint64_t millLockContention( struct millHeader *mill );
+int millPlacePellet( struct millHeader *mill, int row, int col );
+void millTickJoin( struct millHeader *mill );
+void millTickLeave( struct millHeader *mill );
+uint32_t millTickArrive( struct millHeader *mill, uint32_t tick );
+uint32_t millTickAdvance( struct millHeader *mill );
+bool millTickSettle( struct millHeader *mill );
+uint32_t millTickStart( struct millHeader *mill );
+void millTickFishDone( struct millHeader *mill, uint32_t tick );
+void millTickAfterFish( struct millHeader *mill, uint32_t tick );
+void millTickEnd( struct millHeader *mill, uint32_t tick );
+void millStop( struct millHeader *mill );
+void millWaitStop( struct millHeader *mill );
+int millMovePellet( struct millHeader *mill, int row, int col );
+void millAdvancePellets( struct millHeader *mill, uint32_t *eaten, uint32_t *passed );
+void millAdvanceBlocks( struct millHeader *mill, int first, int last, uint64_t *halo, uint32_t *eaten, uint32_t *passed );
+void millLandHalo( struct millHeader *mill, int block, const uint64_t *halo, uint32_t *eaten );
+uint64_t millCountBlocks( struct millHeader *mill, int first, int last );
+
+/* Returns the current tick of the simulation clock
+ */
+static inline uint32_t millTickNow( struct millHeader *mill ){
+    return __atomic_load_n( &mill->tick, __ATOMIC_ACQUIRE );
+}
+
+/* Returns true if the run ends before tick (see millTickEnd), so an actor that got tick from millTickArrive
+ * doesn't step on it and every actor runs exactly the same ticks
+ */
+static inline bool millTickOver( struct millHeader *mill, uint32_t tick ){
+    return tick >= __atomic_load_n( &mill->lastTick, __ATOMIC_ACQUIRE );
+}
+
+/* Returns true once swim_mill has stopped the run (see millStop)
+ */
+static inline bool millStopped( struct millHeader *mill ){
+    return __atomic_load_n( &mill->stop, __ATOMIC_ACQUIRE ) != 0;
+}
+
+/* Returns the first cell of the matrix
+ */
+static inline char *millCells( struct millHeader *mill ){
+    return (char *)mill + mill->headerSize;
+}
+
+/* Returns the tile holding row and the 64 columns of word w
+ */
+static inline size_t millTile( const struct millHeader *mill, int row, int w ){
+    return (size_t)(row / MILL_BLOCK_ROWS) * mill->words + w;
+}
+
+/* Returns where the 64 cells of word w of row start (they sit next to each other in their tile)
+ */
+static inline size_t millCellRun( const struct millHeader *mill, int row, int w ){
+    return (millTile( mill, row, w ) * MILL_BLOCK_ROWS + row % MILL_BLOCK_ROWS) * 64;
+}
+
+/* Returns where word w of row is in the pellet bitmap and the bit-planes
+ */
+static inline size_t millWord( const struct millHeader *mill, int row, int w ){
+    size_t page = (size_t)(row / MILL_BLOCK_ROWS) * mill->bitPages + w / MILL_PAGE_WORDS;
+    return (page * MILL_BLOCK_ROWS + row % MILL_BLOCK_ROWS) * MILL_PAGE_WORDS + w % MILL_PAGE_WORDS;
+}
+
+/* Returns the cell at row, col
+ */
+static inline char *millCell( struct millHeader *mill, int row, int col ){
+    return millCells( mill ) + millCellRun( mill, row, col / 64 ) + col % 64;
+}
+
+/* Returns how a character is stored in a cell
+ */
+static inline char millStored( char value ){
+    return (value == 'x') ? MILL_EMPTY : value;
+}
+
+/* Returns the character a stored cell stands for
+ */
+static inline char millShown( char stored ){
+    return (stored == MILL_EMPTY) ? 'x' : stored;
+}
+
+/* Returns the character at row, col
+ * Cells are read and written atomically so unlocked readers (and MILL_LOCK_CAS) never see torn updates
+ */
+static inline char millGet( struct millHeader *mill, int row, int col ){
+    return millShown( __atomic_load_n(millCell(mill, row, col), __ATOMIC_RELAXED) );
+}
+
+/* Sets the character at row, col (keeping the pellet index and the bit-planes up to date)
+ */
+static inline void millSet( struct millHeader *mill, int row, int col, char value ){
+    char old = millShown( __atomic_exchange_n(millCell(mill, row, col), millStored(value), __ATOMIC_RELAXED) );
+    if( old != value ){
+        millCellChanged( mill, row, col, old, value );
+    }
+}
+
+/* Changes the character at row, col from expected to value if nobody changed it first
+ * Returns true if the swap happened
+ */
+static inline bool millCas( struct millHeader *mill, int row, int col, char expected, char value ){
+    char stored = millStored( expected );
+    if( !__atomic_compare_exchange_n(millCell(mill, row, col), &stored, millStored(value),
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ){
+        return false;
+    }
+    if( expected != value ){
+        millCellChanged( mill, row, col, expected, value );
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE // For CPU_SET and pthread_setaffinity_np
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sched.h>
+#include<errno.h>
+#include "mill.h"
+#include "mill_affinity.h"
+
+#define NODE_PATH "/sys/devices/system/node/node%d/cpulist" // CPUs of each NUMA node
+#define CPULIST_MAX 4096 // Room for a line of a cpulist file
+
+// Prototype Functions (Comments on details are made with each function)
+static int parseCpus( const char *text, int *cpus );
+
+/* Makes the CPU list described by spec (see mill_affinity.h), NULL pins nothing
+ * Prints why and exits if spec isn't a list of CPUs swim_mill may run on
+ */
+void millAffinityInit( struct millAffinity *affinity, const char *spec ){
+    memset( affinity, 0, sizeof(*affinity) );
+    if( spec == NULL ){
+        return;
+    }
+    cpu_set_t allowed;
+    if( sched_getaffinity(0, sizeof(allowed), &allowed) == -1 ){
+        fprintf( stderr, "Error reading the CPUs swim_mill may run on: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    if( strcmp(spec, "all") == 0 ){
+        for( int cpu = 0; cpu < MILL_AFFINITY_MAX_CPUS && cpu < CPU_SETSIZE; cpu++ ){
+            if( CPU_ISSET(cpu, &allowed) ){
+                affinity->cpus[affinity->count++] = cpu;
+            }
+        }
+        return;
+    }
+    affinity->count = parseCpus( spec, affinity->cpus );
+    if( affinity->count < 1 ){
+        fprintf( stderr, "Unknown CPU list %s (all, or CPUs and ranges like 0-7,16-23 below %d).\n", spec, MILL_AFFINITY_MAX_CPUS );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < affinity->count; i++ ){
+        if( affinity->cpus[i] >= CPU_SETSIZE || !CPU_ISSET(affinity->cpus[i], &allowed) ){
+            fprintf( stderr, "CPU %d isn't one swim_mill may run on.\n", affinity->cpus[i] );
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Returns the CPU for the next simulation thread, or -1 if threads aren't pinned
+ */
+int millAffinityNext( struct millAffinity *affinity ){
+    if( affinity->count == 0 ){
+        return -1;
+    }
+    int simulation = (affinity->count > 1) ? affinity->count - 1 : 1; // The last CPU is kept for the service threads
+    return affinity->cpus[affinity->next++ % simulation];
+}
+
+/* Returns the CPU of the threads that only serve the run, or -1 if threads aren't pinned
+ */
+int millAffinityService( const struct millAffinity *affinity ){
+    return (affinity->count > 0) ? affinity->cpus[affinity->count - 1] : -1;
+}
+
+/* Keeps thread on cpu from now on (threads it creates start out there too), -1 leaves it where it is
+ */
+void millAffinityPin( pthread_t thread, int cpu ){
+    if( cpu < 0 ){
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    int code = pthread_setaffinity_np( thread, sizeof(set), &set );
+    if( code ){
+        fprintf( stderr, "Error pinning a thread to CPU %d: %s\n", cpu, strerror(code) );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Lets the calling process run on every CPU of the list again (nothing happens if threads aren't pinned)
+ * A child forked from a pinned thread starts out on that thread's CPU, so fish and pellet call this before exec
+ */
+void millAffinityRelease( const struct millAffinity *affinity ){
+    if( affinity->count == 0 ){
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for( int i = 0; i < affinity->count; i++ ){
+        CPU_SET( affinity->cpus[i], &set );
+    }
+    if( sched_setaffinity(0, sizeof(set), &set) == -1 ){
+        fprintf( stderr, "Error letting a process run on the CPUs of -A: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Returns the NUMA node cpu belongs to, or -1 if the system doesn't say
+ */
+int millCpuNode( int cpu ){
+    static int cpus[MILL_AFFINITY_MAX_CPUS];
+    char path[64];
+    char line[CPULIST_MAX];
+    for( int node = 0; node < MILL_MAX_NODES; node++ ){
+        snprintf( path, sizeof(path), NODE_PATH, node );
+        FILE *file = fopen( path, "r" );
+        if( file == NULL ){
+            continue; // Node numbers can have gaps
+        }
+        int count = (fgets(line, sizeof(line), file) != NULL) ? parseCpus( strtok(line, "\n"), cpus ) : 0;
+        fclose( file );
+        for( int i = 0; i < count; i++ ){
+            if( cpus[i] == cpu ){
+                return node;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Reads a list of CPUs and ranges of CPUs (0-3,8,10-11) into cpus
+ * Returns the number of CPUs read, or -1 if text isn't such a list (or names a CPU past MILL_AFFINITY_MAX_CPUS)
+ */
+static int parseCpus( const char *text, int *cpus ){
+    int count = 0;
+    while( text != NULL && *text != '\0' ){
+        char *end;
+        long first = strtol( text, &end, 10 );
+        long last = first;
+        if( end == text ){
+            return -1;
+        }
+        if( *end == '-' ){
+            text = end + 1;
+            last = strtol( text, &end, 10 );
+            if( end == text ){
+                return -1;
+            }
+        }
+        if( first < 0 || last < first || last >= MILL_AFFINITY_MAX_CPUS || count + (last - first + 1) > MILL_AFFINITY_MAX_CPUS ){
+            return -1;
+        }
+        for( long cpu = first; cpu <= last; cpu++ ){
+            cpus[count++] = (int)cpu;
+        }
+        if( *end != ',' && *end != '\0' ){
+            return -1;
+        }
+        text = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
@@ -0,0 +1,31 @@
+#ifndef MILL_AFFINITY_H
+#define MILL_AFFINITY_H
+
+#include<pthread.h>
+
+/* Where swim_mill's threads run (swim_mill -A)
+ * The CPUs are given as a list like 0-7,16-23 (or all, every CPU swim_mill may run on). The last CPU of the list
+ * is kept for the threads that only serve the run: the main thread printing the matrix, the event log writer, the
+ * reaper and the checkpoint writer. Every other CPU goes to the simulation threads (engine workers, fish workers,
+ * the pellet and fish threads) in list order, one thread each, starting over once they are all taken
+ * With one CPU everything shares it. Without -A no thread is pinned. The fish and pellet processes aren't pinned
+ * either: they may run on any CPU of the list
+ * See millBindBlocks for how the planes engine keeps each band of the matrix on the NUMA node of its worker
+ */
+
+#define MILL_AFFINITY_MAX_CPUS 1024 // Highest CPU number plus one a list may name
+
+struct millAffinity {
+    int count; // CPUs in the list (0 when threads aren't pinned)
+    int cpus[MILL_AFFINITY_MAX_CPUS]; // The CPUs, in the order they are handed out
+    int next; // Simulation CPUs handed out so far
+};
+
+void millAffinityInit( struct millAffinity *affinity, const char *spec );
+int millAffinityNext( struct millAffinity *affinity );
+int millAffinityService( const struct millAffinity *affinity );
+void millAffinityPin( pthread_t thread, int cpu );
+void millAffinityRelease( const struct millAffinity *affinity );
+int millCpuNode( int cpu );
+
+#endif
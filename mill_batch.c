@@ -0,0 +1,333 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<pthread.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<errno.h>
+#include "mill.h"
+#include "fish_engine.h"
+#include "pellet_engine.h"
+#include "pellet_feed.h"
+#include "rng.h"
+
+/* Runs many independent mills in one process, spread over every core, and prints the statistics of each run
+ * Every mill is private memory (no SysV shared memory or semaphore keys, so any number of runs or batches can
+ * run side by side) and takes the same steps as swim_mill -e -f: the fish move, then every pellet moves down a row,
+ * then 1 to 5 new pellets are dropped (or as many as the -a feed asks for, see pellet_feed.h)
+ * -P makes every fish plan that many ticks ahead (see fish_plan.h) instead of heading for the closest pellet
+ * -r, -c and -f take comma separated lists, and every combination is run -k times (run i is seeded with seed + i)
+ * Output is CSV, one line per run: run,seed,rows,cols,fish,ticks,spawned,eaten,passed,collisions,travel,seconds
+ * followed on stderr by the mean of every statistic for each combination
+ */
+
+#define ROW 16 // Default number of rows
+#define COL 16 // Default number of columns
+#define TICKS 30 // Default number of ticks each mill runs for (MAX_TIME of swim_mill at one tick per second)
+#define RUNS 1 // Default number of runs of every combination
+#define MAX_VALUES 64 // Max number of values in a comma separated list
+
+// One mill to run and, once it is done, what happened in it
+struct batchRun {
+    int rows;
+    int cols;
+    int fish;
+    uint64_t seed;
+    long spawned; // Pellets dropped
+    long eaten; // Pellets eaten by a fish
+    long passed; // Pellets that left the last row
+    long collisions; // Pellets dropped on top of another pellet
+    long travel; // Columns moved by all the fish together
+    double seconds; // Time the run took
+};
+
+// The runs one thread owns (run numbers first through last - 1 that haven't been taken yet)
+// The owner takes runs from the front and threads that ran out of work steal from the back
+// Both ends change under the mutex but with atomic stores, since thieves size up every shard without locking it
+struct batchShard {
+    pthread_mutex_t mutex;
+    int first;
+    int last;
+};
+
+struct batchRun *runs; // Every run of the batch
+struct batchShard *shards; // One shard of runs per thread
+int threadCount; // Number of threads running mills
+long ticks = TICKS; // Ticks every mill runs for
+int horizon; // Ticks the fish plan ahead (0 heads for the closest pellet)
+struct pelletFeed feed; // How many pellets are dropped every tick (each run feeds from a copy of its own)
+static __thread struct batchRun *current; // Run the calling thread is working on (pellet reports go to it)
+
+// Prototype Functions (Comments on details are made after the main function)
+static void *batchWorker( void *arg );
+static bool takeRun( int self, int *run );
+void runMill( struct batchRun *run );
+void noLock( int first, int last, bool lock );
+void countPellet( const struct pelletExit *done );
+int parseList( const char *text, int *values );
+double now( void );
+
+int main( int argc, char *argv[] ){
+    int rowValues[MAX_VALUES] = { ROW };
+    int colValues[MAX_VALUES] = { COL };
+    int fishValues[MAX_VALUES] = { 1 };
+    int rowCount = 1, colCount = 1, fishCount = 1;
+    int repeats = RUNS;
+    uint64_t seed = 1;
+    const char *feedSpec = "uniform";
+    int option;
+    threadCount = sysconf( _SC_NPROCESSORS_ONLN );
+
+    while( (option = getopt(argc, argv, "r:c:f:k:n:j:s:P:a:")) != -1 ){
+        switch( option ){
+            case 'r':
+                rowCount = parseList( optarg, rowValues );
+                break;
+            case 'c':
+                colCount = parseList( optarg, colValues );
+                break;
+            case 'f':
+                fishCount = parseList( optarg, fishValues );
+                break;
+            case 'k':
+                repeats = atoi( optarg );
+                break;
+            case 'n':
+                ticks = atol( optarg );
+                break;
+            case 'j':
+                threadCount = atoi( optarg );
+                break;
+            case 's':
+                seed = strtoull( optarg, NULL, 0 );
+                break;
+            case 'P':
+                horizon = atoi( optarg );
+                break;
+            case 'a':
+                feedSpec = optarg;
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-r rows,...] [-c cols,...] [-f fish,...] [-k runs of each] [-n ticks] [-j threads] [-s seed] [-P plan horizon] [-a feed]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( rowCount < 1 || colCount < 1 || fishCount < 1 || repeats < 1 || ticks < 1 || threadCount < 1 ||
+        horizon < 0 || horizon > FISH_PLAN_MAX_HORIZON ){
+        fprintf( stderr, "Invalid arguments.\n" );
+        exit(EXIT_FAILURE);
+    }
+    pelletFeedInit( &feed, feedSpec );
+    for( int r = 0; r < rowCount; r++ ){
+        for( int c = 0; c < colCount; c++ ){
+            for( int f = 0; f < fishCount; f++ ){
+                if( rowValues[r] < 2 || colValues[c] < 1 || fishValues[f] < 1 || fishValues[f] > colValues[c] ){
+                    fprintf( stderr, "Every mill needs at least 2 rows, 1 column and from 1 to cols fish.\n" );
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+
+    int combinations = rowCount * colCount * fishCount;
+    int total = combinations * repeats;
+    runs = calloc( total, sizeof(struct batchRun) );
+    shards = calloc( threadCount, sizeof(struct batchShard) );
+    pthread_t *threads = calloc( threadCount, sizeof(pthread_t) );
+    if( runs == NULL || shards == NULL || threads == NULL ){
+        fprintf( stderr, "Error allocating the batch: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < total; i++ ){
+        int combination = i / repeats;
+        runs[i].rows = rowValues[combination / (colCount * fishCount)];
+        runs[i].cols = colValues[combination / fishCount % colCount];
+        runs[i].fish = fishValues[combination % fishCount];
+        runs[i].seed = seed + i;
+    }
+    // Every thread starts out with an equal, contiguous share of the runs
+    for( int t = 0; t < threadCount; t++ ){
+        pthread_mutex_init( &shards[t].mutex, NULL );
+        shards[t].first = (int)((long)total * t / threadCount);
+        shards[t].last = (int)((long)total * (t + 1) / threadCount);
+    }
+
+    double start = now();
+    for( long t = 0; t < threadCount; t++ ){
+        int code = pthread_create( &threads[t], NULL, batchWorker, (void *)t );
+        if( code ){
+            fprintf( stderr, "pthread_create failed with code %d.\n", code );
+            exit(EXIT_FAILURE);
+        }
+    }
+    for( int t = 0; t < threadCount; t++ ){
+        pthread_join( threads[t], NULL );
+    }
+    double seconds = now() - start;
+
+    printf( "run,seed,rows,cols,fish,ticks,spawned,eaten,passed,collisions,travel,seconds\n" );
+    for( int i = 0; i < total; i++ ){
+        struct batchRun *run = &runs[i];
+        printf( "%d,%llu,%d,%d,%d,%ld,%ld,%ld,%ld,%ld,%ld,%.6f\n", i, (unsigned long long)run->seed, run->rows, run->cols,
+                run->fish, ticks, run->spawned, run->eaten, run->passed, run->collisions, run->travel, run->seconds );
+    }
+    // Mean of every statistic for each combination
+    fprintf( stderr, "rows,cols,fish,runs,spawned,eaten,passed,collisions,travel,eaten_ratio\n" );
+    for( int c = 0; c < combinations; c++ ){
+        double spawned = 0, eaten = 0, passed = 0, collisions = 0, travel = 0;
+        struct batchRun *first = &runs[c * repeats];
+        for( int i = c * repeats; i < (c + 1) * repeats; i++ ){
+            spawned += runs[i].spawned;
+            eaten += runs[i].eaten;
+            passed += runs[i].passed;
+            collisions += runs[i].collisions;
+            travel += runs[i].travel;
+        }
+        fprintf( stderr, "%d,%d,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.4f\n", first->rows, first->cols, first->fish, repeats,
+                 spawned / repeats, eaten / repeats, passed / repeats, collisions / repeats, travel / repeats,
+                 (eaten + passed > 0) ? eaten / (eaten + passed) : 0.0 );
+    }
+    fprintf( stderr, "%d runs on %d threads in %.3f seconds.\n", total, threadCount, seconds );
+
+    for( int t = 0; t < threadCount; t++ ){
+        pthread_mutex_destroy( &shards[t].mutex );
+    }
+    free( threads );
+    free( shards );
+    free( runs );
+    pelletFeedDestroy( &feed );
+    return 0;
+}
+
+/* Runs mills until no thread has any left
+ */
+static void *batchWorker( void *arg ){
+    int self = (int)(long)arg;
+    int run;
+    while( takeRun(self, &run) ){
+        runMill( &runs[run] );
+    }
+    return NULL;
+}
+
+/* Takes the next run from this thread's own shard, or steals the last run of the shard with the most left
+ * Returns false once every shard is empty
+ */
+static bool takeRun( int self, int *run ){
+    struct batchShard *own = &shards[self];
+    pthread_mutex_lock( &own->mutex );
+    if( own->first < own->last ){
+        *run = own->first;
+        __atomic_store_n( &own->first, own->first + 1, __ATOMIC_RELAXED );
+        pthread_mutex_unlock( &own->mutex );
+        return true;
+    }
+    pthread_mutex_unlock( &own->mutex );
+
+    while( 1 ){
+        int victim = -1;
+        int most = 0;
+        for( int t = 0; t < threadCount; t++ ){
+            int left = __atomic_load_n( &shards[t].last, __ATOMIC_RELAXED ) - __atomic_load_n( &shards[t].first, __ATOMIC_RELAXED );
+            if( t != self && left > most ){
+                most = left;
+                victim = t;
+            }
+        }
+        if( victim == -1 ){
+            return false;
+        }
+        struct batchShard *shard = &shards[victim];
+        pthread_mutex_lock( &shard->mutex );
+        if( shard->first < shard->last ){
+            *run = shard->last - 1;
+            __atomic_store_n( &shard->last, shard->last - 1, __ATOMIC_RELAXED );
+            pthread_mutex_unlock( &shard->mutex );
+            return true;
+        }
+        pthread_mutex_unlock( &shard->mutex ); // Someone else got there first, look again
+    }
+}
+
+/* Runs one mill for ticks ticks on the calling thread and fills in its statistics
+ */
+void runMill( struct batchRun *run ){
+    double start = now();
+    struct millHeader *mill = aligned_alloc( MILL_ALIGN, millSegmentSize(run->rows, run->cols) );
+    if( mill == NULL ){
+        fprintf( stderr, "Error allocating a mill: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    millInit( mill, run->rows, run->cols, MILL_LOCK_GLOBAL, 0, run->seed );
+    millClear( mill );
+
+    struct rng spawner;
+    rngSeed( &spawner, run->seed, MILL_STREAM_SPAWNER );
+    struct pelletFeed runFeed = feed; // Starts out calm like every other run
+    current = run;
+    struct fishEngine *fish = fishEngineCreate( mill, run->fish, 0, run->seed, noLock );
+    fishEnginePlan( fish, horizon );
+    struct pelletEngine *pellets = pelletEngineCreate( mill, 0, run->rows * run->cols, run->seed, noLock, countPellet );
+    for( long tick = 0; tick < ticks; tick++ ){
+        if( tick > 0 ){
+            fishEngineStep( fish ); // The fish is placed on tick 0 and moves from tick 1 on, like ./fish
+        }
+        pelletEngineStep( pellets );
+        int count = pelletFeedNext( &runFeed, &spawner, tick ); // 1 to 5 unless -a says otherwise
+        run->spawned += count;
+        pelletEngineSpawn( pellets, count );
+    }
+    for( int i = 0; i < fish->count; i++ ){
+        run->travel += fish->fish[i].travel;
+    }
+    pelletEngineDestroy( pellets );
+    fishEngineDestroy( fish );
+    free( mill );
+    current = NULL;
+    run->seconds = now() - start;
+}
+
+/* Private mills are only touched by the thread running them, so there is nothing to lock
+ */
+void noLock( int first, int last, bool lock ){
+}
+
+/* Adds a finished pellet to the statistics of the run the calling thread is working on
+ */
+void countPellet( const struct pelletExit *done ){
+    if( done->code == PELLET_EATEN ){
+        current->eaten++;
+    } else if( done->code == PELLET_PASSED ){
+        current->passed++;
+    } else if( done->code == PELLET_COLLISION ){
+        current->collisions++;
+    }
+}
+
+/* Reads a comma separated list of numbers into values
+ * Returns the number of values read (0 if there are too many)
+ */
+int parseList( const char *text, int *values ){
+    int count = 0;
+    while( *text != '\0' ){
+        if( count == MAX_VALUES ){
+            return 0;
+        }
+        char *end;
+        values[count++] = strtol( text, &end, 10 );
+        text = (*end == ',') ? end + 1 : end;
+        if( end == text && *end != '\0' ){
+            return 0; // Not a number
+        }
+    }
+    return count;
+}
+
+/* Returns the current time in seconds
+ */
+double now( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
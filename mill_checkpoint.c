@@ -0,0 +1,147 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<limits.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<errno.h>
+#include "mill_checkpoint.h"
+
+#define CHECKPOINT_CHUNK 65536 // The segment is written in chunks this big, chunks of zeros are left as holes
+
+// Prototype Functions (Comments on details are made with each function)
+static uint64_t checkpointAlign( uint64_t offset );
+static bool writeAt( int fd, const void *data, size_t size, uint64_t offset );
+static bool writeSparse( int fd, const void *data, size_t size, uint64_t offset );
+
+/* Writes a checkpoint of the run to path: checkpoint (mode, tick, ticks, the feed and the random number streams
+ * filled in by the caller), the copy of the shared segment, and the pellet engine's and the fish pool's records
+ * (pellets is NULL in planes mode)
+ * Meant to run in a forked child, so it never exits: returns false (after printing why) if the file couldn't be written
+ */
+bool millCheckpointWrite( const char *path, struct millCheckpoint *checkpoint, const struct millHeader *segment,
+                          const struct pelletEngine *pellets, const struct fishEngine *fish ){
+    int lanes = (pellets == NULL) ? 0 : (pellets->workers > 0) ? pellets->workers : 1;
+    checkpoint->pelletCount = 0;
+    for( int i = 0; i < lanes; i++ ){
+        checkpoint->pelletCount += pellets->lanes[i].count;
+    }
+    checkpoint->fishCount = fish->count;
+    checkpoint->segmentOffset = checkpointAlign( sizeof(*checkpoint) );
+    checkpoint->pelletOffset = checkpointAlign( checkpoint->segmentOffset + segment->size );
+    checkpoint->fishOffset = checkpointAlign( checkpoint->pelletOffset + checkpoint->pelletCount * sizeof(struct pelletRecord) );
+    checkpoint->size = checkpoint->fishOffset + (uint64_t)fish->count * sizeof(struct fishRecord);
+    checkpoint->version = MILL_CHECKPOINT_VERSION;
+    checkpoint->magic = MILL_CHECKPOINT_MAGIC;
+
+    char partial[PATH_MAX]; // The file is written here and renamed to path once it is whole
+    if( snprintf(partial, sizeof(partial), "%s.partial", path) >= (int)sizeof(partial) ){
+        fprintf( stderr, "Checkpoint path %s is too long.\n", path );
+        return false;
+    }
+    int fd = open( partial, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+    if( fd == -1 ){
+        fprintf( stderr, "Error opening %s: %s\n", partial, strerror(errno) );
+        return false;
+    }
+    bool written = ftruncate( fd, checkpoint->size ) == 0 && // The gaps between the parts read back as zeros
+                   writeAt( fd, checkpoint, sizeof(*checkpoint), 0 ) &&
+                   writeSparse( fd, segment, segment->size, checkpoint->segmentOffset );
+    uint64_t offset = checkpoint->pelletOffset;
+    for( int i = 0; i < lanes && written; i++ ){
+        size_t size = pellets->lanes[i].count * sizeof(struct pelletRecord);
+        written = writeAt( fd, pellets->lanes[i].pellets, size, offset );
+        offset += size;
+    }
+    written = written && writeAt( fd, fish->fish, fish->count * sizeof(struct fishRecord), checkpoint->fishOffset );
+    written = written && fsync( fd ) == 0; // On disk before it takes the place of the last checkpoint
+    if( close(fd) == -1 || !written || rename(partial, path) == -1 ){
+        fprintf( stderr, "Error writing checkpoint %s: %s\n", path, strerror(errno) );
+        unlink( partial );
+        return false;
+    }
+    return true;
+}
+
+/* Maps the checkpoint at path (privately, so the run never writes to it) and checks every part fits in the file
+ */
+struct millCheckpoint *millCheckpointOpen( const char *path ){
+    int fd = open( path, O_RDONLY );
+    if( fd == -1 ){
+        fprintf( stderr, "Error opening checkpoint %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if( fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct millCheckpoint) ){
+        fprintf( stderr, "%s is not a checkpoint.\n", path );
+        exit(EXIT_FAILURE);
+    }
+    struct millCheckpoint *checkpoint = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd ); // The mapping keeps the file open
+    if( checkpoint == MAP_FAILED ){
+        fprintf( stderr, "Error with mmap of %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    uint64_t size = st.st_size;
+    if( checkpoint->magic != MILL_CHECKPOINT_MAGIC || checkpoint->version != MILL_CHECKPOINT_VERSION || checkpoint->size != size ||
+        checkpoint->segmentOffset + sizeof(struct millHeader) > size || millCheck(millCheckpointSegment(checkpoint)) == -1 ||
+        checkpoint->segmentOffset + millCheckpointSegment(checkpoint)->size > checkpoint->pelletOffset ||
+        checkpoint->pelletOffset + checkpoint->pelletCount * sizeof(struct pelletRecord) > checkpoint->fishOffset ||
+        checkpoint->fishCount < 1 || checkpoint->workers < 0 || checkpoint->capacity < 1 || checkpoint->fishOffset + (uint64_t)checkpoint->fishCount * sizeof(struct fishRecord) > size ||
+        memchr(checkpoint->feed, '\0', sizeof(checkpoint->feed)) == NULL ){
+        fprintf( stderr, "%s is not a checkpoint of this version of swim_mill.\n", path );
+        exit(EXIT_FAILURE);
+    }
+    return checkpoint;
+}
+
+/* Unmaps a checkpoint opened by millCheckpointOpen
+ */
+void millCheckpointClose( struct millCheckpoint *checkpoint ){
+    munmap( checkpoint, checkpoint->size );
+}
+
+/* Rounds offset up to the next MILL_ALIGN boundary
+ */
+static uint64_t checkpointAlign( uint64_t offset ){
+    return (offset + MILL_ALIGN - 1) & ~(uint64_t)(MILL_ALIGN - 1);
+}
+
+/* Writes size bytes of data at offset of the file, returns false if it couldn't
+ */
+static bool writeAt( int fd, const void *data, size_t size, uint64_t offset ){
+    const char *next = data;
+    while( size > 0 ){
+        ssize_t written = pwrite( fd, next, size, offset );
+        if( written == -1 && errno == EINTR ){
+            continue;
+        }
+        if( written <= 0 ){
+            return false;
+        }
+        next += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+/* Writes size bytes of data at offset of the file like writeAt, skipping every chunk that is all zeros
+ * (the file was sized with ftruncate, so those read back as zeros without taking any disk space)
+ */
+static bool writeSparse( int fd, const void *data, size_t size, uint64_t offset ){
+    const char *next = data;
+    for( size_t done = 0; done < size; done += CHECKPOINT_CHUNK ){
+        size_t chunk = (size - done < CHECKPOINT_CHUNK) ? size - done : CHECKPOINT_CHUNK;
+        size_t i = 0;
+        while( i < chunk && next[done + i] == 0 ){
+            i++;
+        }
+        if( i < chunk && !writeAt(fd, next + done, chunk, offset + done) ){
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef MILL_CHECKPOINT_H
+#define MILL_CHECKPOINT_H
+
+#include<stdbool.h>
+#include<stdint.h>
+#include "mill.h"
+#include "rng.h"
+#include "fish_engine.h"
+#include "pellet_engine.h"
+#include "pellet_feed.h"
+
+/* Checkpoint of a whole run, written every few ticks so a run that dies can be picked up again (swim_mill -R)
+ * Only runs whose actors all live inside swim_mill can be saved: engine (-e) or planes (-b) mode with a fish pool
+ * (-f), since the state of a ./pellet or ./fish process can't be read from outside it
+ *
+ * The file is laid out to be mapped and used in place: this header, then a copy of the shared segment (the
+ * matrix, its pellet index and bit-planes, the tick), then every pellet record of the engine, then every fish
+ * record, each part starting on a MILL_ALIGN boundary
+ * swim_mill takes the copy of the segment while every actor waits at the tick barrier and forks a child that
+ * writes the file from its copy-on-write view of the engines, so the run only waits for a copy of the tiles
+ * holding pellets (see millCopy) and a fork
+ * Tiles of the copy without a pellet are left as holes in the file, so it stays as sparse as the mill
+ * The file is written next to its name and renamed over it, so there is always a whole checkpoint on disk
+ */
+
+#define MILL_CHECKPOINT_MAGIC 0x504b434d // "MCKP" in memory
+#define MILL_CHECKPOINT_VERSION 5 // Bumped whenever the layout of the file changes
+#define MILL_CHECKPOINT_ENGINE 1 // The run used the pellet engine (-e)
+#define MILL_CHECKPOINT_PLANES 2 // The run used the pellet planes (-b)
+
+struct millCheckpoint {
+    uint32_t magic; // Always MILL_CHECKPOINT_MAGIC
+    uint32_t version; // Always MILL_CHECKPOINT_VERSION
+    uint64_t size; // Bytes in the file
+    uint32_t mode; // MILL_CHECKPOINT_ENGINE or MILL_CHECKPOINT_PLANES
+    uint32_t tick; // Tick the run picks up on
+    int64_t ticks; // Length of the whole run in ticks
+    struct rng spawner; // Random number stream of swim_mill's pellet thread
+    struct rng placer; // Random number stream the pellet engine places pellets with
+    uint64_t nextId; // Last pellet ID the pellet engine gave out
+    int32_t fishCount; // Number of fish records
+    int32_t horizon; // Ticks the fish planned ahead (0 when they headed for the closest pellet)
+    int32_t bursting; // The feed was in the middle of a burst
+    int32_t workers; // Pellet worker threads (-w, they decide the order pellets finishing on the same tick are logged in)
+    int32_t capacity; // Pool size of the pellet engine (-p, pellets past it aren't dropped)
+    uint64_t pelletCount; // Number of pellet records
+    uint64_t segmentOffset; // Bytes to the copy of the shared segment (its own header says how big it is)
+    uint64_t pelletOffset; // Bytes to the pellet records
+    uint64_t fishOffset; // Bytes to the fish records
+    char feed[PELLET_FEED_SPEC_MAX]; // Spec of the feed that dropped the pellets (see pellet_feed.h)
+};
+
+bool millCheckpointWrite( const char *path, struct millCheckpoint *checkpoint, const struct millHeader *segment,
+                          const struct pelletEngine *pellets, const struct fishEngine *fish );
+struct millCheckpoint *millCheckpointOpen( const char *path );
+void millCheckpointClose( struct millCheckpoint *checkpoint );
+
+/* Returns the saved shared segment
+ */
+static inline const struct millHeader *millCheckpointSegment( const struct millCheckpoint *checkpoint ){
+    return (const struct millHeader *)((const char *)checkpoint + checkpoint->segmentOffset);
+}
+
+/* Returns the saved pellet records (pelletCount of them)
+ */
+static inline const struct pelletRecord *millCheckpointPellets( const struct millCheckpoint *checkpoint ){
+    return (const struct pelletRecord *)((const char *)checkpoint + checkpoint->pelletOffset);
+}
+
+/* Returns the saved fish records (fishCount of them)
+ */
+static inline const struct fishRecord *millCheckpointFish( const struct millCheckpoint *checkpoint ){
+    return (const struct fishRecord *)((const char *)checkpoint + checkpoint->fishOffset);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include "event_log.h"
+
+/* Decodes an event log written by swim_mill (swim_mill_results.bin by default)
+ * Prints the same text swim_mill_results.txt used to hold, or with -c one CSV line per event:
+ * tick,actor,type,fish,row,col
+ */
+
+int main( int argc, char *argv[] ){
+    bool csv = false;
+    int option;
+    while( (option = getopt(argc, argv, "c")) != -1 ){
+        switch( option ){
+            case 'c':
+                csv = true;
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-c] [event log]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    const char *path = (optind < argc) ? argv[optind] : "swim_mill_results.bin";
+    FILE *in = fopen( path, "r" );
+    if( in == NULL ){
+        fprintf( stderr, "Error opening %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    char magic[4];
+    uint16_t version, flags;
+    if( fread(magic, 1, 4, in) != 4 || memcmp(magic, EVENT_MAGIC, 4) != 0 ||
+        fread(&version, sizeof(version), 1, in) != 1 || fread(&flags, sizeof(flags), 1, in) != 1 ){
+        fprintf( stderr, "%s is not an event log.\n", path );
+        exit(EXIT_FAILURE);
+    }
+    if( version > EVENT_VERSION ){
+        fprintf( stderr, "%s has event log version %u, this decoder knows up to %u.\n", path, version, EVENT_VERSION );
+        exit(EXIT_FAILURE);
+    }
+    if( csv ){
+        printf( "tick,actor,type,fish,row,col\n" );
+    }
+
+    uint16_t length;
+    while( fread(&length, sizeof(length), 1, in) == 1 ){
+        struct eventRecord record;
+        size_t known = (length < sizeof(record)) ? length : sizeof(record); // Fields this decoder doesn't know are skipped
+        memset( &record, 0, sizeof(record) );
+        if( fread(&record, 1, known, in) != known || fseek(in, length - known, SEEK_CUR) == -1 ){
+            fprintf( stderr, "%s ends in the middle of an event.\n", path );
+            exit(EXIT_FAILURE);
+        }
+        if( csv ){
+            printf( "%u,%llu,%u,%u,%d,%d\n", record.tick, (unsigned long long)eventActor(&record), record.type, record.fish, record.row, record.col );
+        } else {
+            eventLogFormat( stdout, flags, &record );
+        }
+    }
+    fclose( in );
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<signal.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<errno.h>
+#include "mill_ipc.h"
+
+#define OBJ_PERMS ( S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP ) // Read/Write permissions for owner or group owner
+
+/* Writes the name of the segment belonging to the swim_mill with PID owner into name
+ */
+void millIpcName( char *name, size_t size, pid_t owner ){
+    snprintf( name, size, "%s%d", MILL_IPC_PREFIX, (int)owner );
+}
+
+/* Creates the shared memory object name with size bytes and maps it
+ * A big segment asks for transparent huge pages, so the rows and bit-planes every actor walks need far fewer TLB
+ * entries (the kernel quietly ignores the request where shmem huge pages are turned off)
+ */
+struct millHeader *millIpcCreate( const char *name, size_t size ){
+    int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, OBJ_PERMS );
+    // An object with this name can only be left over from a run whose PID has been reused, so start over
+    if( fd == -1 && errno == EEXIST && shm_unlink(name) != -1 ){
+        fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, OBJ_PERMS );
+    }
+    if( fd == -1 ){
+        fprintf( stderr, "Error with shm_open %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    if( ftruncate(fd, size) == -1 ){
+        fprintf( stderr, "Error with ftruncate %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    struct millHeader *mill = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd ); // The mapping keeps the object open
+    if( mill == MAP_FAILED ){
+        fprintf( stderr, "Error with mmap: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    if( size >= MILL_IPC_HUGE_PAGE ){
+        madvise( mill, size, MADV_HUGEPAGE );
+    }
+    return mill;
+}
+
+/* Maps the segment swim_mill created and checks that it was laid out by a swim_mill with the same layout version
+ */
+struct millHeader *millIpcAttach( const char *name ){
+    if( name == NULL ){
+        fprintf( stderr, "No shared memory to attach to (%s isn't set, start this from swim_mill).\n", MILL_IPC_ENV );
+        exit(EXIT_FAILURE);
+    }
+    int fd = shm_open( name, O_RDWR, OBJ_PERMS );
+    if( fd == -1 ){
+        fprintf( stderr, "Error with shm_open %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if( fstat(fd, &st) == -1 ){
+        fprintf( stderr, "Error with fstat %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    if( (size_t)st.st_size < sizeof(struct millHeader) ){
+        fprintf( stderr, "Shared memory %s is too small to be a mill.\n", name );
+        exit(EXIT_FAILURE);
+    }
+    struct millHeader *mill = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( mill == MAP_FAILED ){
+        fprintf( stderr, "Error with mmap: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    if( millCheck(mill) == -1 || mill->size != (uint64_t)st.st_size ){
+        fprintf( stderr, "Shared memory has an unknown layout (magic %#x, version %u).\n", mill->magic, mill->version );
+        exit(EXIT_FAILURE);
+    }
+    return mill;
+}
+
+/* Unmaps a segment
+ */
+void millIpcDetach( struct millHeader *mill ){
+    if( munmap(mill, mill->size) == -1 ){
+        fprintf( stderr, "Error with munmap: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Removes the shared memory object name (processes that still have it mapped keep their mapping)
+ */
+void millIpcRemove( const char *name ){
+    if( shm_unlink(name) == -1 ){
+        fprintf( stderr, "Error with shm_unlink: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Removes every object left behind by a swim_mill that is no longer running (its segment and anything named
+ * after it, like its timings), so a run that crashed doesn't leave memory pinned in the system
+ * Returns the number of objects removed
+ */
+int millIpcSweep( void ){
+    DIR *dir = opendir( MILL_IPC_DIR );
+    if( dir == NULL ){
+        return 0; // No shared memory directory to look in, so nothing to clean up
+    }
+    const char *prefix = MILL_IPC_PREFIX + 1; // Names in the directory have no leading slash
+    size_t length = strlen( prefix );
+    int removed = 0;
+    struct dirent *entry;
+    while( (entry = readdir(dir)) != NULL ){
+        if( strncmp(entry->d_name, prefix, length) != 0 ){
+            continue;
+        }
+        char *end;
+        long owner = strtol( entry->d_name + length, &end, 10 );
+        if( end == entry->d_name + length || (*end != '\0' && *end != '.') || owner <= 0 ){
+            continue; // Not named after a PID
+        }
+        if( kill((pid_t)owner, 0) == 0 || errno != ESRCH ){
+            continue; // Its swim_mill is still running (or belongs to someone else)
+        }
+        char name[sizeof(entry->d_name) + 1];
+        snprintf( name, sizeof(name), "/%s", entry->d_name );
+        removed += (shm_unlink(name) == 0);
+    }
+    closedir( dir );
+    return removed;
+}
@@ -0,0 +1,29 @@
+#ifndef MILL_IPC_H
+#define MILL_IPC_H
+
+#include<stddef.h>
+#include<sys/types.h>
+#include "mill.h"
+
+/* Shared memory for swim_mill, fish and pellet
+ * The segment is a POSIX shared memory object (shm_open + mmap) named after the PID of the swim_mill that made it,
+ * so any number of runs can go side by side, and every lock lives inside it as a futex word (see millLockGlobal
+ * and millLockRows), so there is no semaphore set to create, open or remove
+ * swim_mill hands the name to fish and pellet in the MILL_IPC_ENV environment variable
+ * A run that crashes leaves its objects behind, so every swim_mill first removes the ones whose PID is gone
+ */
+
+#define MILL_IPC_ENV "SWIM_MILL_SHM" // Environment variable holding the name of the run's segment
+#define MILL_IPC_PREFIX "/swim_mill." // Segments are named this followed by the PID of their swim_mill
+#define MILL_IPC_NAME_MAX 64 // Room for a segment name
+#define MILL_IPC_HUGE_PAGE (2UL << 20) // Segments at least this big ask for transparent huge pages
+#define MILL_IPC_DIR "/dev/shm" // Where the system keeps POSIX shared memory objects
+
+void millIpcName( char *name, size_t size, pid_t owner );
+struct millHeader *millIpcCreate( const char *name, size_t size );
+struct millHeader *millIpcAttach( const char *name );
+void millIpcDetach( struct millHeader *mill );
+void millIpcRemove( const char *name );
+int millIpcSweep( void );
+
+#endif
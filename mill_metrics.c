@@ -0,0 +1,293 @@
+#define _GNU_SOURCE // For accept4
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<errno.h>
+#include "mill_metrics.h"
+
+#define METRICS_STOP UINT64_MAX // epoll key of the eventfd that stops the server (client keys are their slot)
+#define METRICS_LISTENER (UINT64_MAX - 1) // epoll key of the listening socket
+#define METRICS_RATE_NS 1000000000ULL // How often the tick rate is sampled
+#define METRICS_BODY 8192 // Room for every metric
+
+// Names of the pellet exit codes, in exit code order
+static const char *outcomeNames[MILL_METRICS_OUTCOMES] = { "eaten", "error", "passed", "collision", "stopped" };
+
+// Prototype Functions (Comments on details are made with each function)
+static void *metricsServer( void *arg );
+static void acceptClients( struct millMetrics *metrics );
+static void dropIdle( struct millMetrics *metrics, uint64_t now );
+static void readRequest( struct millMetrics *metrics, struct millMetricsClient *client );
+static void answer( struct millMetrics *metrics, struct millMetricsClient *client );
+static int render( struct millMetrics *metrics, char *body, int size );
+static uint64_t residentBytes( void );
+static uint64_t nowNs( void );
+
+/* Creates the socket at path and starts the thread serving the metrics of mill on it
+ * processes is swim_mill's count of running processes (read atomically)
+ * A socket left at path by a run that is gone is replaced, one another run still serves on is not
+ */
+struct millMetrics *millMetricsOpen( const char *path, struct millHeader *mill, const int *processes ){
+    struct millMetrics *metrics = calloc( 1, sizeof(*metrics) );
+    if( metrics == NULL ){
+        fprintf( stderr, "Error allocating the metrics: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    if( strlen(path) >= sizeof(metrics->path) ){
+        fprintf( stderr, "Metrics socket path %s is longer than %zu characters.\n", path, sizeof(metrics->path) - 1 );
+        exit(EXIT_FAILURE);
+    }
+    strcpy( metrics->path, path );
+    metrics->mill = mill;
+    metrics->processes = processes;
+    for( int i = 0; i < MILL_METRICS_CLIENTS; i++ ){
+        metrics->clients[i].fd = -1;
+    }
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strcpy( address.sun_path, path );
+    struct stat st;
+    if( lstat(path, &st) == 0 ){
+        int probe = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+        bool served = S_ISSOCK(st.st_mode) && probe != -1 && connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0;
+        if( probe != -1 ){
+            close( probe );
+        }
+        if( !S_ISSOCK(st.st_mode) || served ){
+            fprintf( stderr, "%s is %s.\n", path, served ? "already serving the metrics of another run" : "not a socket" );
+            exit(EXIT_FAILURE);
+        }
+        unlink( path ); // Left behind by a run that crashed
+    }
+    metrics->listener = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( metrics->listener == -1 || bind(metrics->listener, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(metrics->listener, MILL_METRICS_CLIENTS) == -1 ){
+        fprintf( stderr, "Error opening the metrics socket %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    metrics->epoll = epoll_create1( EPOLL_CLOEXEC );
+    metrics->stop = eventfd( 0, EFD_CLOEXEC );
+    struct epoll_event stopEvent = { EPOLLIN, { .u64 = METRICS_STOP } };
+    struct epoll_event listenEvent = { EPOLLIN, { .u64 = METRICS_LISTENER } };
+    if( metrics->epoll == -1 || metrics->stop == -1 || epoll_ctl(metrics->epoll, EPOLL_CTL_ADD, metrics->stop, &stopEvent) == -1 ||
+        epoll_ctl(metrics->epoll, EPOLL_CTL_ADD, metrics->listener, &listenEvent) == -1 ){
+        fprintf( stderr, "Error setting up the metrics server: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    metrics->lastTick = millTickNow( mill );
+    metrics->lastSample = nowNs();
+
+    int code = pthread_create( &metrics->server, NULL, metricsServer, metrics );
+    if( code ){
+        fprintf( stderr, "pthread_create failed with code %d.\n", code );
+        exit(EXIT_FAILURE);
+    }
+    return metrics;
+}
+
+/* Adds count pellets that finished with exit code code (PELLET_EATEN, PELLET_PASSED...)
+ * Any number of threads may call this at once
+ */
+void millMetricsCount( struct millMetrics *metrics, int code, uint32_t count ){
+    if( code >= 0 && code < MILL_METRICS_OUTCOMES ){
+        __atomic_add_fetch( &metrics->outcomes[code], count, __ATOMIC_RELAXED );
+    }
+}
+
+/* Stops the server thread, hangs up on every client and removes the socket
+ */
+void millMetricsClose( struct millMetrics *metrics ){
+    uint64_t stop = 1;
+    if( write(metrics->stop, &stop, sizeof(stop)) != sizeof(stop) ){
+        fprintf( stderr, "Error stopping the metrics server: %s\n", strerror(errno) );
+    }
+    int code = pthread_join( metrics->server, NULL );
+    if( code ){
+        fprintf( stderr, "pthread_join failed with code %d.\n", code );
+    }
+    for( int i = 0; i < MILL_METRICS_CLIENTS; i++ ){
+        if( metrics->clients[i].fd != -1 ){
+            close( metrics->clients[i].fd );
+        }
+    }
+    close( metrics->listener );
+    close( metrics->epoll );
+    close( metrics->stop );
+    unlink( metrics->path );
+    free( metrics );
+}
+
+/* Thread serving every client until millMetricsClose, sampling the tick rate and hanging up on idle clients
+ * once a second in between
+ */
+static void *metricsServer( void *arg ){
+    struct millMetrics *metrics = arg;
+    struct epoll_event ready[MILL_METRICS_CLIENTS + 2];
+    while( 1 ){
+        uint64_t now = nowNs();
+        if( now - metrics->lastSample >= METRICS_RATE_NS ){
+            uint32_t tick = millTickNow( metrics->mill );
+            metrics->tickRate = (tick - metrics->lastTick) * 1e9 / (now - metrics->lastSample);
+            metrics->lastTick = tick;
+            metrics->lastSample = now;
+            dropIdle( metrics, now );
+        }
+        int timeout = (int)((metrics->lastSample + METRICS_RATE_NS - now) / 1000000) + 1; // Until the next sample is due
+        int count = epoll_wait( metrics->epoll, ready, MILL_METRICS_CLIENTS + 2, timeout );
+        if( count == -1 ){
+            if( errno == EINTR ){
+                continue;
+            }
+            fprintf( stderr, "Error with epoll_wait: %s\n", strerror(errno) );
+            return NULL;
+        }
+        for( int i = 0; i < count; i++ ){
+            if( ready[i].data.u64 == METRICS_STOP ){
+                return NULL;
+            } else if( ready[i].data.u64 == METRICS_LISTENER ){
+                acceptClients( metrics );
+            } else {
+                readRequest( metrics, &metrics->clients[ready[i].data.u64] );
+            }
+        }
+    }
+}
+
+/* Takes every client waiting on the listener, turning away the ones there is no slot for
+ */
+static void acceptClients( struct millMetrics *metrics ){
+    int fd;
+    while( (fd = accept4(metrics->listener, NULL, NULL, SOCK_CLOEXEC)) != -1 ){
+        int slot = 0;
+        while( slot < MILL_METRICS_CLIENTS && metrics->clients[slot].fd != -1 ){
+            slot++;
+        }
+        struct epoll_event event = { EPOLLIN, { .u64 = (uint64_t)slot } };
+        if( slot == MILL_METRICS_CLIENTS || epoll_ctl(metrics->epoll, EPOLL_CTL_ADD, fd, &event) == -1 ){
+            close( fd );
+            continue;
+        }
+        metrics->clients[slot].fd = fd;
+        metrics->clients[slot].length = 0;
+        metrics->clients[slot].connected = nowNs();
+    }
+}
+
+/* Hangs up on every client that hasn't sent a whole request within MILL_METRICS_DEADLINE_MS of connecting
+ */
+static void dropIdle( struct millMetrics *metrics, uint64_t now ){
+    for( int i = 0; i < MILL_METRICS_CLIENTS; i++ ){
+        struct millMetricsClient *client = &metrics->clients[i];
+        if( client->fd != -1 && now - client->connected >= MILL_METRICS_DEADLINE_MS * 1000000ULL ){
+            close( client->fd ); // Also takes it out of the epoll instance
+            client->fd = -1;
+        }
+    }
+}
+
+/* Reads what the client sent and answers once the request is whole: an HTTP request once its headers end, anything
+ * else once its first line does (or once the client stops sending, or the request fills the buffer)
+ */
+static void readRequest( struct millMetrics *metrics, struct millMetricsClient *client ){
+    ssize_t got = read( client->fd, client->request + client->length, MILL_METRICS_REQUEST - 1 - client->length );
+    if( got == -1 && errno == EINTR ){
+        return;
+    }
+    if( got > 0 ){
+        client->length += got;
+        client->request[client->length] = '\0';
+        char *line = strchr( client->request, '\n' );
+        if( line == NULL && client->length < MILL_METRICS_REQUEST - 1 ){
+            return;
+        }
+        bool http = false; // The first line ends in the HTTP version
+        if( line != NULL ){
+            *line = '\0';
+            http = strstr( client->request, "HTTP/" ) != NULL;
+            *line = '\n';
+        }
+        if( http && strstr(client->request, "\r\n\r\n") == NULL && strstr(client->request, "\n\n") == NULL &&
+            client->length < MILL_METRICS_REQUEST - 1 ){
+            return;
+        }
+    }
+    if( got >= 0 && client->length > 0 ){
+        answer( metrics, client );
+    }
+    close( client->fd ); // Also takes it out of the epoll instance
+    client->fd = -1;
+}
+
+/* Sends every metric to the client, as an HTTP response if it asked over HTTP
+ */
+static void answer( struct millMetrics *metrics, struct millMetricsClient *client ){
+    char response[METRICS_BODY + 256];
+    char body[METRICS_BODY];
+    int bodyLength = render( metrics, body, sizeof(body) );
+    int length = 0;
+    if( strstr(client->request, "HTTP/") != NULL ){
+        length = snprintf( response, sizeof(response), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: %d\r\nConnection: close\r\n\r\n", bodyLength );
+    }
+    memcpy( response + length, body, bodyLength );
+    length += bodyLength;
+    // The whole response fits in the socket buffer, so it goes out at once unless the client has hung up
+    if( send(client->fd, response, length, MSG_NOSIGNAL) == -1 && errno != EPIPE && errno != ECONNRESET ){
+        fprintf( stderr, "Error sending the metrics: %s\n", strerror(errno) );
+    }
+}
+
+/* Writes every metric into body (room for size bytes) in the Prometheus text format
+ * Returns the number of bytes written
+ */
+static int render( struct millMetrics *metrics, char *body, int size ){
+    struct millHeader *mill = metrics->mill;
+    uint64_t cells = (uint64_t)mill->rows * mill->cols;
+    uint64_t pellets = cells - __atomic_load_n( &mill->freeCount, __ATOMIC_RELAXED );
+    int length = snprintf( body, size,
+        "# HELP mill_ticks_total Ticks the mill has finished.\n# TYPE mill_ticks_total counter\nmill_ticks_total %u\n"
+        "# HELP mill_ticks_per_second Ticks finished over the last second.\n# TYPE mill_ticks_per_second gauge\nmill_ticks_per_second %.2f\n"
+        "# HELP mill_pellets Pellets on the matrix.\n# TYPE mill_pellets gauge\nmill_pellets %llu\n"
+        "# HELP mill_pellets_finished_total Pellets that finished, by exit code.\n# TYPE mill_pellets_finished_total counter\n",
+        millTickNow(mill), metrics->tickRate, (unsigned long long)pellets );
+    for( int i = 0; i < MILL_METRICS_OUTCOMES; i++ ){
+        length += snprintf( body + length, size - length, "mill_pellets_finished_total{outcome=\"%s\"} %llu\n", outcomeNames[i],
+                            (unsigned long long)__atomic_load_n(&metrics->outcomes[i], __ATOMIC_RELAXED) );
+    }
+    length += snprintf( body + length, size - length,
+        "# HELP mill_lock_contended_total Lock takes that had to wait for another actor.\n# TYPE mill_lock_contended_total counter\nmill_lock_contended_total %llu\n"
+        "# HELP mill_processes Processes of the run (swim_mill, fish and pellets).\n# TYPE mill_processes gauge\nmill_processes %d\n"
+        "# HELP process_resident_memory_bytes Resident memory of swim_mill.\n# TYPE process_resident_memory_bytes gauge\nprocess_resident_memory_bytes %llu\n",
+        (unsigned long long)millLockContention(mill), __atomic_load_n(metrics->processes, __ATOMIC_RELAXED),
+        (unsigned long long)residentBytes() );
+    return length;
+}
+
+/* Returns the resident memory of this process in bytes (0 if the system doesn't say)
+ */
+static uint64_t residentBytes( void ){
+    unsigned long long size = 0, resident = 0;
+    FILE *file = fopen( "/proc/self/statm", "r" );
+    if( file != NULL ){
+        if( fscanf(file, "%llu %llu", &size, &resident) != 2 ){
+            resident = 0;
+        }
+        fclose( file );
+    }
+    return resident * sysconf( _SC_PAGESIZE );
+}
+
+/* Returns the monotonic clock in nanoseconds
+ */
+static uint64_t nowNs( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,57 @@
+#ifndef MILL_METRICS_H
+#define MILL_METRICS_H
+
+#include<stdint.h>
+#include<pthread.h>
+#include<sys/un.h>
+#include "mill.h"
+#include "pellet_engine.h"
+
+/* Live counters of a run, served in the Prometheus text format on a Unix domain socket (swim_mill -M path)
+ * A client connects, sends a request (an HTTP GET, like curl --unix-socket path http://mill/metrics, or any line
+ * ending in a newline) and gets every metric back, after which the connection is closed:
+ *   mill_ticks_total                        ticks the mill has finished
+ *   mill_ticks_per_second                   ticks finished over the last second
+ *   mill_pellets                            pellets on the matrix
+ *   mill_pellets_finished_total{outcome}    pellets that finished, by exit code (eaten, error, passed, collision, stopped)
+ *   mill_lock_contended_total               lock takes that had to wait for another actor (see millLockContention)
+ *   mill_processes                          processes of the run (swim_mill, fish and pellets)
+ *   process_resident_memory_bytes           resident memory of swim_mill (the shared segment included)
+ * A client that hasn't sent a whole request within MILL_METRICS_DEADLINE_MS is hung up on, so idle connections
+ * can't take every slot. One thread serves every client with epoll. It only reads counters the actors update atomically, so serving
+ * never takes a lock on the matrix and never slows the run down
+ */
+
+#define MILL_METRICS_CLIENTS 16 // Most clients served at once (more are turned away until one finishes)
+#define MILL_METRICS_REQUEST 1024 // Bytes of a request read before answering it anyway
+#define MILL_METRICS_DEADLINE_MS 2000 // Longest a client gets to send its request before it is hung up on
+#define MILL_METRICS_OUTCOMES (PELLET_STOPPED + 1) // Pellet exit codes counted
+
+// A connected client whose request hasn't fully arrived yet
+struct millMetricsClient {
+    int fd; // Socket of the client (-1 for a free slot)
+    int length; // Bytes of the request read so far
+    uint64_t connected; // When the client connected (nanoseconds), see MILL_METRICS_DEADLINE_MS
+    char request[MILL_METRICS_REQUEST];
+};
+
+struct millMetrics {
+    struct millHeader *mill; // The mill being served (only ever read without its locks)
+    const int *processes; // swim_mill's count of running processes
+    uint64_t outcomes[MILL_METRICS_OUTCOMES]; // Pellets that finished with each exit code
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)]; // Where the socket is
+    int listener; // Listening socket
+    int epoll; // epoll instance holding the listener, the stop eventfd and every client
+    int stop; // eventfd that tells the server thread to stop
+    uint32_t lastTick; // Tick of the last rate sample
+    uint64_t lastSample; // When the rate was last sampled (nanoseconds)
+    double tickRate; // Ticks per second over the last sample
+    struct millMetricsClient clients[MILL_METRICS_CLIENTS];
+    pthread_t server; // Thread serving the clients
+};
+
+struct millMetrics *millMetricsOpen( const char *path, struct millHeader *mill, const int *processes );
+void millMetricsCount( struct millMetrics *metrics, int code, uint32_t count );
+void millMetricsClose( struct millMetrics *metrics );
+
+#endif
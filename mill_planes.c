@@ -0,0 +1,251 @@
+#include<string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#endif
+#include "mill.h"
+
+/* Whole matrix pellet step on the bit-planes: every pellet moves down one row at once
+ * The planes are updated a 64 bit word at a time and the 64 cells under a word holding a pellet a vector at a time
+ * (AVX2 or SSE2 when the CPU has it, one byte at a time otherwise), so the cost of a tick depends on how many
+ * 64 column runs hold a pellet rather than on how many pellets there are
+ */
+
+// Prototype Functions (Comments on details are made with each function)
+static void advanceCellsScalar( char *row, char *next, size_t bytes );
+static void (*advanceCells)( char *row, char *next, size_t bytes );
+
+/* Moves the pellets of one row of cells into the next one with the same rules as millMovePellet:
+ * a pellet above 'x' or 'P' moves down, a pellet above 'F' or 'E' is eaten (the cell becomes 'E')
+ * next is NULL for the last row, whose pellets leave the matrix
+ * Cells are as stored, so an 'x' is MILL_EMPTY
+ */
+static void advanceCellsScalar( char *row, char *next, size_t bytes ){
+    for( size_t i = 0; i < bytes; i++ ){
+        if( row[i] != 'P' ){
+            continue;
+        }
+        row[i] = MILL_EMPTY;
+        if( next != NULL ){
+            next[i] = (next[i] == 'F' || next[i] == 'E') ? 'E' : 'P';
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* SSE2 version of advanceCellsScalar, 16 cells at a time (bytes is a multiple of 64)
+ */
+__attribute__((target("sse2")))
+static void advanceCellsSse2( char *row, char *next, size_t bytes ){
+    const __m128i pellet = _mm_set1_epi8( 'P' );
+    const __m128i empty = _mm_set1_epi8( MILL_EMPTY );
+    const __m128i fish = _mm_set1_epi8( 'F' );
+    const __m128i eaten = _mm_set1_epi8( 'E' );
+    for( size_t i = 0; i < bytes; i += 16 ){
+        __m128i above = _mm_loadu_si128( (const __m128i *)(row + i) );
+        __m128i moving = _mm_cmpeq_epi8( above, pellet );
+        _mm_storeu_si128( (__m128i *)(row + i), _mm_or_si128(_mm_andnot_si128(moving, above), _mm_and_si128(moving, empty)) );
+        if( next != NULL ){
+            __m128i below = _mm_loadu_si128( (const __m128i *)(next + i) );
+            __m128i onFish = _mm_or_si128( _mm_cmpeq_epi8(below, fish), _mm_cmpeq_epi8(below, eaten) );
+            __m128i landed = _mm_or_si128( _mm_and_si128(onFish, eaten), _mm_andnot_si128(onFish, pellet) );
+            _mm_storeu_si128( (__m128i *)(next + i), _mm_or_si128(_mm_andnot_si128(moving, below), _mm_and_si128(moving, landed)) );
+        }
+    }
+}
+
+/* AVX2 version of advanceCellsScalar, 32 cells at a time (bytes is a multiple of 64)
+ */
+__attribute__((target("avx2")))
+static void advanceCellsAvx2( char *row, char *next, size_t bytes ){
+    const __m256i pellet = _mm256_set1_epi8( 'P' );
+    const __m256i empty = _mm256_set1_epi8( MILL_EMPTY );
+    const __m256i fish = _mm256_set1_epi8( 'F' );
+    const __m256i eaten = _mm256_set1_epi8( 'E' );
+    for( size_t i = 0; i < bytes; i += 32 ){
+        __m256i above = _mm256_loadu_si256( (const __m256i *)(row + i) );
+        __m256i moving = _mm256_cmpeq_epi8( above, pellet );
+        _mm256_storeu_si256( (__m256i *)(row + i), _mm256_blendv_epi8(above, empty, moving) );
+        if( next != NULL ){
+            __m256i below = _mm256_loadu_si256( (const __m256i *)(next + i) );
+            __m256i onFish = _mm256_or_si256( _mm256_cmpeq_epi8(below, fish), _mm256_cmpeq_epi8(below, eaten) );
+            __m256i landed = _mm256_blendv_epi8( pellet, eaten, onFish );
+            _mm256_storeu_si256( (__m256i *)(next + i), _mm256_blendv_epi8(below, landed, moving) );
+        }
+    }
+}
+#endif
+
+/* Picks the widest cell kernel the CPU supports the first time it is needed
+ */
+static void pickKernel( void ){
+    advanceCells = advanceCellsScalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx2") ){
+        advanceCells = advanceCellsAvx2;
+    } else if( __builtin_cpu_supports("sse2") ){
+        advanceCells = advanceCellsSse2;
+    }
+#endif
+}
+
+/* Moves every pellet on the matrix down one row (the planes mode version of calling millMovePellet on each one)
+ * Adds the number of pellets that landed on the fish to eaten and the number that left the last row to passed
+ * The caller holds the lock of every row (no other actor may change cells while this runs)
+ */
+void millAdvancePellets( struct millHeader *mill, uint32_t *eaten, uint32_t *passed ){
+    millAdvanceBlocks( mill, 0, mill->blocks - 1, NULL, eaten, passed );
+    __atomic_store_n( &mill->freeCount, (uint64_t)mill->rows * mill->cols - millCountBlocks(mill, 0, mill->blocks - 1), __ATOMIC_RELEASE );
+}
+
+/* Moves every pellet in blocks first through last down one row
+ * Rows are done from the bottom up, a tile at a time, so a pellet always moves into a row whose own pellets have
+ * already left, and blocks, tiles and 64 column runs without a pellet are skipped using the pellet index (so the
+ * memory of an empty tile is never touched)
+ * A tile's cells and its words of the bitmap take 4.5 KB, so the rows of a tile are moved while they sit in L1
+ * If halo isn't NULL the row below block last belongs to another thread that may still be moving it: the pellets
+ * of the bottom row of block last are lifted off the matrix into halo (a word per 64 columns) instead, to be put
+ * down by millLandHalo once every thread is done
+ * The fish and eaten planes are only read on the last row, the only one the fish ever swim on
+ * Adds the number of pellets that landed on the fish to eaten and the number that left the last row to passed
+ * The block counts are left stale (see millCountBlocks), and no other thread may touch these blocks meanwhile
+ */
+void millAdvanceBlocks( struct millHeader *mill, int first, int last, uint64_t *halo, uint32_t *eaten, uint32_t *passed ){
+    uint32_t *blockPellets = (uint32_t *)((char *)mill + mill->blockPelletOffset);
+    uint32_t *rowPellets = (uint32_t *)((char *)mill + mill->rowPelletOffset);
+    uint32_t *tilePellets = (uint32_t *)((char *)mill + mill->tilePelletOffset);
+    uint64_t *pelletBits = (uint64_t *)((char *)mill + mill->pelletOffset);
+    uint64_t *fishBits = (uint64_t *)((char *)mill + mill->fishOffset);
+    uint64_t *eatenBits = (uint64_t *)((char *)mill + mill->eatenOffset);
+    char *cells = millCells( mill );
+    int lastRow = mill->rows - 1;
+    if( advanceCells == NULL ){
+        pickKernel();
+    }
+    if( halo != NULL ){
+        memset( halo, 0, mill->words * sizeof(uint64_t) );
+    }
+
+    // Tile by tile, so the cells and bits of a whole block of rows are done before the next page is touched
+    for( int block = last; block >= first; block-- ){
+        if( blockPellets[block] == 0 ){
+            continue; // No pellet in this block of rows
+        }
+        int top = block * MILL_BLOCK_ROWS;
+        int bottom = (top + MILL_BLOCK_ROWS - 1 < lastRow) ? top + MILL_BLOCK_ROWS - 1 : lastRow;
+        for( uint32_t w = 0; w < mill->words; w++ ){
+            size_t tile = millTile( mill, top, w );
+            if( tilePellets[tile] == 0 ){
+                continue; // No pellet in the tile (which is left untouched)
+            }
+            // Inside a tile the next row's word is MILL_PAGE_WORDS words on and its cells 64 bytes on
+            size_t base = millWord( mill, top, w );
+            char *run = cells + millCellRun( mill, top, w );
+            int32_t change = 0; // Change in the tile's pellet count
+            for( int row = bottom; row >= top; row-- ){
+                size_t word = base + (size_t)(row - top) * MILL_PAGE_WORDS;
+                uint64_t pellets = pelletBits[word];
+                if( pellets == 0 ){
+                    continue; // No pellet in these 64 columns
+                }
+                char *rowCells = run + (size_t)(row - top) * 64;
+                uint32_t count = __builtin_popcountll( pellets );
+                pelletBits[word] = 0;
+                rowPellets[row] -= count;
+                change -= count;
+                if( row == lastRow || (halo != NULL && block == last && row == bottom) ){
+                    // Pellets in the last row pass the fish, the ones over another thread's row wait in the halo
+                    if( row == lastRow ){
+                        *passed += count;
+                    } else {
+                        halo[w] = pellets;
+                    }
+                    advanceCells( rowCells, NULL, 64 );
+                    continue;
+                }
+                // Pellets above the fish (or an eaten pellet) are eaten, the rest move into the row below
+                bool inside = (row < bottom); // The row below is in the same tile
+                size_t next = inside ? word + MILL_PAGE_WORDS : millWord( mill, row + 1, w );
+                char *nextCells = inside ? rowCells + 64 : cells + millCellRun( mill, row + 1, w );
+                uint64_t onFish = (row + 1 == lastRow) ? pellets & (fishBits[next] | eatenBits[next]) : 0;
+                uint64_t down = pellets & ~onFish;
+                *eaten += __builtin_popcountll( onFish );
+                if( down ){
+                    uint32_t moved = __builtin_popcountll( down );
+                    pelletBits[next] |= down;
+                    rowPellets[row + 1] += moved;
+                    if( inside ){
+                        change += moved;
+                    } else {
+                        tilePellets[millTile(mill, row + 1, w)] += moved;
+                    }
+                }
+                if( onFish ){
+                    eatenBits[next] |= onFish;
+                    fishBits[next] &= ~onFish;
+                }
+                advanceCells( rowCells, nextCells, 64 );
+            }
+            tilePellets[tile] += change;
+        }
+    }
+}
+
+/* Puts the pellets millAdvanceBlocks lifted into halo from the row above block down on the top row of block
+ * (which has already been advanced), eating the ones that land on the fish like millAdvanceBlocks does
+ * Adds the number of pellets that landed on the fish to eaten
+ */
+void millLandHalo( struct millHeader *mill, int block, const uint64_t *halo, uint32_t *eaten ){
+    uint32_t *rowPellets = (uint32_t *)((char *)mill + mill->rowPelletOffset);
+    uint32_t *tilePellets = (uint32_t *)((char *)mill + mill->tilePelletOffset);
+    uint64_t *pelletBits = (uint64_t *)((char *)mill + mill->pelletOffset);
+    uint64_t *fishBits = (uint64_t *)((char *)mill + mill->fishOffset);
+    uint64_t *eatenBits = (uint64_t *)((char *)mill + mill->eatenOffset);
+    char *cells = millCells( mill );
+    int row = block * MILL_BLOCK_ROWS;
+    for( uint32_t w = 0; w < mill->words; w++ ){
+        uint64_t pellets = halo[w];
+        if( pellets == 0 ){
+            continue;
+        }
+        size_t word = millWord( mill, row, w );
+        char *rowCells = cells + millCellRun( mill, row, w );
+        uint64_t onFish = (row == (int)mill->rows - 1) ? pellets & (fishBits[word] | eatenBits[word]) : 0;
+        uint64_t down = pellets & ~onFish;
+        *eaten += __builtin_popcountll( onFish );
+        if( down ){
+            uint32_t moved = __builtin_popcountll( down );
+            pelletBits[word] |= down;
+            rowPellets[row] += moved;
+            tilePellets[millTile(mill, row, w)] += moved;
+        }
+        if( onFish ){
+            eatenBits[word] |= onFish;
+            fishBits[word] &= ~onFish;
+        }
+        for( uint64_t bits = pellets; bits; bits &= bits - 1 ){
+            char *cell = rowCells + __builtin_ctzll( bits );
+            *cell = ((onFish >> __builtin_ctzll(bits)) & 1) ? 'E' : 'P';
+        }
+    }
+}
+
+/* Rebuilds the counts of blocks first through last from the row counts once their pellets have moved
+ * Returns the number of pellets in those blocks
+ */
+uint64_t millCountBlocks( struct millHeader *mill, int first, int last ){
+    uint32_t *blockPellets = (uint32_t *)((char *)mill + mill->blockPelletOffset);
+    uint32_t *rowPellets = (uint32_t *)((char *)mill + mill->rowPelletOffset);
+    uint64_t total = 0;
+    for( int b = first; b <= last; b++ ){
+        uint32_t sum = 0;
+        uint32_t end = (b + 1) * MILL_BLOCK_ROWS;
+        end = (end > mill->rows) ? mill->rows : end;
+        for( uint32_t i = b * MILL_BLOCK_ROWS; i < end; i++ ){
+            sum += rowPellets[i];
+        }
+        blockPellets[b] = sum;
+        total += sum;
+    }
+    return total;
+}
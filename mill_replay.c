@@ -0,0 +1,164 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<errno.h>
+#include "mill.h"
+#include "fish_engine.h"
+#include "pellet_engine.h"
+#include "planes_engine.h"
+#include "mill_trace.h"
+
+/* Replays a trace recorded with swim_mill -T as fast as it goes: the fish make the recorded moves and the pellets
+ * are dropped on the recorded cells, with the pellets moving in between the way the recorded run moved them
+ * (the pellet engine for a -e trace, the pellet planes for a -b trace)
+ * The mill is private memory with nothing to wait for, so this times the engines alone, and the matrix it ends up
+ * with is checked against the digest in the trace
+ * -w sets the worker threads moving the pellets (0 moves them on the calling thread)
+ * -P lets the fish plan that many ticks ahead (see fish_plan.h) instead of making the recorded moves, so fish
+ * strategies can be compared on exactly the same pellets (the matrix is then not checked, since the fish differ)
+ * Output is CSV: ticks,spawned,eaten,passed,collisions,travel,seconds,ticks_per_second,match
+ * Exits with 1 if the matrix doesn't match the trace
+ */
+
+#define WORKERS 0 // Default number of worker threads moving the pellets
+
+long eaten; // Pellets eaten by a fish
+long passed; // Pellets that left the last row
+long collisions; // Pellets dropped on top of another pellet
+
+// Prototype Functions (Comments on details are made after the main function)
+void noLock( int first, int last, bool lock );
+void countPellet( const struct pelletExit *done );
+double now( void );
+
+int main( int argc, char *argv[] ){
+    int workers = WORKERS;
+    int horizon = -1; // Ticks the fish plan ahead, -1 replays the recorded moves
+    int option;
+
+    while( (option = getopt(argc, argv, "w:P:")) != -1 ){
+        switch( option ){
+            case 'w':
+                workers = atoi( optarg );
+                break;
+            case 'P':
+                horizon = atoi( optarg );
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-w workers] [-P plan horizon] trace\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( optind != argc - 1 || workers < 0 || horizon < -1 || horizon > FISH_PLAN_MAX_HORIZON ){
+        fprintf( stderr, "Usage: %s [-w workers] [-P plan horizon] trace\n", argv[0] );
+        exit(EXIT_FAILURE);
+    }
+    struct millTraceReader *trace = millTraceOpen( argv[optind] );
+    const struct millTraceHeader *header = trace->header;
+    int rows = header->rows;
+    int cols = header->cols;
+
+    struct millHeader *mill = aligned_alloc( MILL_ALIGN, millSegmentSize(rows, cols) );
+    int8_t *moves = malloc( header->fishCount );
+    uint64_t *cells = malloc( (header->maxSpawn > 0 ? header->maxSpawn : 1) * sizeof(uint64_t) );
+    if( mill == NULL || moves == NULL || cells == NULL ){
+        fprintf( stderr, "Error allocating the replay: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    millInit( mill, rows, cols, MILL_LOCK_GLOBAL, 0, header->seed );
+    millClear( mill );
+    // The fish start where they started in the recorded run (their columns only depend on the count and the mill)
+    struct fishEngine *fish = fishEngineCreate( mill, header->fishCount, 0, header->seed, noLock );
+    fishEnginePlan( fish, (horizon > 0) ? horizon : 0 );
+    struct pelletEngine *pellets = NULL;
+    struct planesEngine *planes = NULL;
+    if( header->mode == MILL_TRACE_ENGINE ){
+        pellets = pelletEngineCreate( mill, workers, header->capacity, header->seed, noLock, countPellet );
+    } else {
+        planes = planesEngineCreate( mill, workers );
+    }
+
+    double start = now();
+    int count;
+    for( long tick = 0; millTraceNext(trace, moves, cells, &count); tick++ ){
+        if( horizon >= 0 ){
+            if( tick > 0 ){
+                fishEngineStep( fish );
+            }
+        } else {
+            for( int i = 0; i < fish->count; i++ ){
+                int col = fish->fish[i].col + moves[i];
+                if( col < 0 || col >= cols ){
+                    fprintf( stderr, "The trace moves fish %d off the matrix on tick %ld.\n", i + 1, tick );
+                    exit(EXIT_FAILURE);
+                }
+            }
+            fishEngineReplay( fish, moves );
+        }
+        if( pellets != NULL ){
+            pelletEngineStep( pellets );
+            pelletEnginePlace( pellets, cells, count );
+        } else {
+            uint32_t tickEaten = 0;
+            uint32_t tickPassed = 0;
+            uint32_t tickCollided = 0;
+            planesEngineStep( planes, &tickEaten, &tickPassed );
+            millPlacePellets( mill, cells, count, &tickEaten, &tickCollided );
+            eaten += tickEaten;
+            passed += tickPassed;
+            collisions += tickCollided;
+        }
+    }
+    double seconds = now() - start;
+
+    bool match = (millDigest(mill) == header->digest);
+    long travel = 0;
+    for( int i = 0; i < fish->count; i++ ){
+        travel += fish->fish[i].travel;
+    }
+    printf( "ticks,spawned,eaten,passed,collisions,travel,seconds,ticks_per_second,match\n" );
+    printf( "%llu,%llu,%ld,%ld,%ld,%ld,%.6f,%.0f,%s\n", (unsigned long long)header->ticks, (unsigned long long)header->spawned,
+            eaten, passed, collisions, travel, seconds, (seconds > 0) ? header->ticks / seconds : 0.0,
+            (horizon >= 0) ? "unchecked" : (match ? "yes" : "no") );
+
+    if( pellets != NULL ){
+        pelletEngineDestroy( pellets );
+    }
+    if( planes != NULL ){
+        planesEngineDestroy( planes );
+    }
+    fishEngineDestroy( fish );
+    millTraceClose( trace );
+    free( cells );
+    free( moves );
+    free( mill );
+    return (horizon >= 0 || match) ? 0 : 1;
+}
+
+/* The mill is only touched by the calling thread (and the engine workers it waits for), so there is nothing to lock
+ */
+void noLock( int first, int last, bool lock ){
+}
+
+/* Adds a finished pellet to the statistics of the replay
+ */
+void countPellet( const struct pelletExit *done ){
+    if( done->code == PELLET_EATEN ){
+        eaten++;
+    } else if( done->code == PELLET_PASSED ){
+        passed++;
+    } else if( done->code == PELLET_COLLISION ){
+        collisions++;
+    }
+}
+
+/* Returns the current time in seconds
+ */
+double now( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,158 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sched.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<errno.h>
+#include "mill_snapshot.h"
+#include "mill_ipc.h"
+
+/* Returns the number of bytes a snapshot of a rows by cols mill takes
+ */
+static size_t millSnapshotSize( int rows, int cols ){
+    return MILL_ALIGN + (size_t)rows * (cols + 1);
+}
+
+/* Writes the name of the snapshot belonging to the swim_mill with PID owner into name
+ */
+void millSnapshotName( char *name, size_t size, pid_t owner ){
+    snprintf( name, size, "%s%d%s", MILL_IPC_PREFIX, (int)owner, MILL_SNAPSHOT_SUFFIX );
+}
+
+/* Creates the shared memory object name sized for a rows by cols mill and maps it for writing
+ * The frame starts out empty (every cell a space) until the first millSnapshotPublish
+ */
+struct millSnapshot *millSnapshotCreate( const char *name, int rows, int cols ){
+    size_t size = millSnapshotSize( rows, cols );
+    int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+    // An object with this name can only be left over from a run whose PID has been reused, so start over
+    if( fd == -1 && errno == EEXIST && shm_unlink(name) != -1 ){
+        fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+    }
+    if( fd == -1 ){
+        fprintf( stderr, "Error with shm_open %s: %s\n", name, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    if( ftruncate(fd, size) == -1 ){
+        fprintf( stderr, "Error sizing %s: %s\n", name, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    struct millSnapshot *snapshot = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd ); // The mapping keeps the object alive
+    if( snapshot == MAP_FAILED ){
+        fprintf( stderr, "Error with mmap of %s: %s\n", name, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    snapshot->rows = rows;
+    snapshot->cols = cols;
+    snapshot->frameSize = (uint64_t)rows * (cols + 1);
+    snapshot->frameOffset = MILL_ALIGN;
+    char *frame = (char *)snapshot + snapshot->frameOffset;
+    memset( frame, ' ', snapshot->frameSize );
+    for( int i = 0; i < rows; i++ ){
+        frame[(size_t)i * (cols + 1) + cols] = '\n';
+    }
+    snapshot->version = MILL_SNAPSHOT_VERSION;
+    __atomic_store_n( &snapshot->magic, MILL_SNAPSHOT_MAGIC, __ATOMIC_RELEASE ); // Written last like millInit
+    return snapshot;
+}
+
+/* Maps an existing snapshot read-only (a viewer can never disturb swim_mill or another viewer)
+ * Returns NULL if there is no snapshot by that name or it isn't one swim_mill wrote
+ */
+struct millSnapshot *millSnapshotAttach( const char *name ){
+    int fd = shm_open( name, O_RDONLY, 0 );
+    if( fd == -1 ){
+        return NULL;
+    }
+    struct stat st;
+    if( fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct millSnapshot) ){
+        close( fd );
+        return NULL;
+    }
+    struct millSnapshot *snapshot = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( snapshot == MAP_FAILED ){
+        return NULL;
+    }
+    if( __atomic_load_n(&snapshot->magic, __ATOMIC_ACQUIRE) != MILL_SNAPSHOT_MAGIC || snapshot->version != MILL_SNAPSHOT_VERSION ||
+        (size_t)st.st_size < millSnapshotSize(snapshot->rows, snapshot->cols) ){
+        munmap( snapshot, st.st_size );
+        return NULL;
+    }
+    return snapshot;
+}
+
+/* Copies the cells of mill into the frame (as characters, so empty cells show up as 'x')
+ * Takes no lock: cells are single bytes, so copying a row while actors change it never tears a cell, and the
+ * seqlock tells readers to retry instead of showing a frame that is half old and half new
+ * Rows and tiles without a pellet (but those of the last block) are filled in without reading them, so the mill
+ * stays sparse
+ * Only one thread may publish to a snapshot
+ */
+void millSnapshotPublish( struct millSnapshot *snapshot, struct millHeader *mill ){
+    char *frame = (char *)snapshot + snapshot->frameOffset;
+    uint32_t sequence = snapshot->sequence;
+    __atomic_store_n( &snapshot->sequence, sequence + 1, __ATOMIC_RELAXED ); // Odd, the frame is changing
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    uint32_t lastBlock = (snapshot->rows - 1) / MILL_BLOCK_ROWS;
+    for( uint32_t i = 0; i < snapshot->rows; i++ ){
+        char *line = frame + (size_t)i * (snapshot->cols + 1);
+        if( i / MILL_BLOCK_ROWS < lastBlock && millRowPellets(mill, i) == 0 ){
+            memset( line, 'x', snapshot->cols );
+            continue;
+        }
+        for( uint32_t w = 0; w * 64 < snapshot->cols; w++ ){
+            uint32_t count = (snapshot->cols - w * 64 < 64) ? snapshot->cols - w * 64 : 64; // Columns in this word
+            const char *cells = millCells( mill ) + millCellRun( mill, i, w );
+            if( i / MILL_BLOCK_ROWS < lastBlock && millTilePellets(mill, i, w) == 0 ){
+                memset( line + w * 64, 'x', count );
+                continue;
+            }
+            for( uint32_t j = 0; j < count; j++ ){
+                line[w * 64 + j] = millShown( cells[j] );
+            }
+        }
+    }
+    snapshot->tick = millTickNow( mill );
+    snapshot->frames++;
+    __atomic_store_n( &snapshot->sequence, sequence + 2, __ATOMIC_RELEASE ); // Even again, the frame is whole
+}
+
+/* Copies the latest whole frame (frameSize bytes) into frame and its tick into tick
+ * Returns false if swim_mill kept changing the frame for MILL_SNAPSHOT_RETRIES tries in a row
+ */
+bool millSnapshotRead( const struct millSnapshot *snapshot, char *frame, uint32_t *tick ){
+    const char *shared = millSnapshotFrame( snapshot );
+    for( int attempt = 0; attempt < MILL_SNAPSHOT_RETRIES; attempt++ ){
+        uint32_t before = __atomic_load_n( &snapshot->sequence, __ATOMIC_ACQUIRE );
+        if( before & 1 ){
+            sched_yield(); // swim_mill is in the middle of a copy
+            continue;
+        }
+        memcpy( frame, shared, snapshot->frameSize );
+        *tick = snapshot->tick;
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if( __atomic_load_n(&snapshot->sequence, __ATOMIC_RELAXED) == before ){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Unmaps a snapshot mapped by millSnapshotCreate or millSnapshotAttach
+ */
+void millSnapshotDetach( struct millSnapshot *snapshot ){
+    munmap( snapshot, millSnapshotSize(snapshot->rows, snapshot->cols) );
+}
+
+/* Removes the shared memory object name (viewers that have it mapped keep their mapping)
+ */
+void millSnapshotRemove( const char *name ){
+    if( shm_unlink(name) == -1 && errno != ENOENT ){
+        fprintf( stderr, "Error with shm_unlink %s: %s\n", name, strerror(errno) );
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef MILL_SNAPSHOT_H
+#define MILL_SNAPSHOT_H
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<sys/types.h>
+#include "mill.h"
+
+/* Read-only copy of the matrix for anyone who wants to watch a mill
+ * swim_mill copies the cells into a POSIX shared memory object of its own (/dev/shm/swim_mill.<PID>.snapshot, named
+ * after the run's segment so runs side by side never share one, see millSnapshotName) without taking the matrix lock, and any number of viewers (see mill_watch) mmap it read-only, so watching costs the
+ * actors nothing however large the mill is
+ *
+ * The frame is kept as the text printMatrix prints (every row followed by a newline), so it can be written to a
+ * terminal with a single write. It is guarded by a seqlock: sequence is odd while the frame is being copied, and a
+ * reader whose copy started and ended on the same even sequence has a whole frame
+ */
+
+#define MILL_SNAPSHOT_SUFFIX ".snapshot" // Follows the name of the run's segment (so millIpcSweep removes a leftover one)
+#define MILL_SNAPSHOT_NAME_MAX 80 // Room for a snapshot name
+#define MILL_SNAPSHOT_MAGIC 0x50414e53 // "SNAP" in memory
+#define MILL_SNAPSHOT_VERSION 1
+#define MILL_SNAPSHOT_RETRIES 1000 // Times a reader retries a frame that changed under it before giving up
+
+struct millSnapshot {
+    uint32_t magic; // Always MILL_SNAPSHOT_MAGIC
+    uint32_t version; // Always MILL_SNAPSHOT_VERSION
+    uint32_t rows; // Geometry of the mill the frame was copied from
+    uint32_t cols;
+    uint32_t sequence; // Seqlock (odd while swim_mill is copying the frame)
+    uint32_t tick; // Tick of the simulation clock when the frame was copied
+    uint64_t frameSize; // Bytes in the frame (rows * (cols + 1))
+    uint64_t frames; // Number of frames published so far
+    uint32_t frameOffset; // Bytes from the start of the object to the frame
+};
+
+void millSnapshotName( char *name, size_t size, pid_t owner );
+struct millSnapshot *millSnapshotCreate( const char *name, int rows, int cols );
+struct millSnapshot *millSnapshotAttach( const char *name );
+void millSnapshotPublish( struct millSnapshot *snapshot, struct millHeader *mill );
+bool millSnapshotRead( const struct millSnapshot *snapshot, char *frame, uint32_t *tick );
+void millSnapshotDetach( struct millSnapshot *snapshot );
+void millSnapshotRemove( const char *name );
+
+/* Returns the frame (only swim_mill, the one writer, may read it without millSnapshotRead)
+ */
+static inline const char *millSnapshotFrame( const struct millSnapshot *snapshot ){
+    return (const char *)snapshot + snapshot->frameOffset;
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifdef MILL_STATS
+
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<pthread.h>
+#include<string.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<errno.h>
+#include "mill_stats.h"
+
+#define STATS_SUFFIX ".stats" // The shared histograms are named after the mill's segment with this added
+#define STATS_NAME_MAX 96 // Room for the name of the shared histograms
+#define STATS_CALIBRATE_NS 20000000L // How long the time stamp counter is measured against the clock (20ms)
+
+// Histograms of one thread of swim_mill
+struct millStatsSet {
+    struct millStats stats;
+    struct millStatsSet *next; // Every thread's set is on one list so they can be summed
+};
+
+static __thread struct millStatsSet *local; // The calling thread's histograms (made on its first sample)
+static struct millStatsSet *sets; // Every thread's histograms
+static pthread_mutex_t setsMutex = PTHREAD_MUTEX_INITIALIZER; // Guards sets
+static struct millStats *shared; // Shared histograms of the run (processes count straight into them)
+static bool owner; // This process created shared (swim_mill), so its threads keep histograms of their own
+static double nsPerTick = 1.0; // Nanoseconds per time stamp counter tick (measured by millStatsCreate)
+
+static const char *statNames[MILL_STAT_COUNT] = { "lock_wait", "lock_hold", "fish_decide", "pellet_step", "reap_lag", "tick_wait" };
+
+// Prototype Functions (Comments on details are made with each function)
+static void statsName( char *statsName, const char *name );
+static struct millStats *mapStats( const char *name, int flags );
+static void addHistogram( struct millHistogram *total, const struct millHistogram *histogram );
+static int bucketOf( uint64_t value );
+static uint64_t bucketTop( int bucket );
+static uint64_t percentile( const struct millHistogram *histogram, double fraction );
+
+/* Creates the shared histograms of the mill name (swim_mill) and measures the time stamp counter against the clock
+ */
+void millStatsCreate( const char *name ){
+    char path[STATS_NAME_MAX];
+    statsName( path, name );
+    shared = mapStats( path, O_RDWR | O_CREAT | O_TRUNC );
+    owner = true;
+
+    struct timespec begin, end, pause = { 0, STATS_CALIBRATE_NS };
+    clock_gettime( CLOCK_MONOTONIC, &begin );
+    uint64_t first = millStatsNow();
+    nanosleep( &pause, NULL );
+    uint64_t last = millStatsNow();
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    double ns = (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+    nsPerTick = (last > first) ? ns / (last - first) : 1.0;
+}
+
+/* Maps the shared histograms of the mill name (fish and pellet)
+ * If there are none (swim_mill was built without MILL_STATS) the samples are simply dropped
+ */
+void millStatsAttach( const char *name ){
+    if( name == NULL ){
+        return;
+    }
+    char path[STATS_NAME_MAX];
+    statsName( path, name );
+    shared = mapStats( path, O_RDWR );
+}
+
+/* Counts the time since start (from MILL_STAT_START) into histogram stat
+ * Threads of swim_mill count into their own histograms without atomic read-modify-writes, other processes
+ * add to the shared histograms atomically
+ */
+void millStatsRecord( int stat, uint64_t start ){
+    uint64_t elapsed = millStatsNow() - start;
+    int bucket = bucketOf( elapsed );
+    struct millHistogram *histogram;
+    if( !owner ){
+        if( shared == NULL ){
+            return;
+        }
+        histogram = &shared->histograms[stat];
+        __atomic_fetch_add( &histogram->counts[bucket], 1, __ATOMIC_RELAXED );
+        __atomic_fetch_add( &histogram->samples, 1, __ATOMIC_RELAXED );
+        __atomic_fetch_add( &histogram->sum, elapsed, __ATOMIC_RELAXED );
+        uint64_t max = __atomic_load_n( &histogram->max, __ATOMIC_RELAXED );
+        while( elapsed > max && !__atomic_compare_exchange_n(&histogram->max, &max, elapsed, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ){
+        }
+        return;
+    }
+    if( local == NULL ){
+        local = calloc( 1, sizeof(*local) );
+        if( local == NULL ){
+            return; // Better to lose the samples than the run
+        }
+        pthread_mutex_lock( &setsMutex );
+        local->next = sets;
+        sets = local;
+        pthread_mutex_unlock( &setsMutex );
+    }
+    // Only this thread writes its histograms, the stores are atomic so millStatsExport can read them at any time
+    histogram = &local->stats.histograms[stat];
+    __atomic_store_n( &histogram->counts[bucket], histogram->counts[bucket] + 1, __ATOMIC_RELAXED );
+    __atomic_store_n( &histogram->samples, histogram->samples + 1, __ATOMIC_RELAXED );
+    __atomic_store_n( &histogram->sum, histogram->sum + elapsed, __ATOMIC_RELAXED );
+    if( elapsed > histogram->max ){
+        __atomic_store_n( &histogram->max, elapsed, __ATOMIC_RELAXED );
+    }
+}
+
+/* Prints every histogram, summed over the threads of swim_mill and the shared histograms, in nanoseconds
+ */
+void millStatsExport( FILE *out ){
+    struct millHistogram total;
+    fprintf( out, "stat,samples,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n" );
+    for( int stat = 0; stat < MILL_STAT_COUNT; stat++ ){
+        memset( &total, 0, sizeof(total) );
+        pthread_mutex_lock( &setsMutex );
+        for( struct millStatsSet *set = sets; set != NULL; set = set->next ){
+            addHistogram( &total, &set->stats.histograms[stat] );
+        }
+        pthread_mutex_unlock( &setsMutex );
+        if( shared != NULL ){
+            addHistogram( &total, &shared->histograms[stat] );
+        }
+        fprintf( out, "%s,%llu,%.1f,%.0f,%.0f,%.0f,%.0f\n", statNames[stat], (unsigned long long)total.samples,
+                 (total.samples > 0) ? total.sum * nsPerTick / total.samples : 0.0,
+                 percentile(&total, 0.5) * nsPerTick, percentile(&total, 0.99) * nsPerTick,
+                 percentile(&total, 0.999) * nsPerTick, total.max * nsPerTick );
+    }
+    fflush( out );
+}
+
+/* Removes the shared histograms of the mill name
+ */
+void millStatsRemove( const char *name ){
+    char path[STATS_NAME_MAX];
+    statsName( path, name );
+    shm_unlink( path );
+}
+
+/* Writes the name of the shared histograms of the mill name into statsName
+ */
+static void statsName( char *statsName, const char *name ){
+    snprintf( statsName, STATS_NAME_MAX, "%s%s", name, STATS_SUFFIX );
+}
+
+/* Opens (or with O_CREAT creates) the shared histograms and maps them, returns NULL if they can't be opened
+ */
+static struct millStats *mapStats( const char *name, int flags ){
+    int fd = shm_open( name, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP );
+    if( fd == -1 ){
+        return NULL;
+    }
+    if( (flags & O_CREAT) && ftruncate(fd, sizeof(struct millStats)) == -1 ){
+        fprintf( stderr, "Error with ftruncate %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    struct millStats *stats = mmap( NULL, sizeof(struct millStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    return (stats == MAP_FAILED) ? NULL : stats;
+}
+
+/* Adds histogram (which its thread or process may be counting into right now) to total
+ */
+static void addHistogram( struct millHistogram *total, const struct millHistogram *histogram ){
+    for( int b = 0; b < MILL_STAT_BUCKETS; b++ ){
+        total->counts[b] += __atomic_load_n( &histogram->counts[b], __ATOMIC_RELAXED );
+    }
+    total->samples += __atomic_load_n( &histogram->samples, __ATOMIC_RELAXED );
+    total->sum += __atomic_load_n( &histogram->sum, __ATOMIC_RELAXED );
+    uint64_t max = __atomic_load_n( &histogram->max, __ATOMIC_RELAXED );
+    total->max = (max > total->max) ? max : total->max;
+}
+
+/* Returns the bucket of a value: values below 16 get a bucket each, and every power of two above that is split
+ * into 16 buckets by the 4 bits after its top bit
+ */
+static int bucketOf( uint64_t value ){
+    if( value < 16 ){
+        return (int)value;
+    }
+    int top = 63 - __builtin_clzll( value );
+    return (top - 3) * 16 + (int)((value >> (top - 4)) & 15);
+}
+
+/* Returns the largest value that falls in bucket
+ */
+static uint64_t bucketTop( int bucket ){
+    if( bucket < 16 ){
+        return bucket;
+    }
+    int top = bucket / 16 + 3;
+    uint64_t sub = bucket % 16;
+    return ((16 + sub + 1) << (top - 4)) - 1;
+}
+
+/* Returns the value fraction of the samples in histogram are at or below
+ */
+static uint64_t percentile( const struct millHistogram *histogram, double fraction ){
+    if( histogram->samples == 0 ){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * histogram->samples);
+    rank = (rank < histogram->samples) ? rank + 1 : histogram->samples; // 1 based
+    uint64_t seen = 0;
+    for( int b = 0; b < MILL_STAT_BUCKETS; b++ ){
+        seen += histogram->counts[b];
+        if( seen >= rank ){
+            uint64_t top = bucketTop( b );
+            return (top < histogram->max) ? top : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+#endif
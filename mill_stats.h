@@ -0,0 +1,82 @@
+#ifndef MILL_STATS_H
+#define MILL_STATS_H
+
+#include<stdint.h>
+#include<stdio.h>
+
+/* Hot path instrumentation, only compiled in with -DMILL_STATS (make STATS=1)
+ * Actors time their hot paths with the time stamp counter and count every sample into a log-linear histogram
+ * (16 buckets per power of two, so any percentile is within about 6% of the true value):
+ * threads of swim_mill count into histograms of their own, and fish and pellet processes add theirs to a shared
+ * memory histogram set swim_mill created next to the mill, so nothing is lost when a pellet exits
+ * swim_mill prints every histogram (p50/p99/p999 in nanoseconds) at the end of the run and on SIGUSR1
+ *
+ * Without MILL_STATS every MILL_STAT_ macro is empty and the functions do nothing
+ */
+
+// What is timed
+#define MILL_STAT_LOCK_WAIT 0 // Waiting to take a lock on the matrix (lockRows)
+#define MILL_STAT_LOCK_HOLD 1 // Holding the lock while a new pellet is placed
+#define MILL_STAT_FISH_DECIDE 2 // A fish picking its direction (millFindPellet)
+#define MILL_STAT_PELLET_STEP 3 // A pellet moving one row, locking included
+#define MILL_STAT_REAP_LAG 4 // Time from the reaper waking on finished pellet processes to each one being reaped and logged
+#define MILL_STAT_TICK_WAIT 5 // swim_mill waiting for every actor to finish a tick (millTickAdvance)
+#define MILL_STAT_COUNT 6
+
+#define MILL_STAT_BUCKETS 1024 // Enough log-linear buckets for any 64 bit value
+
+struct millHistogram {
+    uint64_t counts[MILL_STAT_BUCKETS];
+    uint64_t samples; // Number of samples
+    uint64_t sum; // Sum of every sample (for the mean)
+    uint64_t max; // Largest sample
+};
+
+struct millStats {
+    struct millHistogram histograms[MILL_STAT_COUNT];
+};
+
+#ifdef MILL_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<x86intrin.h>
+#else
+#include<time.h>
+#endif
+
+#define MILL_STAT_START( start ) uint64_t start = millStatsNow()
+#define MILL_STAT_MARK( start ) start = millStatsNow()
+#define MILL_STAT_END( stat, start ) millStatsRecord( stat, start )
+
+/* Returns the time stamp counter (nanoseconds where there is none)
+ */
+static inline uint64_t millStatsNow( void ){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void millStatsCreate( const char *name );
+void millStatsAttach( const char *name );
+void millStatsRecord( int stat, uint64_t start );
+void millStatsExport( FILE *out );
+void millStatsRemove( const char *name );
+
+#else
+
+#define MILL_STAT_START( start ) (void)0
+#define MILL_STAT_MARK( start ) (void)0
+#define MILL_STAT_END( stat, start ) (void)0
+
+static inline void millStatsCreate( const char *name ){}
+static inline void millStatsAttach( const char *name ){}
+static inline void millStatsExport( FILE *out ){}
+static inline void millStatsRemove( const char *name ){}
+
+#endif
+
+#endif
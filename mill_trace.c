@@ -0,0 +1,220 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<errno.h>
+#include "mill_trace.h"
+
+#define TRACE_BUFFER (1 << 20) // Bytes stdio gathers before writing to the trace
+
+// Prototype Functions (Comments on details are made with each function)
+static void putVarint( FILE *file, uint64_t value );
+static uint64_t getVarint( struct millTraceReader *trace );
+static void traceCorrupt( const struct millTraceReader *trace );
+
+/* Creates the trace file at path for a run in mode (MILL_TRACE_ENGINE or MILL_TRACE_PLANES) on mill, before its
+ * first tick, with the fish already in their starting columns
+ */
+struct millTraceWriter *millTraceCreate( const char *path, int mode, const struct millHeader *mill, const struct fishEngine *fish,
+                                         int capacity, uint64_t seed ){
+    struct millTraceWriter *trace = calloc( 1, sizeof(*trace) );
+    if( trace == NULL ){
+        fprintf( stderr, "Error allocating the trace: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    trace->file = fopen( path, "w" );
+    if( trace->file == NULL ){
+        fprintf( stderr, "Error opening trace %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    setvbuf( trace->file, NULL, _IOFBF, TRACE_BUFFER );
+    trace->header.mode = mode;
+    trace->header.rows = mill->rows;
+    trace->header.cols = mill->cols;
+    trace->header.fishCount = fish->count;
+    trace->header.capacity = capacity;
+    trace->header.seed = seed;
+    trace->moveBytes = (fish->count + 3) / 4;
+    trace->cols = malloc( fish->count * sizeof(int) );
+    trace->moves = malloc( trace->moveBytes + 1 );
+    if( trace->cols == NULL || trace->moves == NULL ){
+        fprintf( stderr, "Error allocating the trace: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < fish->count; i++ ){
+        trace->cols[i] = fish->fish[i].col;
+    }
+    fwrite( &trace->header, sizeof(trace->header), 1, trace->file ); // Room for the header, written again at the end
+    return trace;
+}
+
+/* Records a tick: the fish moves since the last tick (read from the pool, which has finished its step) and the
+ * count cells (row * cols + col) pellets were dropped on, in the order they were dropped
+ */
+void millTraceTick( struct millTraceWriter *trace, const struct fishEngine *fish, const uint64_t *cells, int count ){
+    memset( trace->moves, 0, trace->moveBytes );
+    for( int i = 0; i < fish->count; i++ ){
+        int move = fish->fish[i].col - trace->cols[i];
+        trace->moves[i / 4] |= (uint8_t)((move & 3) << (2 * (i % 4)));
+        trace->cols[i] = fish->fish[i].col;
+    }
+    fwrite( trace->moves, 1, trace->moveBytes, trace->file );
+    putVarint( trace->file, count );
+    uint64_t last = 0;
+    for( int n = 0; n < count; n++ ){
+        int64_t delta = (int64_t)(cells[n] - last);
+        putVarint( trace->file, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63) ); // Zigzag, so small steps back stay small
+        last = cells[n];
+    }
+    trace->header.ticks++;
+    trace->header.spawned += count;
+    trace->header.maxSpawn = (count > trace->header.maxSpawn) ? count : trace->header.maxSpawn;
+}
+
+/* Writes the header (with the digest of mill, which has finished its last tick) and closes the trace
+ * ticks is the number of ticks the run went through. If the trace is missing any of them, or a fish move made
+ * after the last tick recorded, it can't reproduce the matrix: it is closed without its magic number so that
+ * mill_replay turns it down
+ */
+void millTraceFinish( struct millTraceWriter *trace, struct millHeader *mill, const struct fishEngine *fish, uint64_t ticks ){
+    bool whole = (trace->header.ticks == ticks);
+    for( int i = 0; i < fish->count; i++ ){
+        whole = whole && (fish->fish[i].col == trace->cols[i]);
+    }
+    if( !whole ){
+        fprintf( stderr, "The trace recorded %llu of the run's %llu ticks and can't be replayed.\n",
+                 (unsigned long long)trace->header.ticks, (unsigned long long)ticks );
+    }
+    trace->header.digest = millDigest( mill );
+    trace->header.size = ftell( trace->file );
+    trace->header.version = MILL_TRACE_VERSION;
+    trace->header.magic = whole ? MILL_TRACE_MAGIC : 0;
+    if( fseek(trace->file, 0, SEEK_SET) == -1 || fwrite(&trace->header, sizeof(trace->header), 1, trace->file) != 1 ||
+        fclose(trace->file) == EOF ){
+        fprintf( stderr, "Error writing the trace: %s\n", strerror(errno) );
+    }
+    free( trace->cols );
+    free( trace->moves );
+    free( trace );
+}
+
+/* Maps the trace at path for replaying, checking it was written whole by this version of swim_mill
+ */
+struct millTraceReader *millTraceOpen( const char *path ){
+    int fd = open( path, O_RDONLY );
+    if( fd == -1 ){
+        fprintf( stderr, "Error opening trace %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if( fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct millTraceHeader) ){
+        fprintf( stderr, "%s is not a trace.\n", path );
+        exit(EXIT_FAILURE);
+    }
+    const struct millTraceHeader *header = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd ); // The mapping keeps the file open
+    if( header == MAP_FAILED ){
+        fprintf( stderr, "Error with mmap of %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    madvise( (void *)header, st.st_size, MADV_SEQUENTIAL ); // Read once front to back, so read ahead of the replay
+    if( header->magic != MILL_TRACE_MAGIC || header->version != MILL_TRACE_VERSION || header->size != (uint64_t)st.st_size ||
+        (header->mode != MILL_TRACE_ENGINE && header->mode != MILL_TRACE_PLANES) || header->rows < 2 || header->cols < 1 ||
+        header->fishCount < 1 || header->fishCount > (int32_t)header->cols || header->capacity < 1 || header->maxSpawn < 0 ){
+        fprintf( stderr, "%s is not a whole trace of this version of swim_mill.\n", path );
+        exit(EXIT_FAILURE);
+    }
+    struct millTraceReader *trace = calloc( 1, sizeof(*trace) );
+    if( trace == NULL ){
+        fprintf( stderr, "Error allocating the trace: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    trace->header = header;
+    trace->next = (const uint8_t *)(header + 1);
+    trace->end = (const uint8_t *)header + header->size;
+    return trace;
+}
+
+/* Reads the next tick: the move of every fish into moves and the cells pellets were dropped on into cells (room
+ * for header->maxSpawn of them), their number into count
+ * Returns false once every tick has been read
+ */
+bool millTraceNext( struct millTraceReader *trace, int8_t *moves, uint64_t *cells, int *count ){
+    if( trace->tick == trace->header->ticks ){
+        return false;
+    }
+    int fishCount = trace->header->fishCount;
+    if( trace->end - trace->next < (fishCount + 3) / 4 ){
+        traceCorrupt( trace );
+    }
+    for( int i = 0; i < fishCount; i++ ){
+        int move = (trace->next[i / 4] >> (2 * (i % 4))) & 3;
+        if( move == 2 ){
+            traceCorrupt( trace );
+        }
+        moves[i] = (move == 3) ? -1 : (int8_t)move;
+    }
+    trace->next += (fishCount + 3) / 4;
+    uint64_t pellets = getVarint( trace );
+    if( pellets > (uint64_t)trace->header->maxSpawn ){
+        traceCorrupt( trace );
+    }
+    uint64_t cellCount = (uint64_t)trace->header->rows * trace->header->cols;
+    uint64_t last = 0;
+    for( uint64_t n = 0; n < pellets; n++ ){
+        uint64_t zigzag = getVarint( trace );
+        last += (zigzag >> 1) ^ -(zigzag & 1);
+        if( last >= cellCount ){
+            traceCorrupt( trace );
+        }
+        cells[n] = last;
+    }
+    *count = (int)pellets;
+    trace->tick++;
+    return true;
+}
+
+/* Unmaps a trace opened by millTraceOpen
+ */
+void millTraceClose( struct millTraceReader *trace ){
+    munmap( (void *)trace->header, trace->header->size );
+    free( trace );
+}
+
+/* Writes value as a LEB128 varint: 7 bits a byte, low bits first, the top bit set on every byte but the last
+ */
+static void putVarint( FILE *file, uint64_t value ){
+    while( value >= 0x80 ){
+        putc_unlocked( (int)(value & 0x7f) | 0x80, file );
+        value >>= 7;
+    }
+    putc_unlocked( (int)value, file );
+}
+
+/* Reads a LEB128 varint written by putVarint
+ */
+static uint64_t getVarint( struct millTraceReader *trace ){
+    uint64_t value = 0;
+    for( int shift = 0; shift < 64; shift += 7 ){
+        if( trace->next == trace->end ){
+            traceCorrupt( trace );
+        }
+        uint8_t byte = *trace->next++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if( byte < 0x80 ){
+            return value;
+        }
+    }
+    traceCorrupt( trace );
+    return 0;
+}
+
+/* Stops the replay of a trace that doesn't decode
+ */
+static void traceCorrupt( const struct millTraceReader *trace ){
+    fprintf( stderr, "The trace is corrupt at tick %llu.\n", (unsigned long long)trace->tick );
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,69 @@
+#ifndef MILL_TRACE_H
+#define MILL_TRACE_H
+
+#include<stdbool.h>
+#include<stdint.h>
+#include<stdio.h>
+#include "mill.h"
+#include "fish_engine.h"
+
+/* Trace of a run: every pellet dropped and every fish move, recorded by swim_mill -T and replayed by mill_replay
+ * Only runs whose actors all live inside swim_mill can be traced (-e or -b with a fish pool, like checkpoints), and
+ * a traced run starts from an empty mill (not from -R)
+ *
+ * The file is this header followed by one record per tick, in the order the tick happened:
+ *   the move of every fish (2 bits each, 4 fish to a byte: 0 stayed, 1 right, 3 left)
+ *   the number of pellets dropped, then the cell (row * cols + col) of each, every one as the difference from the
+ *   cell before it (the first from 0)
+ * Numbers are LEB128 varints (7 bits a byte) and differences are zigzag coded, and a tick's pellets are dropped in
+ * index order, so most take one or two bytes. The header is written last, once the digest of the final matrix is
+ * known (see millDigest), and mill_replay maps the file and checks the matrix it ends up with against it
+ */
+
+#define MILL_TRACE_MAGIC 0x5254434d // "MCTR" in memory
+#define MILL_TRACE_VERSION 1 // Bumped whenever the layout of the file changes
+#define MILL_TRACE_ENGINE 1 // The run used the pellet engine (-e)
+#define MILL_TRACE_PLANES 2 // The run used the pellet planes (-b)
+
+struct millTraceHeader {
+    uint32_t magic; // Always MILL_TRACE_MAGIC
+    uint32_t version; // Always MILL_TRACE_VERSION
+    uint32_t mode; // MILL_TRACE_ENGINE or MILL_TRACE_PLANES
+    uint32_t rows; // Number of rows in the matrix
+    uint32_t cols; // Number of columns in the matrix
+    int32_t fishCount; // Number of fish
+    int32_t capacity; // Pool size of the pellet engine (pellets past it weren't dropped)
+    int32_t maxSpawn; // Most pellets dropped on one tick
+    uint64_t seed; // Seed of the run
+    uint64_t ticks; // Ticks recorded
+    uint64_t spawned; // Pellets recorded
+    uint64_t size; // Bytes in the file
+    uint64_t digest; // millDigest of the matrix after the last tick
+};
+
+// A trace being recorded
+struct millTraceWriter {
+    FILE *file;
+    struct millTraceHeader header;
+    int *cols; // Column of every fish when the last tick was recorded
+    uint8_t *moves; // The packed moves of a tick
+    int moveBytes; // Bytes of packed moves per tick
+};
+
+// A trace being replayed (the whole file is mapped)
+struct millTraceReader {
+    const struct millTraceHeader *header;
+    const uint8_t *next; // Next byte to decode
+    const uint8_t *end; // End of the file
+    uint64_t tick; // Ticks read so far
+};
+
+struct millTraceWriter *millTraceCreate( const char *path, int mode, const struct millHeader *mill, const struct fishEngine *fish,
+                                         int capacity, uint64_t seed );
+void millTraceTick( struct millTraceWriter *trace, const struct fishEngine *fish, const uint64_t *cells, int count );
+void millTraceFinish( struct millTraceWriter *trace, struct millHeader *mill, const struct fishEngine *fish, uint64_t ticks );
+struct millTraceReader *millTraceOpen( const char *path );
+bool millTraceNext( struct millTraceReader *trace, int8_t *moves, uint64_t *cells, int *count );
+void millTraceClose( struct millTraceReader *trace );
+
+#endif
@@ -0,0 +1,116 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<errno.h>
+#include "mill_snapshot.h"
+
+/* Watches a running swim_mill through its read-only snapshot and prints a frame every interval
+ * Never touches the mill itself or its locks, so any number of watchers can run without slowing the mill down
+ * -m names the snapshot (swim_mill prints its name when it starts), -p takes the PID of the swim_mill instead, -i sets the milliseconds between frames and -k stops
+ * after that many frames (by default it runs until swim_mill removes the snapshot)
+ */
+
+#define INTERVAL_MS 1000 // Default milliseconds between frames
+#define TICK_LINE 32 // Room for the line in front of every frame
+
+// Prototype Functions (Comments on details are made after the main function)
+bool snapshotExists( const char *name );
+void writeAll( const char *buffer, size_t length );
+
+int main( int argc, char *argv[] ){
+    const char *name = NULL;
+    char pidName[MILL_SNAPSHOT_NAME_MAX]; // Name of the snapshot of the run given with -p
+    long interval = INTERVAL_MS;
+    long frames = 0;
+    int option;
+    while( (option = getopt(argc, argv, "m:p:i:k:")) != -1 ){
+        switch( option ){
+            case 'm':
+                name = optarg;
+                break;
+            case 'p':
+                millSnapshotName( pidName, sizeof(pidName), atoi(optarg) );
+                name = pidName;
+                break;
+            case 'i':
+                interval = atol( optarg );
+                break;
+            case 'k':
+                frames = atol( optarg );
+                break;
+            default:
+                fprintf( stderr, "Usage: %s -m snapshot name | -p swim_mill PID [-i milliseconds between frames] [-k frames]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( name == NULL ){
+        fprintf( stderr, "Usage: %s -m snapshot name | -p swim_mill PID [-i milliseconds between frames] [-k frames]\n", argv[0] );
+        exit(EXIT_FAILURE);
+    }
+    struct millSnapshot *snapshot = millSnapshotAttach( name );
+    if( snapshot == NULL ){
+        fprintf( stderr, "There is no mill snapshot named %s (is swim_mill running?).\n", name );
+        exit(EXIT_FAILURE);
+    }
+
+    // Room for the tick line and the frame, so every frame goes out with a single write
+    char *buffer = malloc( TICK_LINE + snapshot->frameSize );
+    if( buffer == NULL ){
+        fprintf( stderr, "Error allocating the frame: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    struct timespec pause = { interval / 1000, (interval % 1000) * 1000000L };
+    for( long shown = 0; frames == 0 || shown < frames; shown++ ){
+        if( shown > 0 ){
+            nanosleep( &pause, NULL );
+        }
+        if( !snapshotExists(name) ){
+            break; // swim_mill has finished
+        }
+        uint32_t tick;
+        if( !millSnapshotRead(snapshot, buffer + TICK_LINE, &tick) ){
+            continue; // Frames are changing faster than they can be copied, try again next interval
+        }
+        // The tick is only known once the frame is copied, so its line goes into the room left in front of the frame
+        char line[TICK_LINE];
+        int length = snprintf( line, sizeof(line), "Tick %u.\n", tick );
+        memcpy( buffer + TICK_LINE - length, line, length );
+        writeAll( buffer + TICK_LINE - length, length + snapshot->frameSize );
+    }
+    free( buffer );
+    millSnapshotDetach( snapshot );
+    return 0;
+}
+
+/* Returns true while the snapshot name still exists
+ */
+bool snapshotExists( const char *name ){
+    int fd = shm_open( name, O_RDONLY, 0 );
+    if( fd == -1 ){
+        return false;
+    }
+    close( fd );
+    return true;
+}
+
+/* Writes length bytes of buffer to stdout
+ */
+void writeAll( const char *buffer, size_t length ){
+    while( length > 0 ){
+        ssize_t written = write( STDOUT_FILENO, buffer, length );
+        if( written == -1 && errno == EINTR ){
+            continue;
+        }
+        if( written == -1 ){
+            fprintf( stderr, "Error printing the frame: %s\n", strerror(errno) );
+            exit(EXIT_FAILURE);
+        }
+        buffer += written;
+        length -= written;
+    }
+}
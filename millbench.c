@@ -0,0 +1,336 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<errno.h>
+#include "mill.h"
+#include "fish_engine.h"
+#include "pellet_engine.h"
+#include "planes_engine.h"
+#include "rng.h"
+
+/* Measures how fast the simulation runs as the grid, the number of pellets and the number of threads grow
+ * Every configuration runs on a private square mill filled to a pellet density first, then for -t milliseconds:
+ *   "engine"     swim_mill -e: the fish moves, the pellet engine advances every pellet (with 0, 1, 2, ... worker
+ *                threads) and as many pellets as left the grid are dropped again, so the density holds
+ *   "planes"     swim_mill -b: the fish moves, the planes engine moves every pellet at once (with 0, 1, 2, ... worker
+ *                threads) and the pellets that were eaten or passed are dropped again
+ *   "plan"       "planes" with a fish planning -P ticks ahead (the whole grid by default, see fish_plan.h) instead of
+ *                heading for the closest pellet, so the difference to "planes" is the time the fish takes to decide
+ *   "findpellet" millFindPellet alone, from a random column of the last row each call
+ * Output is CSV, one line per configuration:
+ * bench,label,rows,cols,density,threads,pellets,iterations,seconds,iterations_per_sec,updates_per_sec,ns_per_iteration
+ * An iteration is a tick (a millFindPellet call for findpellet) and an update is one pellet moved one row
+ * label is copied from -l into every line (make bench puts the commit there) so runs of different builds can be compared
+ */
+
+#define SIZES "16,64,256,1024,4096,8192" // Default sides of the square grids
+#define DENSITIES "0.01,0.1,0.3" // Default fractions of the cells holding a pellet
+#define THREADS "0,1,2,4" // Default engine worker threads (0 means the calling thread advances every pellet)
+#define BENCHES "engine,planes,plan,findpellet" // Default benchmarks to run
+#define DURATION_MS 200 // Default time every configuration is measured for
+#define MAX_PELLETS 4000000 // Default max number of pellets in the engine (it keeps a record of every one)
+#define MAX_VALUES 64 // Max number of values in a comma separated list
+#define COLUMNS 4096 // Random fish columns the findpellet benchmark cycles through
+
+// What one configuration did
+struct benchResult {
+    long pellets; // Pellets on the grid once it was filled
+    long iterations; // Ticks (or millFindPellet calls)
+    long updates; // Pellets moved one row
+    double seconds; // Time the iterations took
+};
+
+const char *label = ""; // Copied into every line of the CSV
+double duration = DURATION_MS / 1000.0; // Time every configuration is measured for
+uint64_t seed = 1; // Seed of every mill
+int horizon = FISH_PLAN_MAX_HORIZON; // Ticks the fish of the plan benchmark looks ahead (cut to the rows of the grid)
+long exited; // Pellets the engine reported finished since the last tick
+
+// Prototype Functions (Comments on details are made after the main function)
+struct millHeader *createMill( int side );
+long fillMill( struct millHeader *mill, struct rng *rng, long pellets );
+void benchEngine( int side, double density, int threads, long maxPellets );
+void benchPlanes( const char *bench, int side, double density, int threads, int plan );
+void benchFindPellet( int side, double density );
+void printResult( const char *bench, int side, double density, int threads, const struct benchResult *result );
+void noLock( int first, int last, bool lock );
+void countExit( const struct pelletExit *done );
+int parseList( const char *text, double *values );
+bool runsBench( const char *benches, const char *bench );
+double now( void );
+
+int main( int argc, char *argv[] ){
+    double sizes[MAX_VALUES], densities[MAX_VALUES], threads[MAX_VALUES];
+    int sizeCount = parseList( SIZES, sizes );
+    int densityCount = parseList( DENSITIES, densities );
+    int threadCount = parseList( THREADS, threads );
+    const char *benches = BENCHES;
+    long maxPellets = MAX_PELLETS;
+    int option;
+
+    while( (option = getopt(argc, argv, "g:d:j:b:t:m:s:l:P:")) != -1 ){
+        switch( option ){
+            case 'g':
+                sizeCount = parseList( optarg, sizes );
+                break;
+            case 'd':
+                densityCount = parseList( optarg, densities );
+                break;
+            case 'j':
+                threadCount = parseList( optarg, threads );
+                break;
+            case 'b':
+                benches = optarg;
+                break;
+            case 't':
+                duration = atoi( optarg ) / 1000.0;
+                break;
+            case 'm':
+                maxPellets = atol( optarg );
+                break;
+            case 's':
+                seed = strtoull( optarg, NULL, 0 );
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            case 'P':
+                horizon = atoi( optarg );
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-g sides,...] [-d densities,...] [-j threads,...] [-b benches,...] [-t ms each] [-m max engine pellets] [-s seed] [-l label] [-P plan horizon]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( sizeCount < 1 || densityCount < 1 || threadCount < 1 || duration <= 0 || maxPellets < 1 || strchr(label, ',') != NULL || horizon < 1 ){
+        fprintf( stderr, "Invalid arguments.\n" );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < sizeCount; i++ ){
+        if( sizes[i] < 2 || sizes[i] > 65536 ){
+            fprintf( stderr, "Every grid needs a side from 2 to 65536.\n" );
+            exit(EXIT_FAILURE);
+        }
+    }
+    for( int i = 0; i < densityCount; i++ ){
+        if( densities[i] < 0 || densities[i] > 1 ){
+            fprintf( stderr, "Every density is a fraction from 0 to 1.\n" );
+            exit(EXIT_FAILURE);
+        }
+    }
+    for( int i = 0; i < threadCount; i++ ){
+        if( threads[i] < 0 ){
+            fprintf( stderr, "Thread counts can't be negative.\n" );
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf( "bench,label,rows,cols,density,threads,pellets,iterations,seconds,iterations_per_sec,updates_per_sec,ns_per_iteration\n" );
+    fflush( stdout );
+    for( int s = 0; s < sizeCount; s++ ){
+        for( int d = 0; d < densityCount; d++ ){
+            if( runsBench(benches, "findpellet") ){
+                benchFindPellet( (int)sizes[s], densities[d] );
+            }
+            for( int j = 0; j < threadCount && runsBench(benches, "planes"); j++ ){
+                benchPlanes( "planes", (int)sizes[s], densities[d], (int)threads[j], 0 );
+            }
+            for( int j = 0; j < threadCount && runsBench(benches, "plan"); j++ ){
+                benchPlanes( "plan", (int)sizes[s], densities[d], (int)threads[j], horizon );
+            }
+            for( int j = 0; j < threadCount && runsBench(benches, "engine"); j++ ){
+                benchEngine( (int)sizes[s], densities[d], (int)threads[j], maxPellets );
+            }
+        }
+    }
+    return 0;
+}
+
+/* Allocates a private side by side mill (nobody else touches it, so it has no locks to take) with every cell empty
+ */
+struct millHeader *createMill( int side ){
+    struct millHeader *mill = aligned_alloc( MILL_ALIGN, millSegmentSize(side, side) );
+    if( mill == NULL ){
+        fprintf( stderr, "Error allocating a mill: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    millInit( mill, side, side, MILL_LOCK_GLOBAL, 0, seed );
+    millClear( mill );
+    return mill;
+}
+
+/* Places pellets on random cells without a pellet, the way planes mode drops them (all at once, see millDropPellets)
+ * Returns the number of pellets that stayed on the grid (a pellet dropped on the fish is eaten straight away)
+ */
+long fillMill( struct millHeader *mill, struct rng *rng, long pellets ){
+    uint32_t eaten = 0;
+    uint32_t collided = 0;
+    pellets = (pellets < (long)mill->freeCount) ? pellets : (long)mill->freeCount; // Every pellet gets a cell of its own
+    uint64_t *cells = malloc( (pellets > 0 ? pellets : 1) * sizeof(uint64_t) );
+    if( cells == NULL ){
+        fprintf( stderr, "Error allocating the cells of new pellets: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    millDropPellets( mill, rng, cells, (int)pellets, &eaten, &collided );
+    free( cells );
+    return pellets - eaten - collided;
+}
+
+/* Runs the pellet engine (and one fish) with threads worker threads, dropping a new pellet for every one that left
+ */
+void benchEngine( int side, double density, int threads, long maxPellets ){
+    long pellets = (long)(density * side * side);
+    if( pellets > maxPellets ){
+        fprintf( stderr, "Skipped engine %dx%d at density %g: %ld pellets is more than -m %ld.\n", side, side, density, pellets, maxPellets );
+        return;
+    }
+    struct benchResult result = { 0 };
+    struct millHeader *mill = createMill( side );
+    struct fishEngine *fish = fishEngineCreate( mill, 1, 0, seed, noLock );
+    struct pelletEngine *engine = pelletEngineCreate( mill, threads, (int)pellets + 1, seed, noLock, countExit );
+    pelletEngineSpawn( engine, (int)pellets );
+    result.pellets = engine->live;
+
+    exited = 0;
+    double start = now();
+    do {
+        fishEngineStep( fish );
+        result.updates += engine->live;
+        pelletEngineStep( engine );
+        long dropped = exited;
+        exited = 0;
+        pelletEngineSpawn( engine, (int)dropped );
+        result.iterations++;
+    } while( now() - start < duration );
+    result.seconds = now() - start;
+
+    printResult( "engine", side, density, engine->workers, &result );
+    pelletEngineDestroy( engine );
+    fishEngineDestroy( fish );
+    free( mill );
+}
+
+/* Runs the planes engine with threads worker threads (and one fish planning plan ticks ahead, or heading for the
+ * closest pellet if plan is 0), dropping a new pellet for every one that was eaten or passed
+ */
+void benchPlanes( const char *bench, int side, double density, int threads, int plan ){
+    struct benchResult result = { 0 };
+    struct rng rng;
+    rngSeed( &rng, seed, MILL_STREAM_SPAWNER );
+    struct millHeader *mill = createMill( side );
+    struct fishEngine *fish = fishEngineCreate( mill, 1, 0, seed, noLock );
+    fishEnginePlan( fish, plan );
+    struct planesEngine *planes = planesEngineCreate( mill, threads );
+    result.pellets = fillMill( mill, &rng, (long)(density * side * side) );
+
+    double start = now();
+    do {
+        uint32_t eaten = 0;
+        uint32_t passed = 0;
+        fishEngineStep( fish );
+        result.updates += (long)side * side - mill->freeCount;
+        planesEngineStep( planes, &eaten, &passed );
+        fillMill( mill, &rng, eaten + passed );
+        result.iterations++;
+    } while( now() - start < duration );
+    result.seconds = now() - start;
+
+    printResult( bench, side, density, planes->workers, &result );
+    planesEngineDestroy( planes );
+    fishEngineDestroy( fish );
+    free( mill );
+}
+
+/* Times millFindPellet on its own on a grid filled to density
+ */
+void benchFindPellet( int side, double density ){
+    struct benchResult result = { 0 };
+    struct rng rng;
+    rngSeed( &rng, seed, MILL_STREAM_FISH );
+    struct millHeader *mill = createMill( side );
+    result.pellets = fillMill( mill, &rng, (long)(density * side * side) );
+    int *columns = malloc( COLUMNS * sizeof(int) );
+    if( columns == NULL ){
+        fprintf( stderr, "Error allocating the columns: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < COLUMNS; i++ ){
+        columns[i] = rngBelow( &rng, side ); // Drawn up front so the random numbers aren't timed
+    }
+
+    double start = now();
+    do {
+        for( int i = 0; i < COLUMNS; i++ ){
+            millFindPellet( mill, columns[i], side / 2, &rng );
+        }
+        result.iterations += COLUMNS;
+    } while( now() - start < duration );
+    result.seconds = now() - start;
+
+    printResult( "findpellet", side, density, 0, &result );
+    free( columns );
+    free( mill );
+}
+
+/* Prints one line of the CSV
+ */
+void printResult( const char *bench, int side, double density, int threads, const struct benchResult *result ){
+    printf( "%s,%s,%d,%d,%g,%d,%ld,%ld,%.3f,%.1f,%.0f,%.1f\n", bench, label, side, side, density, threads, result->pellets,
+            result->iterations, result->seconds, result->iterations / result->seconds, result->updates / result->seconds,
+            result->seconds * 1e9 / result->iterations );
+    fflush( stdout ); // Lines show up as they are measured
+}
+
+/* Private mills are only touched by the thread running them, so there is nothing to lock
+ * (the engine's worker threads own whole columns and never share a cell)
+ */
+void noLock( int first, int last, bool lock ){
+}
+
+/* Counts a pellet the engine reported finished so it can be dropped again
+ */
+void countExit( const struct pelletExit *done ){
+    exited++;
+}
+
+/* Reads a comma separated list of numbers into values
+ * Returns the number of values read (0 if there are too many)
+ */
+int parseList( const char *text, double *values ){
+    int count = 0;
+    while( *text != '\0' ){
+        if( count == MAX_VALUES ){
+            return 0;
+        }
+        char *end;
+        values[count++] = strtod( text, &end );
+        text = (*end == ',') ? end + 1 : end;
+        if( end == text && *end != '\0' ){
+            return 0; // Not a number
+        }
+    }
+    return count;
+}
+
+/* Returns true if bench is one of the comma separated benches
+ */
+bool runsBench( const char *benches, const char *bench ){
+    size_t length = strlen( bench );
+    for( const char *next = benches; (next = strstr(next, bench)) != NULL; next += length ){
+        if( (next == benches || next[-1] == ',') && (next[length] == ',' || next[length] == '\0') ){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the current time in seconds
+ */
+double now( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -5,159 +5,116 @@
 #include<signal.h>
 #include<string.h>
 #include<unistd.h>
-#include<sys/sem.h>
-#include<sys/shm.h>
-#include<sys/stat.h>
 #include<errno.h>
+#include "mill.h"
+#include "mill_ipc.h"
+#include "mill_stats.h"
+#include "rng.h"
 
-#define SHM_KEY 0x1234 // Shared memory segment key
-#define SEM_KEY 0x5678 // Semaphore key
-#define OBJ_PERMS ( S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP ) // Read/Write permissions for owner or group owner
-#define ROW 16 // Max number of rows for the matrix shmp
-#define COL 16 // Max number of columns for the matrix shmp
+// The following global variable will be in all three source files
+struct millHeader *shmp; // Shared segment (header with the geometry followed by the 2D char array)
 
-// The following four global variables will be in all three source files
-char (*shmp)[ROW][COL]; // Initialize a 2D char array
-int shmid; // Initialize the shared memory ID
-int semid; // For use with the semaphore set
+// Geometry of the matrix, read from the header swim_mill wrote
+int rows;
+int cols;
 
 // Prototype Functions (Comments on details are made after the main function)
-void shmgetErrorDet( void );
-void shmatErrorDet( void );
-void semgetctlErrorDet( void );
-void semopErrorDet( bool lock );
+void lockRows( int first, int last, bool lock );
 
 int main( int argc, char *argv[] ){
     printf( "pellet process has begun. pellet PID = %d.\n", getpid() );
-    shmgetErrorDet( ); // Gets shared memory
-    shmatErrorDet( ); // Attaches shared memory
-    semgetctlErrorDet(); // Initializes the semaphore set
+    shmp = millIpcAttach( getenv(MILL_IPC_ENV) ); // Attaches the shared memory swim_mill created
+    rows = shmp->rows;
+    cols = shmp->cols;
+    millStatsAttach( getenv(MILL_IPC_ENV) ); // Hot path timings go to swim_mill (only with make STATS=1)
 
-    srand( time(NULL) ); // For creating a random row and col
+    uint32_t tick = millTickNow( shmp ); // swim_mill registered the pellet for the tick it was forked on
+    // For creating a random row and col, swim_mill hands every pellet its own random number stream
+    struct rng rng;
+    rngSeed( &rng, shmp->seed, (argc > 1) ? strtoull(argv[1], NULL, 10) : MILL_STREAM_PELLET );
+    millTickAfterFish( shmp, tick ); // Pellets move after the fish so every tick happens in the same order
     int randRow, randCol; // For determining the location of the new pellet
-    semopErrorDet( true ); // Lock acccess to the shared memory 2D char array
-    // Will keep randomizing the row and col till a blank 'x' is found
-    do{
-        randRow = rand() % ROW;
-        randCol = rand() % COL;
-    } while( (*shmp)[randRow][randCol] == 'P' );
+    int outcome; // What happened to the pellet (one of the MILL_ outcomes)
+    // Picks a random cell without a pellet from the pellet index and only then locks its row
+    // (the row is checked again under the lock in case another pellet landed there first)
+    MILL_STAT_START( held ); // When the lock used for the placement was taken
+    while( 1 ){
+        if( millFreeCell(shmp, &rng, &randRow, &randCol) == -1 ){
+            // Every cell holds a pellet, so this one will collide
+            randRow = rngBelow( &rng, rows );
+            randCol = rngBelow( &rng, cols );
+        }
+        lockRows( randRow, randRow, true ); // Lock acccess to that row of the shared memory 2D char array
+        MILL_STAT_MARK( held );
+        if( millGet(shmp, randRow, randCol) != 'P' || __atomic_load_n(&shmp->freeCount, __ATOMIC_RELAXED) == 0 ){
+            break;
+        }
+        lockRows( randRow, randRow, false );
+    }
 
     // Initial state of pellet creation
-    if( (*shmp)[randRow][randCol] == 'x' ){
-        // If the current location is an 'x' then the pellet will overwrite that location with 'P'
-        (*shmp)[randRow][randCol] = 'P' ;
-        semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
-    } else if( (*shmp)[randRow][randCol] == 'P' ){
-        // Else if the current location already contains a pellet, then terminate this process with code 3
-        // This shouldn't occur due to the earlier do/while loop, but just in case
-        semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
+    outcome = millPlacePellet( shmp, randRow, randCol );
+    MILL_STAT_END( MILL_STAT_LOCK_HOLD, held );
+    lockRows( randRow, randRow, false ); // Unlock acccess to the shared memory 2D char array
+    if( outcome == MILL_COLLISION ){
+        // If the current location already contains a pellet, then terminate this process with code 3
+        // This shouldn't occur due to the earlier loop, but just in case (another pellet can win the CAS)
+        millTickLeave( shmp ); // Stops taking part in ticks
         exit( 3 );
-    } else if( (*shmp)[randRow][randCol] == 'F' || (*shmp)[randRow][randCol] == 'E' ){
+    } else if( outcome == MILL_EATEN ){
         // Else if the current location is the fish (whether 'F' or 'E') then terminate this process successfully
-        (*shmp)[randRow][randCol] = 'E'; // Updates new location to 'E' (for eaten)
-        semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
-        printf( "Pellet has been eaten by the fish. Pellet PID = %d.\n", getpid() );
+        printf( "Pellet has been eaten by fish %u. Pellet PID = %d.\n", millFishAt(shmp, randCol), getpid() );
+        millTickLeave( shmp );
         exit( EXIT_SUCCESS );
-    } else {
-        // For whaever reason it gets here, at least unlock the semaphore
-        semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
     }
-    sleep(1);
+    tick = millTickArrive( shmp, tick ); // Waits for the next tick
 
-    // Will continually update the location of the pellet
-    while( 1 ){
-        randRow++; // Increment the row
-        semopErrorDet( true ); // Lock acccess to the shared memory 2D char array
-        if( (*shmp)[randRow][randCol] == 'x' || (*shmp)[randRow][randCol] == 'P' ){
-            // If the next row is an 'x' or 'P', then update the locations
-            (*shmp)[randRow - 1][randCol] = 'x'; // Updates previous location back to 'x'
-            (*shmp)[randRow][randCol] = 'P'; // Updates new location to 'P'
-            semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
-        } else if( (*shmp)[randRow][randCol] == 'F' ){
-            // Else if the next row is 'F' or 'E' then update the location as 'E' (for eaten) and exit successfully
-            (*shmp)[randRow - 1][randCol] = 'x'; // Updates previous location back to 'x'
-            (*shmp)[randRow][randCol] = 'E'; // Updates new location to 'E' (for eaten)
-            semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
-            printf( "Pellet has been eaten by the fish. pellet PID = %d.\n", getpid() );
+    // Will continually update the location of the pellet until it finishes or swim_mill stops the run
+    while( !millStopped(shmp) && !millTickOver(shmp, tick) ){
+        millTickAfterFish( shmp, tick );
+        MILL_STAT_START( step );
+        lockRows( randRow, randRow + 1, true ); // Lock acccess to this row and the next one
+        outcome = millMovePellet( shmp, randRow, randCol );
+        lockRows( randRow, randRow + 1, false ); // Unlock acccess to the shared memory 2D char array
+        MILL_STAT_END( MILL_STAT_PELLET_STEP, step );
+        if( outcome == MILL_MOVED ){
+            randRow++; // The pellet is now one row lower
+        } else if( outcome == MILL_EATEN ){
+            printf( "Pellet has been eaten by fish %u. pellet PID = %d.\n", millFishAt(shmp, randCol), getpid() );
+            millTickLeave( shmp );
             exit(EXIT_SUCCESS);
-        } else if( randRow >= ROW ){
-            // Else if the pellet reaches the last row then state it as having passed the fish
-            // Ensure that the fish char isn't overwritten with an x if the passing pellet was next to it
-            if( (*shmp)[randRow - 1][randCol] != 'F' && (*shmp)[randRow - 1][randCol] != 'E' ){
-                (*shmp)[randRow - 1][randCol] = 'x'; // Update the previous location to 'x'
-            }
-            semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
+        } else if( outcome == MILL_PASSED ){
             printf( "Pellet has passed the fish. pellet PID = %d.\n", getpid() );
+            millTickLeave( shmp );
             exit(2);
-        } else {
-            // For whatever reason it ends up here, at least unlock the semaphore
-            semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
         }
-        sleep(1);
+        tick = millTickArrive( shmp, tick ); // Waits for the next tick
     }
-    exit(EXIT_FAILURE); // Exit with an error (If it managed to reach this)
+    millWaitStop( shmp ); // The run is over, swim_mill stops it once every thread of its own is done
+    exit( 4 ); // swim_mill stopped the run before the pellet finished
 }
 
-/* Gets shared memory with key
+/* Locks/unlocks rows first through last of the shared memory 2D char array with whatever the mill's lock mode is
  */
-void shmgetErrorDet( void ){
-    shmid = shmget( SHM_KEY, sizeof(shmp), IPC_CREAT | OBJ_PERMS );
-    // If a -1 is returned, then there is an issue
-    if( shmid == -1 ){
-        fprintf( stderr, "Error with shmget %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
-    }
-}
-
-/* Attaches shared memory
- */
-void shmatErrorDet( void ){
-    shmp = shmat( shmid, NULL, 0 );
-    // If a -1 is returned, then there is an issue
-    if( shmp == (void *) -1 ){
-        fprintf( stderr, "Error with shmat: %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
-    }
-}
-
-/* Creates the semaphore set and intializes them
- */
-void semgetctlErrorDet( void ){
-    semid = semget( SEM_KEY, 1, IPC_CREAT | OBJ_PERMS ); // Creates semaphore ID with appropriate permissions
-    // Error Detection
-    if( semid == -1 ){
-        fprintf( stderr, "Error with semget %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
-    }
-    // Initializes semaphore as well as perform error detection
-    if( semctl(semid, 0, SETVAL, 1) == -1 ){
-        fprintf( stderr, "Error with semctl initialization %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
-    }
-}
-
-/* Perform lock/unlock operations on the opened semaphore set
- */
-void semopErrorDet( bool lock ){
-    struct sembuf sops; // struct with data members needed for semop system call
-    // Locking blocks any other process from accessing critical region (shared 2D array)
-    if( lock ){
-        sops.sem_num = 0;
-        sops.sem_op = -1;
-        sops.sem_flg = 0;
-        if( semop(semid, &sops, 1) == -1 ){
-            fprintf( stderr, "Error with semop lock operation. %s\n", strerror(errno) );
+void lockRows( int first, int last, bool lock ){
+    last = (last >= rows) ? (rows - 1) : last; // The row past the last one has nothing to lock
+    MILL_STAT_START( start );
+    if( shmp->lockMode == MILL_LOCK_GLOBAL ){
+        if( lock ){
+            millLockGlobal( shmp );
+        } else {
+            millUnlockGlobal( shmp );
         }
-    // Unlocking allows further access to critical region (shared 2D array)
-    } else if( !lock ){
-        sops.sem_num = 0;
-        sops.sem_op = 1;
-        sops.sem_flg = 0;
-        if( semop(semid, &sops, 1) == -1 ){
-            fprintf( stderr, "Error with semop unlock operation. %s\n", strerror(errno) );
+    } else if( shmp->lockMode == MILL_LOCK_STRIPED ){
+        if( lock ){
+            millLockRows( shmp, first, last );
+        } else {
+            millUnlockRows( shmp, first, last );
         }
-    // Should not get to this else statement (debugging)
-    } else {
-        printf( "How did you wind up here?\n" );
+    }
+    // MILL_LOCK_CAS has nothing to lock, cells change with compare and swap
+    if( lock && shmp->lockMode != MILL_LOCK_CAS ){
+        MILL_STAT_END( MILL_STAT_LOCK_WAIT, start ); // How long it took to get the lock
     }
 }
+
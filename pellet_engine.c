@@ -0,0 +1,392 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "pellet_engine.h"
+#include "mill_stats.h"
+
+// Prototype Functions (Comments on details are made with each function)
+static void *pelletWorker( void *arg );
+static void advanceLane( struct pelletEngine *engine, struct pelletLane *lane );
+static int comparePellets( const void *a, const void *b );
+static void mergePellets( struct pelletLane *lane, const struct pelletRecord *added, int count );
+static void reserveCells( struct pelletEngine *engine, int count );
+static int placeBatch( struct pelletEngine *engine, int count, bool pick );
+
+/* Creates the pellet pool and starts the worker threads that advance it
+ */
+struct pelletEngine *pelletEngineCreate( struct millHeader *mill, int workers, int capacity, uint64_t seed,
+                                         void (*lock)( int first, int last, bool lock ), void (*report)( const struct pelletExit *done ) ){
+    struct pelletEngine *engine = calloc( 1, sizeof(*engine) );
+    if( engine == NULL ){
+        fprintf( stderr, "Error allocating the pellet engine: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    engine->mill = mill;
+    engine->rows = mill->rows;
+    engine->cols = mill->cols;
+    engine->lock = lock;
+    engine->report = report;
+    engine->capacity = capacity;
+    rngSeed( &engine->rng, seed, MILL_STREAM_ENGINE );
+    engine->workers = (workers > engine->cols) ? engine->cols : workers; // A worker without a column would never have work
+    engine->workers = (engine->workers < 0) ? 0 : engine->workers;
+
+    int lanes = (engine->workers > 0) ? engine->workers : 1;
+    engine->lanes = calloc( lanes, sizeof(*engine->lanes) );
+    if( engine->lanes == NULL ){
+        fprintf( stderr, "Error allocating the pellet lanes: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < lanes; i++ ){
+        engine->lanes[i].capacity = capacity;
+        engine->lanes[i].pellets = malloc( capacity * sizeof(struct pelletRecord) );
+        engine->lanes[i].exits = malloc( capacity * sizeof(struct pelletExit) );
+        if( engine->lanes[i].pellets == NULL || engine->lanes[i].exits == NULL ){
+            fprintf( stderr, "Error allocating the pellet pool: %s\n", strerror(errno) );
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_mutex_init( &engine->mutex, NULL );
+    pthread_cond_init( &engine->start, NULL );
+    pthread_cond_init( &engine->done, NULL );
+    engine->threads = calloc( lanes, sizeof(pthread_t) );
+    engine->workerArgs = calloc( lanes, sizeof(struct pelletWorkerArg) );
+    if( engine->threads == NULL || engine->workerArgs == NULL ){
+        fprintf( stderr, "Error allocating the pellet workers: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < engine->workers; i++ ){
+        engine->workerArgs[i].engine = engine;
+        engine->workerArgs[i].index = i;
+        int code = pthread_create( &engine->threads[i], NULL, pelletWorker, &engine->workerArgs[i] );
+        if( code ){
+            fprintf( stderr, "pthread_create failed with code %d.\n", code );
+            exit(EXIT_FAILURE);
+        }
+    }
+    return engine;
+}
+
+/* Places up to count new pellets on random cells of the grid, the same way a new ./pellet process does
+ * The cells of the whole batch are picked in one pass over the pellet index (millFreeCells) before any is placed
+ * The cells the pellets went to are left in engine->cells (so a trace can record them, see mill_trace.h)
+ * Returns the number of pellets that were added to the pool
+ * Must be called from the same thread that calls pelletEngineStep
+ */
+int pelletEngineSpawn( struct pelletEngine *engine, int count ){
+    reserveCells( engine, count );
+    return placeBatch( engine, count, true );
+}
+
+/* Places count new pellets on the given cells (row * cols + col) in order, the way a recorded spawn is replayed
+ * Returns the number of pellets that were added to the pool
+ * Must be called from the same thread that calls pelletEngineStep
+ */
+int pelletEnginePlace( struct pelletEngine *engine, const uint64_t *cells, int count ){
+    reserveCells( engine, count );
+    memcpy( engine->cells, cells, count * sizeof(uint64_t) );
+    return placeBatch( engine, count, false );
+}
+
+/* Makes room for count cells in engine->cells
+ */
+static void reserveCells( struct pelletEngine *engine, int count ){
+    if( count <= engine->cellCapacity ){
+        return;
+    }
+    free( engine->cells );
+    engine->cellCapacity = 2 * count;
+    engine->cells = malloc( engine->cellCapacity * sizeof(uint64_t) );
+    if( engine->cells == NULL ){
+        fprintf( stderr, "Error allocating the cells of new pellets: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Places count pellets on engine->cells, first picking the cells if pick is set, and writes back the cell each
+ * pellet really went to
+ * Returns the number of pellets that were added to the pool
+ */
+static int placeBatch( struct pelletEngine *engine, int count, bool pick ){
+    int lanes = (engine->workers > 0) ? engine->workers : 1;
+    int added = 0;
+    int finishedCount = 0;
+    uint64_t *cells = engine->cells;
+    struct pelletExit *finished = malloc( (count > 0 ? count : 1) * sizeof(struct pelletExit) ); // Pellets that ended as soon as they were created
+    struct pelletRecord *placed = malloc( (count > 0 ? 2 * count : 1) * sizeof(struct pelletRecord) ); // Pellets to add to the lanes, then one lane's share of them
+    if( finished == NULL || placed == NULL ){
+        fprintf( stderr, "Error allocating the pellet exits: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    bool whole = (engine->mill->lockMode == MILL_LOCK_GLOBAL); // With one global lock, take it once for every pellet
+    if( whole ){
+        engine->lock( 0, engine->rows - 1, true ); // Lock acccess to the shared memory 2D char array
+    }
+    int picked = pick ? millFreeCells( engine->mill, &engine->rng, cells, count ) : count;
+    int n = 0;
+    for( ; n < count && engine->live < engine->capacity; n++ ){
+        struct pelletRecord pellet;
+        int outcome;
+        pellet.id = ++engine->nextId;
+        MILL_STAT_START( held ); // With one global lock the whole search happens under it
+        // Takes the next picked cell, or once the grid is full any cell
+        // A cell that holds a pellet by the time its row is locked (the index changed while the batch was picked) is picked again,
+        // unless the cells were given (a replay puts every pellet exactly where it was recorded)
+        bool repick = (n >= picked);
+        if( !repick ){
+            pellet.row = cells[n] / engine->cols;
+            pellet.col = cells[n] % engine->cols;
+        }
+        while( 1 ){
+            if( repick && millFreeCell(engine->mill, &engine->rng, &pellet.row, &pellet.col) == -1 ){
+                pellet.row = rngBelow( &engine->rng, engine->rows );
+                pellet.col = rngBelow( &engine->rng, engine->cols );
+            }
+            repick = true;
+            if( !whole ){
+                engine->lock( pellet.row, pellet.row, true );
+                MILL_STAT_MARK( held );
+            }
+            if( !pick || millGet(engine->mill, pellet.row, pellet.col) != 'P' ||
+                __atomic_load_n(&engine->mill->freeCount, __ATOMIC_RELAXED) == 0 ){
+                break;
+            }
+            if( !whole ){
+                engine->lock( pellet.row, pellet.row, false );
+            }
+        }
+        outcome = millPlacePellet( engine->mill, pellet.row, pellet.col );
+        MILL_STAT_END( MILL_STAT_LOCK_HOLD, held );
+        cells[n] = (uint64_t)pellet.row * engine->cols + pellet.col;
+        if( !whole ){
+            engine->lock( pellet.row, pellet.row, false );
+        }
+
+        if( outcome == MILL_MOVED ){
+            placed[added++] = pellet;
+            engine->live++;
+        } else {
+            // Landed right on the fish, or every cell already holds a pellet
+            finished[finishedCount].id = pellet.id;
+            finished[finishedCount].row = pellet.row;
+            finished[finishedCount].col = pellet.col;
+            finished[finishedCount].fish = (outcome == MILL_EATEN) ? (int)millFishAt( engine->mill, pellet.col ) : 0;
+            finished[finishedCount++].code = (outcome == MILL_EATEN) ? PELLET_EATEN : PELLET_COLLISION;
+        }
+    }
+    if( whole ){
+        engine->lock( 0, engine->rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+    }
+    engine->cellCount = n;
+
+    // The new pellets are sorted once and merged into each lane, instead of being inserted one at a time
+    // (which moved half a lane per pellet and made filling a big grid quadratic)
+    qsort( placed, added, sizeof(struct pelletRecord), comparePellets );
+    for( int i = 0; i < lanes && added > 0; i++ ){
+        int laneAdded = 0;
+        for( int j = 0; j < added; j++ ){
+            if( placed[j].col % lanes == i ){
+                placed[added + laneAdded++] = placed[j]; // The second half of placed holds this lane's pellets
+            }
+        }
+        mergePellets( &engine->lanes[i], &placed[added], laneAdded );
+    }
+    for( int i = 0; i < finishedCount; i++ ){
+        engine->report( &finished[i] );
+    }
+    free( placed );
+    free( finished );
+    return added;
+}
+
+/* Advances every pellet in the pool by one row and returns once all lanes are done
+ * Finished pellets are reported from the calling thread in lane order, so the report order doesn't depend on thread timing
+ */
+void pelletEngineStep( struct pelletEngine *engine ){
+    int lanes = (engine->workers > 0) ? engine->workers : 1;
+    if( engine->workers == 0 ){
+        advanceLane( engine, &engine->lanes[0] ); // Without worker threads the caller advances the single lane itself
+    } else {
+        pthread_mutex_lock( &engine->mutex );
+        engine->pending = engine->workers;
+        engine->generation++;
+        pthread_cond_broadcast( &engine->start );
+        while( engine->pending > 0 ){
+            pthread_cond_wait( &engine->done, &engine->mutex );
+        }
+        pthread_mutex_unlock( &engine->mutex );
+    }
+    for( int i = 0; i < lanes; i++ ){
+        struct pelletLane *lane = &engine->lanes[i];
+        engine->live -= lane->exitCount;
+        for( int j = 0; j < lane->exitCount; j++ ){
+            engine->report( &lane->exits[j] );
+        }
+        lane->exitCount = 0;
+    }
+}
+
+/* Refills an empty pool with count pellets saved by a checkpoint (already on the matrix) in any order, and
+ * picks up the pellet IDs and random number stream where the checkpoint left them
+ * Must be called before the first step
+ */
+void pelletEngineRestore( struct pelletEngine *engine, const struct pelletRecord *pellets, int count, uint64_t nextId, const struct rng *rng ){
+    int lanes = (engine->workers > 0) ? engine->workers : 1;
+    if( count > engine->capacity ){
+        fprintf( stderr, "The checkpoint holds %d pellets, more than the pool size of %d.\n", count, engine->capacity );
+        exit(EXIT_FAILURE);
+    }
+    struct pelletRecord *sorted = malloc( (count > 0 ? 2 * count : 1) * sizeof(struct pelletRecord) ); // Every pellet, then one lane's share of them
+    if( sorted == NULL ){
+        fprintf( stderr, "Error allocating the restored pellets: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    memcpy( sorted, pellets, count * sizeof(struct pelletRecord) );
+    qsort( sorted, count, sizeof(struct pelletRecord), comparePellets );
+    for( int i = 0; i < lanes; i++ ){
+        int laneCount = 0;
+        for( int j = 0; j < count; j++ ){
+            if( sorted[j].col % lanes == i ){
+                sorted[count + laneCount++] = sorted[j];
+            }
+        }
+        mergePellets( &engine->lanes[i], &sorted[count], laneCount );
+    }
+    free( sorted );
+    engine->live = count;
+    engine->nextId = nextId;
+    engine->rng = *rng;
+}
+
+/* Stops the worker threads and frees the pool (pellets still in the pool are dropped)
+ */
+void pelletEngineDestroy( struct pelletEngine *engine ){
+    int lanes = (engine->workers > 0) ? engine->workers : 1;
+    pthread_mutex_lock( &engine->mutex );
+    engine->stopping = true;
+    pthread_cond_broadcast( &engine->start );
+    pthread_mutex_unlock( &engine->mutex );
+    for( int i = 0; i < engine->workers; i++ ){
+        pthread_join( engine->threads[i], NULL );
+    }
+    for( int i = 0; i < lanes; i++ ){
+        free( engine->lanes[i].pellets );
+        free( engine->lanes[i].exits );
+    }
+    pthread_mutex_destroy( &engine->mutex );
+    pthread_cond_destroy( &engine->start );
+    pthread_cond_destroy( &engine->done );
+    free( engine->threads );
+    free( engine->workerArgs );
+    free( engine->lanes );
+    free( engine->cells );
+    free( engine );
+}
+
+/* Worker thread that advances its own lane once per step
+ */
+static void *pelletWorker( void *arg ){
+    struct pelletWorkerArg *worker = arg;
+    struct pelletEngine *engine = worker->engine;
+    unsigned long seen = 0; // Last step this worker has run
+
+    pthread_mutex_lock( &engine->mutex );
+    while( 1 ){
+        while( engine->generation == seen && !engine->stopping ){
+            pthread_cond_wait( &engine->start, &engine->mutex );
+        }
+        if( engine->stopping ){
+            break;
+        }
+        seen = engine->generation;
+        pthread_mutex_unlock( &engine->mutex );
+
+        advanceLane( engine, &engine->lanes[worker->index] );
+
+        pthread_mutex_lock( &engine->mutex );
+        if( --engine->pending == 0 ){
+            pthread_cond_signal( &engine->done );
+        }
+    }
+    pthread_mutex_unlock( &engine->mutex );
+    return NULL;
+}
+
+/* Moves every pellet of a lane down one row with the same rules as pellet.c's main loop
+ * A lane owns whole columns and is kept in descending row order, so a pellet never
+ * overwrites one below it that hasn't moved yet
+ * With one global lock it is taken once for each row of the lane's pellets rather than once for the whole lane,
+ * so the workers take turns with it row by row instead of one lane after the other
+ */
+static void advanceLane( struct pelletEngine *engine, struct pelletLane *lane ){
+    int kept = 0; // Pellets still alive after this step
+    bool whole = (engine->mill->lockMode == MILL_LOCK_GLOBAL); // With one global lock, take it for a row at a time
+    int lockedRow = -1; // Row of the pellets moved under the global lock being held (-1 when it isn't held)
+    for( int i = 0; i < lane->count; i++ ){
+        struct pelletRecord *pellet = &lane->pellets[i];
+        int last = (pellet->row + 1 < engine->rows) ? pellet->row + 1 : pellet->row;
+        MILL_STAT_START( step );
+        if( whole && pellet->row != lockedRow ){
+            if( lockedRow != -1 ){
+                engine->lock( 0, engine->rows - 1, false ); // Lets the other workers have a turn between rows
+            }
+            engine->lock( 0, engine->rows - 1, true ); // Lock acccess to the shared memory 2D char array
+            lockedRow = pellet->row;
+        }
+        if( !whole ){
+            engine->lock( pellet->row, last, true ); // Lock acccess to this row and the next one
+        }
+        int outcome = millMovePellet( engine->mill, pellet->row, pellet->col );
+        if( !whole ){
+            engine->lock( pellet->row, last, false );
+        }
+        MILL_STAT_END( MILL_STAT_PELLET_STEP, step );
+        if( outcome == MILL_MOVED ){
+            pellet->row++;
+            lane->pellets[kept++] = *pellet;
+        } else if( outcome == MILL_STAYED ){
+            lane->pellets[kept++] = *pellet; // Unknown cell, the pellet stays where it is
+        } else {
+            lane->exits[lane->exitCount].id = pellet->id;
+            lane->exits[lane->exitCount].row = pellet->row;
+            lane->exits[lane->exitCount].col = pellet->col;
+            lane->exits[lane->exitCount].fish = (outcome == MILL_EATEN) ? (int)millFishAt( engine->mill, pellet->col ) : 0;
+            lane->exits[lane->exitCount++].code = (outcome == MILL_EATEN) ? PELLET_EATEN : PELLET_PASSED;
+        }
+    }
+    lane->count = kept;
+    if( lockedRow != -1 ){
+        engine->lock( 0, engine->rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+    }
+}
+
+/* Orders pellets by descending row, and pellets on the same row by the order they were spawned in
+ */
+static int comparePellets( const void *a, const void *b ){
+    const struct pelletRecord *left = a;
+    const struct pelletRecord *right = b;
+    if( left->row != right->row ){
+        return (left->row > right->row) ? -1 : 1;
+    }
+    return (left->id > right->id) - (left->id < right->id);
+}
+
+/* Merges count pellets (sorted by comparePellets) into a lane while keeping the lane in descending row order
+ * A new pellet goes after the pellets already on its row, the same place inserting them one by one would put it
+ * Works from the back so every pellet is moved at most once
+ */
+static void mergePellets( struct pelletLane *lane, const struct pelletRecord *added, int count ){
+    int old = lane->count - 1; // Next pellet of the lane to move
+    int next = count - 1; // Next new pellet to place
+    for( int write = lane->count + count - 1; next >= 0; write-- ){
+        if( old >= 0 && lane->pellets[old].row < added[next].row ){
+            lane->pellets[write] = lane->pellets[old--];
+        } else {
+            lane->pellets[write] = added[next--];
+        }
+    }
+    lane->count += count;
+}
@@ -0,0 +1,83 @@
+#ifndef PELLET_ENGINE_H
+#define PELLET_ENGINE_H
+
+#include<stdbool.h>
+#include<stdint.h>
+#include<pthread.h>
+#include "mill.h"
+#include "rng.h"
+
+// Exit codes a pellet can finish with (same meaning as the ./pellet process exit status)
+#define PELLET_EATEN 0 // Pellet was eaten by the fish
+#define PELLET_ERROR 1 // Pellet terminated due to an error
+#define PELLET_PASSED 2 // Pellet passed the fish
+#define PELLET_COLLISION 3 // Pellet initialized on top of an already existing pellet
+#define PELLET_STOPPED 4 // Pellet was still falling when swim_mill stopped the run
+
+// A single pellet kept inside the pool instead of a separate process
+struct pelletRecord {
+    uint64_t id; // Unique pellet ID (takes the place of the pellet PID)
+    int row; // Current row of the pellet
+    int col; // Current column of the pellet
+};
+
+// A pellet that finished during a step, reported once every lane is done
+struct pelletExit {
+    uint64_t id; // Pellet ID (or PID of a ./pellet process)
+    int code;
+    int fish; // Number of the fish that ate the pellet (0 if it wasn't eaten)
+    int row; // Where the pellet was when it finished
+    int col;
+};
+
+// The pellets owned by one worker (a worker owns every column where col % workers == index)
+struct pelletLane {
+    struct pelletRecord *pellets; // Live pellets of this lane, kept in descending row order
+    int count; // Number of live pellets in this lane
+    int capacity; // Max number of pellets this lane can hold
+    struct pelletExit *exits; // Pellets of this lane that finished during the last step
+    int exitCount; // Number of entries in exits
+};
+
+struct pelletEngine;
+
+// Handed to each worker thread so it knows which lane it owns
+struct pelletWorkerArg {
+    struct pelletEngine *engine;
+    int index;
+};
+
+struct pelletEngine {
+    struct millHeader *mill; // The shared segment holding the 2D char array being simulated
+    int rows; // Number of rows in the matrix
+    int cols; // Number of columns in the matrix
+    void (*lock)( int first, int last, bool lock ); // Locks/unlocks rows first through last of the matrix
+    void (*report)( const struct pelletExit *done ); // Called once for every pellet that finishes
+    struct rng rng; // Random number stream used to place new pellets
+    uint64_t nextId; // Last ID given out (64 bits, so even a feed of 1e8 pellets a tick never runs out)
+    int live; // Number of pellets currently in the pool
+    int capacity; // Max number of pellets allowed in the pool at one time
+    uint64_t *cells; // Cells (row * cols + col) the pellets of the last spawn went to, in the order they were placed
+    int cellCount; // Pellets in cells
+    int cellCapacity; // Room in cells
+    int workers; // Number of worker threads (0 means the caller steps every lane itself)
+    struct pelletLane *lanes; // One lane per worker (or a single lane with no workers)
+    pthread_t *threads; // Worker threads
+    struct pelletWorkerArg *workerArgs; // Argument given to each worker thread
+    pthread_mutex_t mutex; // Protects the fields below
+    pthread_cond_t start; // Signaled when a new step begins
+    pthread_cond_t done; // Signaled when the last worker finishes a step
+    unsigned long generation; // Incremented once per step
+    int pending; // Workers that haven't finished the current step
+    bool stopping; // Set when the workers should exit
+};
+
+struct pelletEngine *pelletEngineCreate( struct millHeader *mill, int workers, int capacity, uint64_t seed,
+                                         void (*lock)( int first, int last, bool lock ), void (*report)( const struct pelletExit *done ) );
+int pelletEngineSpawn( struct pelletEngine *engine, int count );
+int pelletEnginePlace( struct pelletEngine *engine, const uint64_t *cells, int count );
+void pelletEngineStep( struct pelletEngine *engine );
+void pelletEngineRestore( struct pelletEngine *engine, const struct pelletRecord *pellets, int count, uint64_t nextId, const struct rng *rng );
+void pelletEngineDestroy( struct pelletEngine *engine );
+
+#endif
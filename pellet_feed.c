@@ -0,0 +1,155 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<limits.h>
+#include<math.h>
+#include<errno.h>
+#include "pellet_feed.h"
+
+#define FEED_MAX_RATE 1e8 // Highest mean number of pellets per tick a feed may ask for
+#define FEED_PTRS_RATE 10.0 // Rates from here on are drawn with PTRS instead of by multiplying uniforms
+
+// Prototype Functions (Comments on details are made with each function)
+static void readTrace( struct pelletFeed *feed, const char *path );
+static long poisson( struct rng *rng, double rate );
+
+/* Makes the feed described by spec (see pellet_feed.h), printing why and exiting if spec isn't a feed
+ */
+void pelletFeedInit( struct pelletFeed *feed, const char *spec ){
+    memset( feed, 0, sizeof(*feed) );
+    if( strlen(spec) >= sizeof(feed->spec) ){
+        fprintf( stderr, "Feed %.32s... is longer than %d characters.\n", spec, PELLET_FEED_SPEC_MAX - 1 );
+        exit(EXIT_FAILURE);
+    }
+    strcpy( feed->spec, spec );
+    char end; // Catches anything left over after the numbers
+    if( strcmp(spec, "uniform") == 0 ){
+        feed->kind = PELLET_FEED_UNIFORM;
+    } else if( sscanf(spec, "poisson:%lf%c", &feed->rate, &end) == 1 ){
+        feed->kind = PELLET_FEED_POISSON;
+    } else if( sscanf(spec, "burst:%lf,%lf,%lf,%lf%c", &feed->rate, &feed->burstRate, &feed->burstStart, &feed->burstEnd, &end) == 4 ){
+        feed->kind = PELLET_FEED_BURST;
+    } else if( strncmp(spec, "trace:", 6) == 0 ){
+        feed->kind = PELLET_FEED_TRACE;
+        readTrace( feed, spec + 6 );
+    } else {
+        fprintf( stderr, "Unknown feed %s (uniform, poisson:rate, burst:rate,burst rate,start chance,end chance or trace:path).\n", spec );
+        exit(EXIT_FAILURE);
+    }
+    if( !(feed->rate >= 0 && feed->rate <= FEED_MAX_RATE && feed->burstRate >= 0 && feed->burstRate <= FEED_MAX_RATE &&
+          feed->burstStart >= 0 && feed->burstStart <= 1 && feed->burstEnd >= 0 && feed->burstEnd <= 1) ){
+        fprintf( stderr, "Feed rates must be from 0 to %g pellets per tick and chances from 0 to 1.\n", FEED_MAX_RATE );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Returns the number of pellets to drop on tick
+ */
+int pelletFeedNext( struct pelletFeed *feed, struct rng *rng, long tick ){
+    switch( feed->kind ){
+        case PELLET_FEED_POISSON:
+            return (int)poisson( rng, feed->rate );
+        case PELLET_FEED_BURST:
+            // The burst switches on or off first, so the tick it starts on already gets the burst rate
+            if( rngUnit(rng) < (feed->bursting ? feed->burstEnd : feed->burstStart) ){
+                feed->bursting = !feed->bursting;
+            }
+            return (int)poisson( rng, feed->bursting ? feed->burstRate : feed->rate );
+        case PELLET_FEED_TRACE:
+            return (int)feed->trace[tick % feed->traceLength];
+        default:
+            return rngBelow( rng, 5 ) + 1; // Random number between 1 and 5
+    }
+}
+
+/* Frees the trace of a feed (every copy of the feed shares it)
+ */
+void pelletFeedDestroy( struct pelletFeed *feed ){
+    free( feed->trace );
+    feed->trace = NULL;
+}
+
+/* Reads the pellets of every tick from the text file at path into the feed's trace
+ */
+static void readTrace( struct pelletFeed *feed, const char *path ){
+    FILE *file = fopen( path, "r" );
+    if( file == NULL ){
+        fprintf( stderr, "Error opening trace %s: %s\n", path, strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    long capacity = 0;
+    int c;
+    while( (c = fgetc(file)) != EOF ){
+        if( c == '#' ){
+            while( c != '\n' && c != EOF ){
+                c = fgetc( file ); // Skips the comment
+            }
+            continue;
+        }
+        if( c == ' ' || c == '\t' || c == '\n' || c == '\r' ){
+            continue;
+        }
+        long count;
+        ungetc( c, file );
+        if( fscanf(file, "%ld", &count) != 1 || count < 0 || count > INT_MAX ){
+            fprintf( stderr, "Trace %s holds something other than pellet counts after tick %ld.\n", path, feed->traceLength );
+            exit(EXIT_FAILURE);
+        }
+        if( feed->traceLength == capacity ){
+            capacity = (capacity > 0) ? 2 * capacity : 1024;
+            uint32_t *trace = realloc( feed->trace, capacity * sizeof(uint32_t) );
+            if( trace == NULL ){
+                fprintf( stderr, "Error allocating the trace: %s\n", strerror(errno) );
+                exit(EXIT_FAILURE);
+            }
+            feed->trace = trace;
+        }
+        feed->trace[feed->traceLength++] = (uint32_t)count;
+    }
+    fclose( file );
+    if( feed->traceLength == 0 ){
+        fprintf( stderr, "Trace %s holds no pellet counts.\n", path );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Returns a Poisson distributed number of pellets with mean rate
+ * Low rates multiply uniforms until they fall under e^-rate (a few draws), higher rates use Hoermann's transformed
+ * rejection (PTRS), which takes about one draw of two uniforms however high the rate is
+ */
+static long poisson( struct rng *rng, double rate ){
+    if( rate < FEED_PTRS_RATE ){
+        double limit = exp( -rate );
+        double product = 1.0 - rngUnit( rng );
+        long count = 0;
+        while( product > limit ){
+            product *= 1.0 - rngUnit( rng );
+            count++;
+        }
+        return count;
+    }
+    double root = sqrt( rate );
+    double logRate = log( rate );
+    double b = 0.931 + 2.53 * root;
+    double a = -0.059 + 0.02483 * b;
+    double inverseAlpha = 1.1239 + 1.1328 / (b - 3.4);
+    double accept = 0.9277 - 3.6224 / (b - 2);
+    while( 1 ){
+        double u = rngUnit( rng ) - 0.5;
+        double v = rngUnit( rng );
+        double us = 0.5 - fabs( u );
+        if( us == 0 ){
+            continue; // u came out at exactly -0.5
+        }
+        long k = (long)floor( (2 * a / us + b) * u + rate + 0.43 );
+        if( us >= 0.07 && v <= accept ){
+            return k; // Inside the box that never needs the full test
+        }
+        if( k < 0 || (us < 0.013 && v > us) ){
+            continue;
+        }
+        if( log(v) + log(inverseAlpha) - log(a / (us * us) + b) <= -rate + k * logRate - lgamma(k + 1.0) ){
+            return k;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef PELLET_FEED_H
+#define PELLET_FEED_H
+
+#include<stdbool.h>
+#include<stdint.h>
+#include "rng.h"
+
+/* How many new pellets are dropped into the mill every tick (swim_mill -a, mill_batch -a)
+ * A feed is given as a spec:
+ *   uniform                                     1 to 5 pellets every tick, the way swim_mill always fed the mill
+ *   poisson:rate                                Poisson arrivals, rate pellets per tick on average
+ *   burst:rate,burst rate,start chance,end chance
+ *                                               Poisson arrivals that switch between rate and burst rate: a calm tick
+ *                                               starts a burst with start chance, a burst ends with end chance
+ *   trace:path                                  The counts in the text file at path, one per tick (whitespace separated,
+ *                                               # starts a comment), starting over once they run out
+ * Every draw comes from the caller's random number stream (swim_mill's spawner stream), so a seeded run is fed the
+ * same way every time. The only state is whether a burst is on, which checkpoints keep
+ */
+
+#define PELLET_FEED_SPEC_MAX 256 // Room for a spec (and the path of a trace)
+#define PELLET_FEED_UNIFORM 0 // 1 to 5 pellets every tick
+#define PELLET_FEED_POISSON 1 // Poisson arrivals at a fixed rate
+#define PELLET_FEED_BURST 2 // Poisson arrivals switching between a calm and a burst rate
+#define PELLET_FEED_TRACE 3 // Counts read from a file
+
+struct pelletFeed {
+    int kind; // One of the PELLET_FEED_ kinds
+    double rate; // Mean pellets per tick (between bursts for burst)
+    double burstRate; // Mean pellets per tick during a burst
+    double burstStart; // Chance a calm tick starts a burst
+    double burstEnd; // Chance a tick of a burst ends it
+    bool bursting; // A burst is on
+    uint32_t *trace; // Pellets of every tick of a trace (shared by copies of the feed)
+    long traceLength; // Ticks in the trace
+    char spec[PELLET_FEED_SPEC_MAX]; // The spec the feed was made from
+};
+
+void pelletFeedInit( struct pelletFeed *feed, const char *spec );
+int pelletFeedNext( struct pelletFeed *feed, struct rng *rng, long tick );
+void pelletFeedDestroy( struct pelletFeed *feed );
+
+#endif
@@ -0,0 +1,214 @@
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<sys/ipc.h>
+#include<sys/sem.h>
+#include<sys/stat.h>
+#include<errno.h>
+#include "mill.h"
+#include "rng.h"
+
+/* Measures how long a new pellet holds the global semaphore while it looks for a cell without a pellet
+ * "reject" is the old pellet.c loop (random cells tried under the lock until one has no pellet)
+ * "index" picks the cell from the pellet index first and only locks to check and place it
+ * "batch" picks the cells of -b pellets at once (millFreeCells, the way a tick's pellets are dropped) and places them
+ * all under one lock, each pellet's hold is its share of the batch's
+ * Output is CSV: method,occupancy,placements,hold_mean_ns,hold_p50_ns,hold_p99_ns,placements_per_sec
+ */
+
+#define ROW 256 // Default number of rows
+#define COL 256 // Default number of columns
+#define PLACEMENTS 20000 // Default number of placements measured per configuration
+#define BATCH 1000 // Default number of pellets placed together by the batch method
+
+struct millHeader *mill; // Private mill the pellets are placed on
+int semid; // Global semaphore, like the one swim_mill creates
+struct rng rng; // Random number stream used for every choice
+
+// Prototype Functions (Comments on details are made after the main function)
+void fill( double occupancy );
+long placeReject( int *row, int *col );
+long placeIndex( int *row, int *col );
+long placeBatch( uint64_t *cells, int count );
+void semopErrorDet( bool lock );
+long nanos( void );
+int compareLong( const void *a, const void *b );
+
+int main( int argc, char *argv[] ){
+    int rows = ROW;
+    int cols = COL;
+    int placements = PLACEMENTS;
+    int batch = BATCH;
+    int option;
+    const double occupancies[] = { 0.5, 0.9, 0.95, 0.99, 0.999 };
+    const char *methodNames[] = { "reject", "index", "batch" };
+
+    while( (option = getopt(argc, argv, "r:c:n:b:")) != -1 ){
+        switch( option ){
+            case 'r':
+                rows = atoi( optarg );
+                break;
+            case 'c':
+                cols = atoi( optarg );
+                break;
+            case 'n':
+                placements = atoi( optarg );
+                break;
+            case 'b':
+                batch = atoi( optarg );
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-r rows] [-c cols] [-n placements] [-b batch]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( rows < 1 || cols < 1 || placements < 1 || batch < 1 ){
+        fprintf( stderr, "Invalid arguments.\n" );
+        exit(EXIT_FAILURE);
+    }
+
+    semid = semget( IPC_PRIVATE, 1, IPC_CREAT | S_IRUSR | S_IWUSR );
+    if( semid == -1 || semctl(semid, 0, SETVAL, 1) == -1 ){
+        fprintf( stderr, "Error with semget %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    mill = aligned_alloc( MILL_ALIGN, millSegmentSize(rows, cols) );
+    long *holds = malloc( placements * sizeof(long) );
+    uint64_t *cells = malloc( batch * sizeof(uint64_t) );
+    if( mill == NULL || holds == NULL || cells == NULL ){
+        fprintf( stderr, "Error allocating the mill: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    millInit( mill, rows, cols, MILL_LOCK_GLOBAL, 0, 0 );
+    rngSeed( &rng, 1, MILL_STREAM_PELLET );
+
+    printf( "method,occupancy,placements,hold_mean_ns,hold_p50_ns,hold_p99_ns,placements_per_sec\n" );
+    for( size_t o = 0; o < sizeof(occupancies) / sizeof(occupancies[0]); o++ ){
+        for( int method = 0; method < 3; method++ ){
+            double total = 0;
+            fill( occupancies[o] );
+            long start = nanos();
+            for( int i = 0; i < placements && method == 2; ){
+                int count = (batch < placements - i) ? batch : placements - i;
+                count = (count < (int)mill->freeCount) ? count : (int)mill->freeCount; // Every pellet gets a cell of its own
+                long held = placeBatch( cells, count );
+                total += held;
+                for( int n = 0; n < count; n++ ){
+                    holds[i++] = held / count;
+                    millSet( mill, cells[n] / mill->cols, cells[n] % mill->cols, 'x' ); // Takes the pellets off again
+                }
+            }
+            for( int i = 0; i < placements && method < 2; i++ ){
+                int row, col;
+                holds[i] = (method == 0) ? placeReject( &row, &col ) : placeIndex( &row, &col );
+                total += holds[i];
+                millSet( mill, row, col, 'x' ); // Takes the pellet off again so the occupancy stays the same
+            }
+            double seconds = (nanos() - start) / 1e9;
+            qsort( holds, placements, sizeof(long), compareLong );
+            printf( "%s,%.3f,%d,%.0f,%ld,%ld,%.0f\n", methodNames[method], occupancies[o], placements,
+                    total / placements, holds[placements / 2], holds[(size_t)placements * 99 / 100], placements / seconds );
+        }
+    }
+    semctl( semid, 0, IPC_RMID );
+    free( cells );
+    free( holds );
+    free( mill );
+    return 0;
+}
+
+/* Clears the mill and puts pellets on random cells until the given fraction of cells hold one
+ * At least one cell is always left without a pellet
+ */
+void fill( double occupancy ){
+    uint64_t cells = (uint64_t)mill->rows * mill->cols;
+    uint64_t target = (uint64_t)(cells * occupancy);
+    target = (target >= cells) ? cells - 1 : target;
+    millClear( mill );
+    for( uint64_t n = 0; n < target; n++ ){
+        int row, col;
+        millFreeCell( mill, &rng, &row, &col );
+        millSet( mill, row, col, 'P' );
+    }
+}
+
+/* Places a pellet the old way: random cells are tried while the lock is held
+ * Returns the number of nanoseconds the lock was held
+ */
+long placeReject( int *row, int *col ){
+    semopErrorDet( true );
+    long start = nanos();
+    while( 1 ){
+        *row = rngBelow( &rng, mill->rows );
+        *col = rngBelow( &rng, mill->cols );
+        if( millGet(mill, *row, *col) != 'P' ){
+            break;
+        }
+    }
+    millPlacePellet( mill, *row, *col );
+    long held = nanos() - start;
+    semopErrorDet( false );
+    return held;
+}
+
+/* Places a pellet on a cell picked from the pellet index before the lock is taken
+ * Returns the number of nanoseconds the lock was held
+ */
+long placeIndex( int *row, int *col ){
+    while( 1 ){
+        millFreeCell( mill, &rng, row, col );
+        semopErrorDet( true );
+        long start = nanos();
+        if( millGet(mill, *row, *col) != 'P' ){
+            millPlacePellet( mill, *row, *col );
+            long held = nanos() - start;
+            semopErrorDet( false );
+            return held;
+        }
+        semopErrorDet( false ); // Only happens when another actor placed a pellet there first
+    }
+}
+
+/* Places count pellets on cells picked together from the pellet index before the lock is taken, then takes the
+ * lock once for all of them
+ * Returns the number of nanoseconds the lock was held
+ */
+long placeBatch( uint64_t *cells, int count ){
+    int picked = millFreeCells( mill, &rng, cells, count );
+    semopErrorDet( true );
+    long start = nanos();
+    for( int n = 0; n < picked; n++ ){
+        millPlacePellet( mill, cells[n] / mill->cols, cells[n] % mill->cols );
+    }
+    long held = nanos() - start;
+    semopErrorDet( false );
+    return held;
+}
+
+/* Perform lock/unlock operations on the private semaphore
+ */
+void semopErrorDet( bool lock ){
+    struct sembuf sops = { 0, lock ? -1 : 1, 0 };
+    if( semop(semid, &sops, 1) == -1 ){
+        fprintf( stderr, "Error with semop. %s\n", strerror(errno) );
+    }
+}
+
+/* Returns the current time in nanoseconds
+ */
+long nanos( void ){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* qsort comparison for longs
+ */
+int compareLong( const void *a, const void *b ){
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,156 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "planes_engine.h"
+
+// Prototype Functions (Comments on details are made with each function)
+static void *planesWorker( void *arg );
+static void advanceBand( struct planesEngine *engine, struct planesBand *band );
+
+/* Creates the planes engine and starts the worker threads that advance it
+ * The matrix is cut into one band of whole blocks per worker, so the only cells two workers share are the rows
+ * where one band ends and the next begins
+ */
+struct planesEngine *planesEngineCreate( struct millHeader *mill, int workers ){
+    struct planesEngine *engine = calloc( 1, sizeof(*engine) );
+    if( engine == NULL ){
+        fprintf( stderr, "Error allocating the planes engine: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    engine->mill = mill;
+    engine->workers = (workers > (int)mill->blocks) ? (int)mill->blocks : workers; // A worker without a block would never have work
+    engine->workers = (engine->workers < 0) ? 0 : engine->workers;
+
+    int bands = (engine->workers > 0) ? engine->workers : 1;
+    engine->bands = calloc( bands, sizeof(*engine->bands) );
+    if( engine->bands == NULL ){
+        fprintf( stderr, "Error allocating the planes bands: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < bands; i++ ){
+        engine->bands[i].first = (int)((uint64_t)i * mill->blocks / bands);
+        engine->bands[i].last = (int)((uint64_t)(i + 1) * mill->blocks / bands) - 1;
+        if( i + 1 < bands ){
+            engine->bands[i].halo = malloc( mill->words * sizeof(uint64_t) ); // The last band has no row below it
+            if( engine->bands[i].halo == NULL ){
+                fprintf( stderr, "Error allocating the planes halo: %s\n", strerror(errno) );
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    pthread_mutex_init( &engine->mutex, NULL );
+    pthread_cond_init( &engine->start, NULL );
+    pthread_cond_init( &engine->done, NULL );
+    engine->threads = calloc( bands, sizeof(pthread_t) );
+    engine->workerArgs = calloc( bands, sizeof(struct planesWorkerArg) );
+    if( engine->threads == NULL || engine->workerArgs == NULL ){
+        fprintf( stderr, "Error allocating the planes workers: %s\n", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    for( int i = 0; i < engine->workers; i++ ){
+        engine->workerArgs[i].engine = engine;
+        engine->workerArgs[i].index = i;
+        int code = pthread_create( &engine->threads[i], NULL, planesWorker, &engine->workerArgs[i] );
+        if( code ){
+            fprintf( stderr, "pthread_create failed with code %d.\n", code );
+            exit(EXIT_FAILURE);
+        }
+    }
+    return engine;
+}
+
+/* Moves every pellet on the matrix down one row (the same as millAdvancePellets) and returns once all bands are done
+ * Every worker advances its own band, lifting the pellets of its bottom row into its halo, then the calling thread
+ * puts the halos down on the top rows of the bands below and rebuilds the block counts
+ * Adds the number of pellets that landed on the fish to eaten and the number that left the last row to passed
+ * The caller holds the lock of every row (no other actor may change cells while this runs)
+ */
+void planesEngineStep( struct planesEngine *engine, uint32_t *eaten, uint32_t *passed ){
+    struct millHeader *mill = engine->mill;
+    if( engine->workers == 0 ){
+        millAdvancePellets( mill, eaten, passed ); // Without worker threads the caller advances the whole matrix itself
+        return;
+    }
+    pthread_mutex_lock( &engine->mutex );
+    engine->pending = engine->workers;
+    engine->generation++;
+    pthread_cond_broadcast( &engine->start );
+    while( engine->pending > 0 ){
+        pthread_cond_wait( &engine->done, &engine->mutex );
+    }
+    pthread_mutex_unlock( &engine->mutex );
+
+    for( int i = 0; i < engine->workers; i++ ){
+        struct planesBand *band = &engine->bands[i];
+        if( band->halo != NULL ){
+            millLandHalo( mill, band->last + 1, band->halo, eaten );
+        }
+        *eaten += band->eaten;
+        *passed += band->passed;
+    }
+    uint64_t total = millCountBlocks( mill, 0, mill->blocks - 1 );
+    __atomic_store_n( &mill->freeCount, (uint64_t)mill->rows * mill->cols - total, __ATOMIC_RELEASE );
+}
+
+/* Stops the worker threads and frees the engine
+ */
+void planesEngineDestroy( struct planesEngine *engine ){
+    int bands = (engine->workers > 0) ? engine->workers : 1;
+    pthread_mutex_lock( &engine->mutex );
+    engine->stopping = true;
+    pthread_cond_broadcast( &engine->start );
+    pthread_mutex_unlock( &engine->mutex );
+    for( int i = 0; i < engine->workers; i++ ){
+        pthread_join( engine->threads[i], NULL );
+    }
+    for( int i = 0; i < bands; i++ ){
+        free( engine->bands[i].halo );
+    }
+    pthread_mutex_destroy( &engine->mutex );
+    pthread_cond_destroy( &engine->start );
+    pthread_cond_destroy( &engine->done );
+    free( engine->threads );
+    free( engine->workerArgs );
+    free( engine->bands );
+    free( engine );
+}
+
+/* Worker thread that advances its own band once per step
+ */
+static void *planesWorker( void *arg ){
+    struct planesWorkerArg *worker = arg;
+    struct planesEngine *engine = worker->engine;
+    unsigned long seen = 0; // Last step this worker has run
+
+    pthread_mutex_lock( &engine->mutex );
+    while( 1 ){
+        while( engine->generation == seen && !engine->stopping ){
+            pthread_cond_wait( &engine->start, &engine->mutex );
+        }
+        if( engine->stopping ){
+            break;
+        }
+        seen = engine->generation;
+        pthread_mutex_unlock( &engine->mutex );
+
+        advanceBand( engine, &engine->bands[worker->index] );
+
+        pthread_mutex_lock( &engine->mutex );
+        if( --engine->pending == 0 ){
+            pthread_cond_signal( &engine->done );
+        }
+    }
+    pthread_mutex_unlock( &engine->mutex );
+    return NULL;
+}
+
+/* Moves every pellet of a band down one row, but those of its bottom row, which wait in its halo since the
+ * worker of the band below may not have moved the pellets out of the row under them yet
+ */
+static void advanceBand( struct planesEngine *engine, struct planesBand *band ){
+    band->eaten = 0;
+    band->passed = 0;
+    millAdvanceBlocks( engine->mill, band->first, band->last, band->halo, &band->eaten, &band->passed );
+}
@@ -0,0 +1,44 @@
+#ifndef PLANES_ENGINE_H
+#define PLANES_ENGINE_H
+
+#include<stdbool.h>
+#include<stdint.h>
+#include<pthread.h>
+#include "mill.h"
+
+// The rows advanced by one worker: a run of whole blocks, so every tile belongs to a single worker
+struct planesBand {
+    int first; // First block of the band
+    int last; // Last block of the band
+    uint64_t *halo; // Pellets lifted off the bottom row of the band during the last step (a word per 64 columns)
+    uint32_t eaten; // Pellets of the band that landed on a fish during the last step
+    uint32_t passed; // Pellets of the band that left the last row during the last step
+};
+
+struct planesEngine;
+
+// Handed to each worker thread so it knows which band it owns
+struct planesWorkerArg {
+    struct planesEngine *engine;
+    int index;
+};
+
+struct planesEngine {
+    struct millHeader *mill; // The shared segment holding the 2D char array being simulated
+    int workers; // Number of worker threads (0 means the caller advances the whole matrix itself)
+    struct planesBand *bands; // One band per worker, top to bottom
+    pthread_t *threads; // Worker threads
+    struct planesWorkerArg *workerArgs; // Argument given to each worker thread
+    pthread_mutex_t mutex; // Protects the fields below
+    pthread_cond_t start; // Signaled when a new step begins
+    pthread_cond_t done; // Signaled when the last worker finishes a step
+    unsigned long generation; // Incremented once per step
+    int pending; // Workers that haven't finished the current step
+    bool stopping; // Set when the workers should exit
+};
+
+struct planesEngine *planesEngineCreate( struct millHeader *mill, int workers );
+void planesEngineStep( struct planesEngine *engine, uint32_t *eaten, uint32_t *passed );
+void planesEngineDestroy( struct planesEngine *engine );
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include<stdint.h>
+
+/* Small, fast pseudo random number generator (xoshiro256**) with one independent stream per actor
+ * Every stream is derived from the run seed and the actor's stream number with splitmix64, so a run
+ * started with the same seed makes exactly the same random choices
+ */
+struct rng {
+    uint64_t s[4];
+};
+
+/* splitmix64 step, used to spread a seed over the generator state
+ */
+static inline uint64_t rngSplitMix( uint64_t *x ){
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Seeds stream number stream of the run seeded with seed
+ */
+static inline void rngSeed( struct rng *rng, uint64_t seed, uint64_t stream ){
+    uint64_t x = seed ^ rngSplitMix( &stream ); // Different streams start far apart in the splitmix sequence
+    for( int i = 0; i < 4; i++ ){
+        rng->s[i] = rngSplitMix( &x );
+    }
+}
+
+static inline uint64_t rngRotl( uint64_t x, int k ){
+    return (x << k) | (x >> (64 - k));
+}
+
+/* Returns the next 64 random bits of the stream
+ */
+static inline uint64_t rngNext( struct rng *rng ){
+    uint64_t *s = rng->s;
+    uint64_t result = rngRotl( s[1] * 5, 7 ) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rngRotl( s[3], 45 );
+    return result;
+}
+
+/* Returns a uniformly distributed number from 0 to n - 1 (takes the place of rand() % n)
+ */
+static inline uint32_t rngBelow( struct rng *rng, uint32_t n ){
+    // Lemire's multiply and shift, retrying the few values that would make the result biased
+    uint64_t m = (uint64_t)(uint32_t)(rngNext( rng ) >> 32) * n;
+    if( (uint32_t)m < n ){
+        uint32_t threshold = -n % n;
+        while( (uint32_t)m < threshold ){
+            m = (uint64_t)(uint32_t)(rngNext( rng ) >> 32) * n;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+/* Returns a uniformly distributed number from 0 up to (but not including) 1
+ */
+static inline double rngUnit( struct rng *rng ){
+    return (rngNext( rng ) >> 11) * 0x1.0p-53; // The top 53 bits fill the whole mantissa
+}
+
+#endif
@@ -4,327 +4,977 @@
 #include<pthread.h>
 #include<signal.h>
 #include<string.h>
+#include<time.h>
 #include<unistd.h>
-#include<sys/ipc.h>
-#include<sys/sem.h>
-#include<sys/shm.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/mman.h>
+#include<sys/pidfd.h>
 #include<sys/stat.h>
+#include<sys/wait.h>
 #include<errno.h>
+#include<fcntl.h>
+#include<getopt.h>
+#include "mill.h"
+#include "mill_ipc.h"
+#include "mill_stats.h"
+#include "event_log.h"
+#include "mill_snapshot.h"
+#include "mill_checkpoint.h"
+#include "fish_engine.h"
+#include "pellet_engine.h"
+#include "planes_engine.h"
+#include "pellet_feed.h"
+#include "mill_trace.h"
+#include "mill_affinity.h"
+#include "mill_metrics.h"
+#include "rng.h"
 
 #define MAX_TIME 30 // Max number of seconds for a computation to be made
+#define TICK_RATE 1 // Default number of ticks per second
 #define MAX_PROCESSES 20 // Max number of processes allowed at one time
-#define SHM_KEY 0x1234 // Shared memory segment key
-#define SEM_KEY 0x5678 // Semaphore key
-#define OBJ_PERMS ( S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP ) // Read/Write permissions for owner or group owner
-#define ROW 16 // Max number of rows for the matrix shmp
-#define COL 16 // Max number of columns for the matrix shmp
+#define ROW 16 // Default number of rows for the matrix shmp
+#define COL 16 // Default number of columns for the matrix shmp
+#define ENGINE_WORKERS 4 // Default number of worker threads advancing pellets in engine and planes mode
+#define ENGINE_CAPACITY 65536 // Default max number of pellets in the pool in engine mode
+#define FISH_WORKERS 4 // Default number of worker threads steering the fish when there is more than one
+#define CHECKPOINT_EVERY 1000 // Default number of ticks between checkpoints
+#define RELEASE_EVERY 64 // Ticks between handing the memory of tiles without a pellet back (see millReleaseEmpty)
+#define REAPER_STOP UINT64_MAX // epoll key of the eventfd that stops the reaper (child keys are pid << 32 | pidfd)
+#define STOP_GRACE_MS 1000 // Longest the children get to exit on their own once the run is stopped before they are killed
 
-// The following four global variables will be in all three source files
-char (*shmp)[ROW][COL]; // Initialize a 2D char array
-int shmid; // Initialize the shared memory ID
-int semid; // For use with the semaphore set
+// The following global variable will be in all three source files
+struct millHeader *shmp; // Shared segment (header with the geometry followed by the 2D char array)
 
 // The following global vairables are meant only for this source file
-bool finished; // Sets to true once computation time ends
-FILE *fp; // For file IO
-int processCounter; // For keeping track of how many processes are running
+volatile sig_atomic_t statsRequested; // Set by SIGUSR1, the main loop prints the hot path timings
+volatile sig_atomic_t interrupted; // Set by SIGINT, the main loop stops the run at the end of the tick
+struct eventLog *events; // Binary log of what happened to every pellet (decode with mill_decode)
+struct millSnapshot *snapshot; // Read-only copy of the matrix for printMatrix and mill_watch
+char shmName[MILL_IPC_NAME_MAX]; // Name of the shared memory object (unique to this run, fish and pellet get it from the environment)
+char snapshotName[MILL_SNAPSHOT_NAME_MAX]; // Name of the snapshot viewers watch (unique to this run too)
+int processCounter; // Processes running (swim_mill, fish and pellets), only changed atomically by the spawner and the reaper
+int reaperEpoll; // epoll instance holding a pidfd for every child process
+int reaperStop; // eventfd that tells the reaper thread to stop
+bool stopped; // Set by main once the run is stopped, from then on the reaper reaps children without reporting them
+pid_t watched[MAX_PROCESSES]; // Every child the reaper hasn't reaped yet (0 marks a free slot)
+int watchedFds[MAX_PROCESSES]; // pidfd of each child in watched
+pthread_mutex_t watchedMutex = PTHREAD_MUTEX_INITIALIZER; // Guards watched and watchedFds
 struct timespec tsChild; // For setting random time between pellet process creation
 pid_t fish; // For use with fork function
 pid_t pellet; // For use with fork function
+int rows = ROW; // Number of rows of the matrix, set with -r
+int cols = COL; // Number of columns of the matrix, set with -c
+int lockMode = MILL_LOCK_GLOBAL; // How actors lock the matrix, set with -l
+int tickRate = TICK_RATE; // Ticks per second (0 = as fast as possible), set with -t
+uint64_t seed; // Seed of every random number stream in the run, set with -s/--seed
+struct rng spawnerRng; // Random number stream of the pellet thread
+int pelletNumber; // Number of pellet processes forked so far (picks each pellet's random number stream)
+bool engineMode; // Pellets are records in an in-process pool instead of ./pellet processes
+struct pelletEngine *engine; // The pellet pool used in engine mode
+bool planeMode; // Pellets only exist as bits in the pellet plane and all of them move at once
+struct planesEngine *planes; // Moves the pellet plane in planes mode
+int fishCount; // Number of fish in the in-process fish pool, set with -f (0 runs a single ./fish process)
+int horizon; // Ticks the fish plan ahead, set with -P (0 heads for the closest pellet)
+struct pelletFeed feed; // How many pellets are dropped every tick, set with -a
+struct fishEngine *fishPool; // The fish pool used when fishCount > 0
+const char *checkpointPath; // Where checkpoints are written, set with -C (NULL writes none)
+pid_t checkpointWriter; // Child process writing the latest checkpoint (0 when there is none)
+struct millTraceWriter *trace; // Records every pellet dropped and every fish move, set with -T (NULL records nothing)
+struct millAffinity affinity; // CPUs the threads are pinned to, set with -A (see mill_affinity.h)
+struct millMetrics *metrics; // Serves live counters of the run on a Unix socket, set with -M (NULL serves none)
 
 // Prototype Functions (Comments on details are made after the main function)
 static void *childPellet( void *ignored );
+static void *enginePellet( void *ignored );
+static void *planePellet( void *ignored );
+static void *engineFish( void *ignored );
+static void *reapChildren( void *ignored );
+void watchChild( pid_t child );
+void unwatchChild( pid_t child, int pidfd );
+void killStragglers( void );
+bool reserveProcess( void );
+void saveCheckpoint( uint32_t tick, long ticks );
+void releaseTiles( void );
+void bindBand( int first, int last, int cpu );
+void reportPellet( const struct pelletExit *done );
+void lockRows( int first, int last, bool lock );
 void SIGINT_Handler( int ignore );
-void shmgetErrorDet( void );
-void shmatErrorDet( void );
-void shmdtErrorDet( void );
-void shmctlErrorDet( void );
+void SIGUSR1_Handler( int ignore );
 void initializeMatrix( void );
 void printMatrix( void );
-void semgetctlErrorDet( void );
-void semopErrorDet( bool lock );
-void semctlErrorDet( void );
 
 int main( int argc, char *argv[] ){
     struct timespec ts; // For nanosleep function to cause small delays (make output pretty) in main function
+    int workers = ENGINE_WORKERS; // Worker threads for engine mode
+    int capacity = ENGINE_CAPACITY; // Pool size for engine mode
+    int fishWorkers = FISH_WORKERS; // Worker threads for the fish pool
+    int option; // For use with the getopt function
+    long maxTicks = -1; // Length of the run in ticks, set with -n (defaults to MAX_TIME seconds worth)
+    bool seeded = false; // A seed was given, otherwise the clock is used like before
+    long checkpointEvery = CHECKPOINT_EVERY; // Ticks between checkpoints, set with -K
+    struct millCheckpoint *restored = NULL; // Checkpoint the run picks up from, set with -R
+    const char *tracePath = NULL; // Where the trace is written, set with -T
+    const char *cpuSpec = NULL; // CPUs the threads are pinned to, set with -A (NULL pins none)
+    const char *metricsPath = NULL; // Where the metrics socket goes, set with -M
+    const char *feedSpec = "uniform"; // How pellets are dropped, set with -a
+    long firstTick = 0; // Tick the run starts on (later than 0 when restored)
     processCounter = 1; // Main is the first process
-    printf( "swim_mill process has begun. swim_mill PID = %d.\n", getpid() ); // Prints the PID of swim_mill main
+    static const struct option longOptions[] = {
+        { "engine", no_argument, NULL, 'e' },
+        { "planes", no_argument, NULL, 'b' },
+        { "workers", required_argument, NULL, 'w' },
+        { "pool", required_argument, NULL, 'p' },
+        { "fish", required_argument, NULL, 'f' },
+        { "fish-workers", required_argument, NULL, 'F' },
+        { "plan", required_argument, NULL, 'P' },
+        { "feed", required_argument, NULL, 'a' },
+        { "rows", required_argument, NULL, 'r' },
+        { "cols", required_argument, NULL, 'c' },
+        { "lock", required_argument, NULL, 'l' },
+        { "tick-rate", required_argument, NULL, 't' },
+        { "ticks", required_argument, NULL, 'n' },
+        { "seed", required_argument, NULL, 's' },
+        { "checkpoint", required_argument, NULL, 'C' },
+        { "checkpoint-every", required_argument, NULL, 'K' },
+        { "restore", required_argument, NULL, 'R' },
+        { "trace", required_argument, NULL, 'T' },
+        { "cpus", required_argument, NULL, 'A' },
+        { "metrics", required_argument, NULL, 'M' },
+        { NULL, 0, NULL, 0 }
+    };
 
-    fp = fopen( "swim_mill_results.txt", "w+" ); // Creates/Opens file to write to
-    if( fp == NULL ){
-        fprintf( stderr, "File failed to open.\n" );
+    // -e runs pellets in the in-process engine, -w and -p set its worker count and pool size (the workers only move
+    // pellets side by side with -l striped or cas, under the global lock they take turns row by row)
+    // -f runs that many fish in an in-process pool (steered by -F worker threads) instead of one ./fish process
+    // -P makes the fish plan that many ticks ahead to catch the most pellets instead of heading for the closest one
+    // -a sets how many pellets are dropped every tick: uniform (1 to 5, the default), poisson:rate,
+    // burst:rate,burst rate,start chance,end chance or trace:path (see pellet_feed.h), processes stay under MAX_PROCESSES
+    // -b runs pellets as bits of the pellet plane, every pellet moving at once (no pellet IDs in the results), -w sets
+    // the worker threads moving it
+    // -r and -c set the size of the matrix, -l sets the lock mode (global, striped or cas)
+    // -t sets the ticks per second (0 runs as fast as possible) and -n the number of ticks to run
+    // -s seeds every random choice so a run can be repeated exactly
+    // -C writes a checkpoint to a file every -K ticks, -R picks a run up from one (with the geometry, modes, lock mode,
+    // tick rate, seed, fish, workers and pool size of the saved run, -n still sets the length of the whole run)
+    // -T records every pellet dropped and every fish move to a trace file that mill_replay replays (see mill_trace.h)
+    // -A pins the threads to a list of CPUs (like 0-7,16-23, or all), the last one for the event log, the reaper and
+    // printing, and puts each band of the matrix in planes mode on the NUMA node of its worker (see mill_affinity.h)
+    // -M serves live counters of the run in the Prometheus text format on a Unix socket at a path (see mill_metrics.h)
+    while( (option = getopt_long(argc, argv, "ebw:p:f:F:P:a:r:c:l:t:n:s:C:K:R:T:A:M:", longOptions, NULL)) != -1 ){
+        switch( option ){
+            case 'e':
+                engineMode = true;
+                break;
+            case 'b':
+                planeMode = true;
+                break;
+            case 'w':
+                workers = atoi( optarg );
+                break;
+            case 'p':
+                capacity = atoi( optarg );
+                break;
+            case 'f':
+                fishCount = atoi( optarg );
+                break;
+            case 'F':
+                fishWorkers = atoi( optarg );
+                break;
+            case 'P':
+                horizon = atoi( optarg );
+                break;
+            case 'a':
+                feedSpec = optarg;
+                break;
+            case 'r':
+                rows = atoi( optarg );
+                break;
+            case 'c':
+                cols = atoi( optarg );
+                break;
+            case 'l':
+                if( strcmp(optarg, "global") == 0 ){
+                    lockMode = MILL_LOCK_GLOBAL;
+                } else if( strcmp(optarg, "striped") == 0 ){
+                    lockMode = MILL_LOCK_STRIPED;
+                } else if( strcmp(optarg, "cas") == 0 ){
+                    lockMode = MILL_LOCK_CAS;
+                } else {
+                    fprintf( stderr, "Unknown lock mode %s (use global, striped or cas).\n", optarg );
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                tickRate = atoi( optarg );
+                break;
+            case 'n':
+                maxTicks = atol( optarg );
+                break;
+            case 's':
+                seed = strtoull( optarg, NULL, 0 );
+                seeded = true;
+                break;
+            case 'C':
+                checkpointPath = optarg;
+                break;
+            case 'K':
+                checkpointEvery = atol( optarg );
+                break;
+            case 'R':
+                restored = millCheckpointOpen( optarg );
+                break;
+            case 'T':
+                tracePath = optarg;
+                break;
+            case 'A':
+                cpuSpec = optarg;
+                break;
+            case 'M':
+                metricsPath = optarg;
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-e | -b] [-w workers] [-p pool size] [-f fish] [-F fish workers] [-P plan horizon] [-a feed] [-r rows] [-c cols] [-l global|striped|cas] [-t ticks per second] [-n ticks] [-s seed] [-C checkpoint file] [-K ticks between checkpoints] [-R checkpoint file] [-T trace file] [-A cpus] [-M metrics socket]\n", argv[0] );
+                exit(EXIT_FAILURE);
+        }
+    }
+    if( restored != NULL ){
+        // The saved run decides everything the matrix and the actors depend on
+        const struct millHeader *saved = millCheckpointSegment( restored );
+        rows = saved->rows;
+        cols = saved->cols;
+        lockMode = saved->lockMode;
+        tickRate = saved->tickRate;
+        seed = saved->seed;
+        seeded = true;
+        engineMode = (restored->mode == MILL_CHECKPOINT_ENGINE);
+        planeMode = (restored->mode == MILL_CHECKPOINT_PLANES);
+        fishCount = restored->fishCount;
+        horizon = restored->horizon;
+        feedSpec = restored->feed;
+        workers = restored->workers;
+        capacity = restored->capacity;
+        maxTicks = (maxTicks < 0) ? restored->ticks : maxTicks;
+        firstTick = restored->tick;
+        if( firstTick >= maxTicks ){
+            fprintf( stderr, "The checkpoint is from tick %ld, past the end of a %ld tick run.\n", firstTick, maxTicks );
+            exit(EXIT_FAILURE);
+        }
+    }
+    if( (checkpointPath != NULL || restored != NULL) && (!(engineMode || planeMode) || fishCount < 1) ){
+        fprintf( stderr, "Checkpoints need every actor inside swim_mill (-e or -b with -f).\n" );
+        exit(EXIT_FAILURE);
+    }
+    if( tracePath != NULL && (!(engineMode || planeMode) || fishCount < 1 || restored != NULL) ){
+        fprintf( stderr, "A trace needs every actor inside swim_mill (-e or -b with -f) and a run that starts from tick 0.\n" );
+        exit(EXIT_FAILURE);
+    }
+    if( checkpointEvery < 1 ){
+        fprintf( stderr, "Checkpoints must be at least 1 tick apart.\n" );
+        exit(EXIT_FAILURE);
+    }
+    if( workers < 0 || capacity < 1 ){
+        fprintf( stderr, "Worker count must be at least 0 and pool size at least 1.\n" );
+        exit(EXIT_FAILURE);
+    }
+    if( engineMode && planeMode ){
+        fprintf( stderr, "Engine mode and planes mode can't be used together.\n" );
         exit(EXIT_FAILURE);
     }
+    if( rows < 2 || cols < 1 ){
+        fprintf( stderr, "The matrix needs at least 2 rows and 1 column.\n" );
+        exit(EXIT_FAILURE);
+    }
+    if( fishCount < 0 || fishCount > cols || fishWorkers < 0 ){
+        fprintf( stderr, "Fish count must be from 0 to the number of columns and fish workers at least 0.\n" );
+        exit(EXIT_FAILURE);
+    }
+    if( horizon < 0 || horizon > FISH_PLAN_MAX_HORIZON ){
+        fprintf( stderr, "Plan horizon must be from 0 to %d ticks.\n", FISH_PLAN_MAX_HORIZON );
+        exit(EXIT_FAILURE);
+    }
+    if( tickRate < 0 ){
+        fprintf( stderr, "Tick rate must be at least 0.\n" );
+        exit(EXIT_FAILURE);
+    }
+    pelletFeedInit( &feed, feedSpec );
+    millAffinityInit( &affinity, cpuSpec );
+    feed.bursting = (restored != NULL) && restored->bursting;
+    if( maxTicks < 0 ){
+        maxTicks = (long)MAX_TIME * ((tickRate > 0) ? tickRate : 1);
+    }
+    if( !seeded ){
+        seed = time(NULL);
+    }
+    printf( "swim_mill process has begun. swim_mill PID = %d.\n", getpid() ); // Prints the PID of swim_mill main
+    printf( "Seed = %llu.\n", (unsigned long long)seed ); // Rerun with -s and this seed to repeat the run
+
+    // The event log writer, the reaper and every forked checkpoint writer start out where main is
+    millAffinityPin( pthread_self(), millAffinityService(&affinity) );
+    events = eventLogOpen( "swim_mill_results.bin", engineMode ? EVENT_IDS : 0 ); // Creates/Opens file to write to
 
-    finished = false; // Will set to true when computation time is finished
-    srand( time(NULL) ); // Will use this later in the childPellet thread for random time creation
+    rngSeed( &spawnerRng, seed, MILL_STREAM_SPAWNER ); // Will use this later in the pellet thread for random pellet creation
     ts.tv_sec = 0; // 0 seconds for use with nanosleep function
     ts.tv_nsec = 100000000; // 100000000 nanoseconds (100ms) for use with nanosleep function
     nanosleep( &ts, &ts ); // Little delay so the swim_mill pid displays first
 
-    shmgetErrorDet(); // Getting shared memory set up
-    shmatErrorDet(); // Attaching shared memory
-    semgetctlErrorDet(); // Initializes the semaphore set
-    signal( SIGINT, &SIGINT_Handler ); // Used for the CTRL C signal to end all processes
+    int swept = millIpcSweep(); // Shared memory left behind by runs that crashed
+    if( swept > 0 ){
+        printf( "Removed %d shared memory object%s left behind by earlier runs.\n", swept, (swept > 1) ? "s" : "" );
+    }
+    millIpcName( shmName, sizeof(shmName), getpid() );
+    shmp = millIpcCreate( shmName, millSegmentSize(rows, cols) ); // Creates and maps the shared memory
+    millInit( shmp, rows, cols, lockMode, tickRate, seed ); // Writes the geometry, lock mode, clock and seed fish and pellet will read
+    millTickEnd( shmp, (maxTicks < UINT32_MAX) ? (uint32_t)maxTicks : UINT32_MAX ); // Every actor stops once the clock gets there
+    setenv( MILL_IPC_ENV, shmName, 1 ); // fish and pellet find the shared memory through their environment
+    millStatsCreate( shmName ); // Hot path timings of every actor (only built in with make STATS=1)
+    signal( SIGINT, &SIGINT_Handler ); // Used for the CTRL C signal to stop the run early
+    signal( SIGUSR1, &SIGUSR1_Handler ); // Prints the hot path timings so far
     initializeMatrix(); // Initializes a 2D array that will be shared between processes (shmp)
+    millSnapshotName( snapshotName, sizeof(snapshotName), getpid() );
+    snapshot = millSnapshotCreate( snapshotName, rows, cols ); // Viewers can watch the mill from here on
+    printf( "Snapshot = %s (watch with mill_watch -m %s).\n", snapshotName, snapshotName );
+    if( metricsPath != NULL ){
+        metrics = millMetricsOpen( metricsPath, shmp, &processCounter ); // So can scrapers
+    }
     nanosleep( &ts, &ts ); // Little delay so that matrix isn't initialized after fish fork
 
-    fish = fork(); // Create and set up the fish process
-    if( fish < 0 ){
-        fprintf( stderr, "fish was not created.\n");
+    pthread_t fish_thread; // Steers the fish pool when there is one
+    pthread_t reaper_thread; // Reaps the fish and pellet processes the moment they exit
+    int code; // Error code for if the pthread_create function fails
+    reaperEpoll = epoll_create1( EPOLL_CLOEXEC );
+    reaperStop = eventfd( 0, EFD_CLOEXEC );
+    struct epoll_event stopEvent = { EPOLLIN, { .u64 = REAPER_STOP } };
+    if( reaperEpoll == -1 || reaperStop == -1 || epoll_ctl(reaperEpoll, EPOLL_CTL_ADD, reaperStop, &stopEvent) == -1 ){
+        fprintf( stderr, "Error setting up the reaper: %s\n", strerror(errno) );
         exit(EXIT_FAILURE);
-    } else if( fish > 0 ){
-        // Do parent stuff
-        processCounter++; // Increments the process counter up to 2 due to fork succeeding
-    } else if( fish == 0 ){
-        // Do child stuff
-        execv("./fish", NULL);
+    }
+    code = pthread_create( &reaper_thread, NULL, reapChildren, NULL );
+    if( code ){
+        fprintf( stderr, "pthread_create failed with code %d.\n", code );
+        exit(EXIT_FAILURE);
+    }
+    millTickJoin( shmp ); // The fish takes part in every tick from the one it starts on
+    if( fishCount > 0 ){
+        // The fish pool takes the place of the ./fish process
+        fishPool = fishEngineCreate( shmp, fishCount, fishWorkers, seed, lockRows );
+        fishEnginePlan( fishPool, horizon );
+        if( restored != NULL ){
+            // Nothing runs yet, so the saved matrix (with the fish where they were) simply replaces the new one
+            millRestore( shmp, millCheckpointSegment(restored) );
+            fishEngineRestore( fishPool, millCheckpointFish(restored), restored->fishCount );
+            spawnerRng = restored->spawner;
+        }
+        if( tracePath != NULL ){
+            trace = millTraceCreate( tracePath, engineMode ? MILL_TRACE_ENGINE : MILL_TRACE_PLANES, shmp, fishPool, capacity, seed );
+        }
+        code = pthread_create( &fish_thread, NULL, engineFish, NULL );
+        if( code ){
+            fprintf( stderr, "pthread_create failed with code %d.\n", code );
+            exit(EXIT_FAILURE);
+        }
+        for( int i = 0; i < fishPool->workers; i++ ){
+            millAffinityPin( fishPool->threads[i], millAffinityNext(&affinity) );
+        }
+        millAffinityPin( fish_thread, millAffinityNext(&affinity) );
+    } else {
+        fish = fork(); // Create and set up the fish process
+        if( fish < 0 ){
+            fprintf( stderr, "fish was not created.\n");
+            exit(EXIT_FAILURE);
+        } else if( fish > 0 ){
+            // Do parent stuff
+            __atomic_add_fetch( &processCounter, 1, __ATOMIC_RELAXED ); // Increments the process counter up to 2 due to fork succeeding
+            watchChild( fish );
+        } else if( fish == 0 ){
+            // Do child stuff
+            signal( SIGINT, SIG_IGN ); // A CTRL C reaches the whole process group, swim_mill stops the fish itself
+            millAffinityRelease( &affinity ); // Forked from the pinned main thread, the fish may use every CPU of -A
+            // Runs the fish process, telling it how far ahead to plan
+            char plan[32];
+            snprintf( plan, sizeof(plan), "%d", horizon );
+            char *fishArgv[] = { "./fish", plan, NULL };
+            execv( "./fish", fishArgv );
+        }
     }
     nanosleep( &ts, &ts ); // Little delay so the fish pid will display next
 
     pthread_t pellet_thread; // Create a new thread that will continuously fork to create new pellets
-    int code; // Error code for if the pthread_create function fails
-    code = pthread_create( &pellet_thread, NULL, childPellet, NULL );
+    millTickJoin( shmp ); // So does the pellet thread
+    if( engineMode ){
+        // In engine mode the thread fills and advances the pellet pool instead of forking
+        engine = pelletEngineCreate( shmp, workers, capacity, seed, lockRows, reportPellet );
+        if( restored != NULL ){
+            pelletEngineRestore( engine, millCheckpointPellets(restored), (int)restored->pelletCount, restored->nextId, &restored->placer );
+        }
+        for( int i = 0; i < engine->workers; i++ ){
+            millAffinityPin( engine->threads[i], millAffinityNext(&affinity) );
+        }
+        code = pthread_create( &pellet_thread, NULL, enginePellet, NULL );
+    } else if( planeMode ){
+        planes = planesEngineCreate( shmp, workers );
+        for( int i = 0; i < planes->workers; i++ ){
+            int cpu = millAffinityNext( &affinity );
+            millAffinityPin( planes->threads[i], cpu );
+            bindBand( planes->bands[i].first, planes->bands[i].last, cpu ); // The worker's band of tiles lives on its node
+        }
+        code = pthread_create( &pellet_thread, NULL, planePellet, NULL );
+    } else {
+        code = pthread_create( &pellet_thread, NULL, childPellet, NULL );
+    }
     if( code ){
         fprintf( stderr, "pthread_create failed with code %d.\n", code );
+    } else {
+        int cpu = millAffinityNext( &affinity );
+        millAffinityPin( pellet_thread, cpu );
+        if( planeMode && planes->workers == 0 ){
+            bindBand( 0, shmp->blocks - 1, cpu ); // The pellet thread moves the whole matrix itself
+        }
     }
     nanosleep( &ts, &ts ); // Little delay so that if error occurs then will be displayed next
 
     printf( "Countdown will begin now.\n" ); // swim_mill will begin counting down
-    for( int seconds = 0; seconds < MAX_TIME; seconds++ ){
-        // printf( "Number of active processes = %d.\n", processCounter );
-        if( (MAX_TIME - seconds) > 1 ){
-            printf( "There are %d seconds left before termination.\n", (MAX_TIME-seconds) );
-        } else if( (MAX_TIME - seconds) == 1 ){
-            printf( "There is %d second left before termination.\n", (MAX_TIME-seconds) );
-            finished = true; // Computation has ended (this will be used by the childPellet thread)
+    struct timespec nextTick; // When the next tick is due (unused when running as fast as possible)
+    struct timespec lastPrint; // When the countdown was last printed
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &nextTick );
+    lastPrint = nextTick;
+    if( restored != NULL ){
+        printf( "Picked up the run on tick %ld.\n", firstTick );
+        millCheckpointClose( restored );
+    }
+    for( long tick = firstTick; tick < maxTicks; tick++ ){
+        long remaining = maxTicks - tick;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        // At one tick per second print every tick like before, otherwise at most once a second (and the last tick)
+        if( tickRate == 1 || remaining == 1 || tick == 0 || now.tv_sec > lastPrint.tv_sec ){
+            // printf( "Number of active processes = %d.\n", processCounter );
+            if( tickRate == 1 && remaining > 1 ){
+                printf( "There are %ld seconds left before termination.\n", remaining );
+            } else if( tickRate == 1 ){
+                printf( "There is %ld second left before termination.\n", remaining );
+            } else {
+                printf( "There %s %ld tick%s left before termination.\n", (remaining > 1) ? "are" : "is", remaining, (remaining > 1) ? "s" : "" );
+            }
+            printMatrix();
+            lastPrint = now;
+        }
+        bool last = (remaining == 1 || interrupted); // Computation ends with this tick
+        if( interrupted && remaining > 1 ){
+            millTickEnd( shmp, tick + 1 ); // Every actor still finishes this tick and none starts the next one
+        }
+        // Paces the clock to tickRate, then waits for every actor to finish this tick and starts the next one
+        if( tickRate > 0 ){
+            nextTick.tv_nsec += 1000000000L / tickRate;
+            nextTick.tv_sec += nextTick.tv_nsec / 1000000000L;
+            nextTick.tv_nsec %= 1000000000L;
+            clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &nextTick, NULL );
+        }
+        MILL_STAT_START( advance );
+        bool checkpointDue = checkpointPath != NULL && !last && (tick + 1) % checkpointEvery == 0;
+        bool releaseDue = (tick + 1) % RELEASE_EVERY == 0;
+        if( checkpointDue || releaseDue ){
+            if( millTickSettle(shmp) ){ // Every actor is done with this tick and waits for the next one
+                if( checkpointDue ){
+                    saveCheckpoint( tick + 1, maxTicks );
+                }
+                if( releaseDue ){
+                    releaseTiles();
+                }
+            }
+            millTickStart( shmp );
+        } else {
+            millTickAdvance( shmp );
+        }
+        MILL_STAT_END( MILL_STAT_TICK_WAIT, advance );
+        if( statsRequested ){
+            statsRequested = 0;
+            millStatsExport( stderr );
+        }
+        if( last ){
+            break; // Interrupted before the last tick
         }
-        printMatrix();
-        sleep(1);
     }
 
-    code = pthread_cancel( pellet_thread ); // Cancels the thread upon completion of computation time
+    // Every pellet thread stops on its own once the clock reaches the last tick, so none is ever cancelled while holding the lock
+    code = pthread_join( pellet_thread, NULL ); // Ensures terminated thread and main thread join to avoid potential zombie processes
     if( code ){
-        fprintf( stderr, "pthread_cancel failed with code %d.\n", code );
+        fprintf( stderr, "pthread_join failed with code %d.\n", code );
     }
-    code = pthread_join( pellet_thread, NULL ); // Ensures terminated thread and main thread join to avoid potential zombie processes
+
+    if( fishCount > 0 ){
+        code = pthread_join( fish_thread, NULL ); // The fish thread stops on its own on the last tick too
+        if( code ){
+            fprintf( stderr, "pthread_join failed with code %d.\n", code );
+        }
+    }
+    if( trace != NULL ){
+        // After the final barrier (every thread is joined), so the clock is the number of ticks the run went through
+        millTraceFinish( trace, shmp, fishPool, millTickNow(shmp) );
+    }
+    if( engineMode ){
+        pelletEngineDestroy( engine ); // Pellets still in the pool are dropped like killed pellet processes
+    }
+    if( planeMode ){
+        planesEngineDestroy( planes );
+    }
+    if( fishCount > 0 ){
+        fishEngineDestroy( fishPool );
+    }
+    // The reaper stops reporting first, then every fish and pellet process sees the stop on its own and exits
+    // (the reaper returns once it has reaped all of them)
+    __atomic_store_n( &stopped, true, __ATOMIC_RELEASE );
+    uint64_t stop = 1;
+    if( write(reaperStop, &stop, sizeof(stop)) != sizeof(stop) ){
+        fprintf( stderr, "Error stopping the reaper: %s\n", strerror(errno) );
+    }
+    millStop( shmp );
+    code = pthread_join( reaper_thread, NULL ); // Returns once every child is reaped, before the event log is closed
     if( code ){
         fprintf( stderr, "pthread_join failed with code %d.\n", code );
     }
 
     printf( "Final matrix appears below.\n" );
     printMatrix();
-    fclose( fp ); // Closes the  file
-    shmdtErrorDet(); // Detaches shared memory
-    shmctlErrorDet(); // Removes shared memory
-    semctlErrorDet(); // Removes semaphore set
-
-    code = kill( fish, SIGTERM ); // Make sure fish is killed
-    if( code == -1 ){
-        fprintf( stderr, "Pellet processes weren't killed with kill command. %s.\n", strerror(errno) );
-    }
-    signal( SIGQUIT, SIG_IGN ); // Set up SIGQUIT to be ignored by Parent
-    code = kill( 0, SIGQUIT ); // Kills all other child processes (pellets) and ignores swim_mill
-    // If an error occurs, print a message
-    if( code == -1 ){
-        fprintf( stderr, "Pellet processes weren't killed with kill command. %s.\n", strerror(errno) );
-    }
-    wait( NULL );
-    printf( "Program has ended naturally.\n" );
+    eventLogClose( events ); // Writes the last events and closes the file
+    if( metrics != NULL ){
+        millMetricsClose( metrics ); // Every pellet has been counted
+    }
+    millStatsExport( stderr ); // Hot path timings of the whole run
+    millStatsRemove( shmName );
+    millSnapshotDetach( snapshot );
+    millSnapshotRemove( snapshotName ); // Viewers still attached keep the last frame
+    millIpcDetach( shmp ); // Detaches shared memory
+    millIpcRemove( shmName ); // Removes shared memory
+
+    if( interrupted ){
+        printf( "\nYou have successfully interrupted the program.\n" );
+    } else {
+        printf( "Program has ended naturally.\n" );
+    }
     exit(EXIT_SUCCESS);
 }
 
 static void *childPellet(void *ignored){
-    while( 1 ){
-        int numberOfProcesses = 1; // Will start this many processes
-        int status; // For use with the waitpid function
-        pid_t return_pid; // For use with the waitpid function
-        numberOfProcesses = (rand() % 5) + 1; // Random number between 1 and 5
-        numberOfProcesses = ((processCounter + numberOfProcesses) >= MAX_PROCESSES) ? 1 : numberOfProcesses;
-        numberOfProcesses = (finished) ? MAX_PROCESSES : numberOfProcesses;
-        // This will generate as many pellets as was randomized in the line above
-        while( numberOfProcesses > 0 ){
+    uint32_t tick = 0; // Last tick this thread has seen
+    while( !millTickOver(shmp, tick) ){
+        int numberOfProcesses = pelletFeedNext( &feed, &spawnerRng, tick ); // 1 to 5 unless -a says otherwise
+        // This will generate as many pellets as the feed asked for, as long as there is room under MAX_PROCESSES
+        // (the reaper frees a slot the moment a pellet exits, so the mill stays full without going over)
+        while( numberOfProcesses > 0 && reserveProcess() ){
             numberOfProcesses--;
-            // Will continue to fork as long as computation hasn't ended or MAX_PROCESSES hasn't been reached
-            if( !finished && (processCounter < MAX_PROCESSES) ){
-                pellet = fork();
-            }
+            millTickJoin( shmp ); // The pellet takes part in the current tick (it leaves again when it finishes)
+            pelletNumber++;
+            pellet = fork();
             if( pellet < 0 ){
                 fprintf( stderr, "pellet was not created.\n");
                 exit(EXIT_FAILURE);
             } else if( pellet > 0 ){
                 // Do parent stuff
-                processCounter = (!finished) ? processCounter+1 : processCounter; // Increments processCounter since fork succeeded
-                // Parent will wait on children to see if they exit
-                return_pid = 1; // Just an intial case to make sure while loop runs
-                // While loop will ensure that even if multiple pellet processes end at once, all will be tracked and decremented
-                while( return_pid > 0 ){
-                    return_pid = waitpid( -1, &status, WNOHANG ); // WNOHANG used to make sure parent process continues
-                    // If statement will only be entered if the above waitpid function notices a pellet process exit
-                    if( return_pid > 0 ){
-                        processCounter--;
-                        // Cheks the status message to print the appropriate messages to the .txt file
-                        if( WEXITSTATUS(status) == 0 ) {
-                          fprintf( fp, "pellet PID %d has been eaten by the fish.\n", return_pid );
-                        } else if( WEXITSTATUS(status) == 1 ){
-                          fprintf( fp, "pellet PID %d has terminated due to an error.\n", return_pid );
-                        } else if( WEXITSTATUS(status) == 2 ){
-                          fprintf( fp, "pellet PID %d has passed the fish.\n", return_pid );
-                        } else if( WEXITSTATUS(status) == 3 ){
-                          fprintf( fp, "pellet PID %d has terminated due to initializing on top of an already exisiting pellet.\n", return_pid );
-                        } else {
-                          fprintf( fp, "pellet PID %d has terminated due to an unknown reason. Figure it out.\n", return_pid );
-                        }
-                    }
-                }
-            } else if( !finished && pellet == 0 ){
-                execv("./pellet", NULL ); // Runs the pellet process
+                watchChild( pellet ); // The reaper reports the pellet once it exits
+            } else if( pellet == 0 ){
+                // Runs the pellet process, telling it which random number stream is its own
+                char stream[32];
+                snprintf( stream, sizeof(stream), "%d", MILL_STREAM_PELLET + pelletNumber );
+                signal( SIGINT, SIG_IGN ); // A CTRL C reaches the whole process group, swim_mill stops the pellet itself
+                millAffinityRelease( &affinity ); // Forked from the pinned pellet thread, the pellet may use every CPU of -A
+                char *pelletArgv[] = { "./pellet", stream, NULL };
+                execv( "./pellet", pelletArgv );
             }
         }
-        // This portion will make the thread sleep for 1 second so long as the computation time hasn't finished
-        if( !finished ) {
-            sleep(1);
-        }
+        tick = millTickArrive( shmp, tick ); // Waits for the next tick
     }
+    millTickLeave( shmp ); // Stops taking part in ticks
+    return NULL;
 }
 
-/* CTRL C Signal Handler to kill all processes and detach/remove shared memory in the case of this interrupt
+/* Reaps the fish and pellet processes as soon as they exit: every child has a pidfd in reaperEpoll, which becomes
+ * readable when the child exits, so nothing is left a zombie and processCounter is always up to date
+ * Once main sets stopped and writes to reaperStop the children are exiting on their own (millStop): the reaper
+ * keeps reaping them without reporting anything, kills whoever is left after STOP_GRACE_MS (but a checkpoint
+ * writer, which is let finish its file) and returns once every child is gone
  */
-void SIGINT_Handler( int ignore ){
-    int code;
-    shmdtErrorDet(); // Detaches shared memory
-    shmctlErrorDet(); // Removes shared memory
-    semctlErrorDet(); // Removes semaphore set
-    code = kill( fish, SIGTERM ); // Make sure fish is killed
-    if( code == -1 ){
-        fprintf( stderr, "Pellet processes weren't killed with kill command. %s.\n", strerror(errno) );
-    }
-    signal( SIGQUIT, SIG_IGN ); // Set up SIGQUIT to be ignored by Parent
-    code = kill( 0, SIGQUIT ); // Kills all other child processes (pellets) and ignores swim_mill
-    // If an error occurs, print a message
-    if( code == -1 ){
-        fprintf( stderr, "Pellet processes weren't killed with kill command. %s.\n", strerror(errno) );
-    }
-    wait( NULL );
-    printf( "\nYou have successfully interrupted the program.\n" );
-    exit( EXIT_SUCCESS );
+static void *reapChildren( void *ignored ){
+    struct epoll_event ready[MAX_PROCESSES + 1];
+    bool stopping = false; // The reaper has heard from reaperStop
+    bool killed = false; // The stragglers have been killed
+    struct timespec stoppedAt, now; // When the reaper heard from reaperStop
+    while( 1 ){
+        int timeout = -1; // Until the run is stopped the reaper only wakes up for exits
+        if( stopping ){
+            if( __atomic_load_n(&processCounter, __ATOMIC_RELAXED) == 1 ){ // swim_mill is the only process left
+                return NULL;
+            }
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            long waited = (now.tv_sec - stoppedAt.tv_sec) * 1000 + (now.tv_nsec - stoppedAt.tv_nsec) / 1000000;
+            if( waited >= STOP_GRACE_MS && !killed ){
+                killStragglers();
+                killed = true;
+            }
+            timeout = killed ? -1 : (int)(STOP_GRACE_MS - waited);
+        }
+        int count = epoll_wait( reaperEpoll, ready, MAX_PROCESSES + 1, timeout );
+        if( count == -1 ){
+            if( errno == EINTR ){
+                continue;
+            }
+            fprintf( stderr, "Error with epoll_wait: %s\n", strerror(errno) );
+            exit(EXIT_FAILURE);
+        }
+        MILL_STAT_START( woke ); // When the reaper learned the children exited
+        for( int i = 0; i < count; i++ ){
+            if( ready[i].data.u64 == REAPER_STOP ){
+                epoll_ctl( reaperEpoll, EPOLL_CTL_DEL, reaperStop, NULL ); // It stays readable, only the children matter now
+                stopping = true;
+                clock_gettime( CLOCK_MONOTONIC, &stoppedAt );
+                continue;
+            }
+            pid_t child = (pid_t)(ready[i].data.u64 >> 32);
+            int status; // For use with the waitpid function
+            if( waitpid(child, &status, 0) != child ){
+                if( errno == ECHILD ){
+                    unwatchChild( child, (int)(ready[i].data.u64 & 0xffffffff) ); // Already reaped, just forget it
+                } else {
+                    fprintf( stderr, "Error with waitpid: %s\n", strerror(errno) );
+                }
+                continue;
+            }
+            unwatchChild( child, (int)(ready[i].data.u64 & 0xffffffff) );
+            __atomic_sub_fetch( &processCounter, 1, __ATOMIC_RELAXED );
+            if( child == fish ){
+                millTickLeave( shmp ); // The fish died before the end of the run, don't let it stall the mill
+                continue;
+            }
+            if( child == __atomic_load_n(&checkpointWriter, __ATOMIC_ACQUIRE) ){
+                if( !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ){
+                    fprintf( stderr, "The checkpoint of the run was not written.\n" );
+                }
+                __atomic_store_n( &checkpointWriter, 0, __ATOMIC_RELEASE ); // The next checkpoint can be taken
+                continue;
+            }
+            if( __atomic_load_n(&stopped, __ATOMIC_ACQUIRE) ){
+                continue; // Pellets still falling when the run stopped are dropped like the ones in the engine
+            }
+            MILL_STAT_END( MILL_STAT_REAP_LAG, woke );
+            struct pelletExit done = { child, WEXITSTATUS(status), 0, -1, -1 }; // Only the exit code is known
+            reportPellet( &done ); // Logs the appropriate event
+            // Pellets leave the tick barrier themselves unless they died some other way
+            if( !WIFEXITED(status) || WEXITSTATUS(status) == PELLET_ERROR || WEXITSTATUS(status) > PELLET_COLLISION ){
+                millTickLeave( shmp );
+            }
+        }
+    }
 }
 
-/* Gets shared memory with key
+/* Hands a child process to the reaper
  */
-void shmgetErrorDet( void ){
-    shmid = shmget( SHM_KEY, sizeof(shmp), IPC_CREAT | OBJ_PERMS );
-    // If a -1 is returned, then there is an issue
-    if( shmid == -1 ){
-        fprintf( stderr, "Error with shmget %s\n", strerror(errno) );
+void watchChild( pid_t child ){
+    int pidfd = pidfd_open( child, 0 ); // Works even if the child already exited, it stays a zombie until the reaper waits on it
+    if( pidfd != -1 ){
+        fcntl( pidfd, F_SETFD, FD_CLOEXEC ); // pidfd_open already sets it, the pellets exec'd later must not keep one
+    }
+    struct epoll_event event = { EPOLLIN, { .u64 = ((uint64_t)child << 32) | (uint32_t)pidfd } };
+    if( pidfd == -1 || epoll_ctl(reaperEpoll, EPOLL_CTL_ADD, pidfd, &event) == -1 ){
+        fprintf( stderr, "Error watching process %d: %s\n", child, strerror(errno) );
         exit(EXIT_FAILURE);
     }
+    pthread_mutex_lock( &watchedMutex );
+    for( int i = 0; i < MAX_PROCESSES; i++ ){
+        if( watched[i] == 0 ){
+            watched[i] = child;
+            watchedFds[i] = pidfd;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &watchedMutex );
 }
 
-/* Attaches shared memory
+/* Forgets a child the reaper has reaped, takes its pidfd out of reaperEpoll and closes it
+ * Closing alone isn't enough: a pellet forked but not yet exec'd holds a copy of every pidfd, and epoll keeps
+ * watching a file until every copy of it is closed
  */
-void shmatErrorDet( void ){
-    shmp = shmat( shmid, NULL, 0 );
-    // If a -1 is returned, then there is an issue
-    if( shmp == (void *) -1 ){
-        fprintf( stderr, "Error with shmat: %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
+void unwatchChild( pid_t child, int pidfd ){
+    pthread_mutex_lock( &watchedMutex );
+    for( int i = 0; i < MAX_PROCESSES; i++ ){
+        if( watched[i] == child ){
+            watched[i] = 0;
+            break;
+        }
     }
+    epoll_ctl( reaperEpoll, EPOLL_CTL_DEL, pidfd, NULL );
+    close( pidfd );
+    pthread_mutex_unlock( &watchedMutex );
 }
 
-/* Detaches shared memory
+/* Kills every child that is still running STOP_GRACE_MS after the run was stopped (a checkpoint writer is let be)
+ * Each one is signalled through its own pidfd, so nothing outside the run is touched, whatever process group it is in
  */
-void shmdtErrorDet( void ){
-    // If a -1 is returned, then there is an issue
-    if( shmdt( shmp ) == -1 ){
-        fprintf( stderr, "Error with shmdt: %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
+void killStragglers( void ){
+    pid_t writer = __atomic_load_n( &checkpointWriter, __ATOMIC_ACQUIRE );
+    pthread_mutex_lock( &watchedMutex );
+    for( int i = 0; i < MAX_PROCESSES; i++ ){
+        if( watched[i] != 0 && watched[i] != writer ){
+            fprintf( stderr, "Process %d didn't stop with the run, killing it.\n", watched[i] );
+            pidfd_send_signal( watchedFds[i], SIGKILL, NULL, 0 );
+        }
     }
+    pthread_mutex_unlock( &watchedMutex );
 }
 
-/* Removes the shared mmemory
+/* Counts one more process in processCounter if that keeps it within MAX_PROCESSES
+ * Returns false if there is no room
  */
-void shmctlErrorDet( void ){
-    // If a -1 is returned, then there is an issue
-    if( shmctl(shmid, IPC_RMID, 0) == -1){
-        fprintf( stderr, "Error with shmctl: %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
+bool reserveProcess( void ){
+    int count = __atomic_load_n( &processCounter, __ATOMIC_RELAXED );
+    while( count < MAX_PROCESSES ){
+        if( __atomic_compare_exchange_n(&processCounter, &count, count + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ){
+            return true;
+        }
     }
+    return false;
 }
 
-/* Initializes the characters in a shared memory 2D array
+/* Engine mode version of childPellet: pellets are added to and advanced in the in-process pool
  */
-void initializeMatrix( void ){
-    semopErrorDet( true ); // Lock acccess to the shared memory 2D char array
-    for( int i = 0; i < ROW; i++ ){
-        for( int j = 0; j < COL; j++ ){
-            (*shmp)[i][j] = 'x';
+static void *enginePellet( void *ignored ){
+    uint32_t tick = millTickNow( shmp ); // Last tick this thread has seen (0, or the tick a restored run picked up on)
+    while( !millTickOver(shmp, tick) ){
+        millTickAfterFish( shmp, tick ); // Pellets move after the fish so every tick happens in the same order
+        pelletEngineStep( engine ); // Every pellet in the pool moves down one row
+        int numberOfPellets = pelletFeedNext( &feed, &spawnerRng, tick ); // 1 to 5 unless -a says otherwise
+        pelletEngineSpawn( engine, numberOfPellets ); // The whole batch is placed at once
+        if( trace != NULL ){
+            millTraceTick( trace, fishPool, engine->cells, engine->cellCount );
         }
+        tick = millTickArrive( shmp, tick );
     }
-    semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
+    millTickLeave( shmp ); // Stops taking part in ticks
+    return NULL;
 }
 
-/* Prints the current characters located in the shared memory 2D array
+/* Planes mode version of childPellet: every pellet moves down one row at once with planesEngineStep
+ * and the tick's new pellets are dropped together under one lock (millDropPellets)
+ * Pellets have no ID in this mode, so the event log gets the number of pellets eaten and passed each tick
  */
-void printMatrix( void ){
-    semopErrorDet( true ); // Lock acccess to the shared memory 2D char array
-    for( int i = 0; i < ROW; i++ ){
-        for( int j = 0; j < COL; j++ ){
-            printf( "%c", (*shmp)[i][j] );
+static void *planePellet( void *ignored ){
+    uint32_t tick = millTickNow( shmp ); // Last tick this thread has seen (0, or the tick a restored run picked up on)
+    uint64_t *cells = NULL; // Room for the cells of a tick's pellets
+    int cellCapacity = 0;
+    while( !millTickOver(shmp, tick) ){
+        uint32_t eaten = 0;
+        uint32_t passed = 0;
+        uint32_t collided = 0;
+        millTickAfterFish( shmp, tick ); // Pellets move after the fish so every tick happens in the same order
+        lockRows( 0, rows - 1, true ); // Lock acccess to the shared memory 2D char array
+        planesEngineStep( planes, &eaten, &passed ); // Every pellet on the matrix moves down one row
+        lockRows( 0, rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+        int numberOfPellets = pelletFeedNext( &feed, &spawnerRng, tick ); // 1 to 5 unless -a says otherwise
+        if( numberOfPellets > cellCapacity ){
+            free( cells );
+            cellCapacity = numberOfPellets * 2;
+            cells = malloc( cellCapacity * sizeof(uint64_t) );
+            if( cells == NULL ){
+                fprintf( stderr, "Error allocating the cells of new pellets: %s\n", strerror(errno) );
+                exit(EXIT_FAILURE);
+            }
+        }
+        lockRows( 0, rows - 1, true ); // Lock acccess to the shared memory 2D char array
+        millDropPellets( shmp, &spawnerRng, cells, numberOfPellets, &eaten, &collided );
+        lockRows( 0, rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+        if( trace != NULL ){
+            millTraceTick( trace, fishPool, cells, numberOfPellets );
+        }
+        struct eventRecord record = { tick, 0, 0, 0, -1, -1, 0 };
+        uint32_t counts[] = { eaten, passed, collided };
+        uint16_t types[] = { EVENT_EATEN_COUNT, EVENT_PASSED_COUNT, EVENT_COLLISION_COUNT };
+        for( int i = 0; i < 3; i++ ){
+            if( counts[i] > 0 ){
+                record.actor = counts[i];
+                record.type = types[i];
+                eventLogWrite( events, &record );
+            }
         }
-        printf("\n");
+        if( metrics != NULL ){
+            millMetricsCount( metrics, PELLET_EATEN, eaten );
+            millMetricsCount( metrics, PELLET_PASSED, passed );
+            millMetricsCount( metrics, PELLET_COLLISION, collided );
+        }
+        tick = millTickArrive( shmp, tick );
     }
-    semopErrorDet( false ); // Unlock acccess to the shared memory 2D char array
+    free( cells );
+    millTickLeave( shmp ); // Stops taking part in ticks
+    return NULL;
 }
 
-/* Creates the semaphore set and intializes them
+/* Fish pool version of the ./fish process: every fish takes one step per tick before the pellets move
  */
-void semgetctlErrorDet( void ){
-    semid = semget( SEM_KEY, 1, IPC_CREAT | OBJ_PERMS ); // Creates semaphore ID with appropriate permissions
-    // Error Detection
-    if( semid == -1 ){
-        fprintf( stderr, "Error with semget %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
+static void *engineFish( void *ignored ){
+    uint32_t tick = millTickNow( shmp ); // Last tick this thread has seen (0, or the tick a restored run picked up on)
+    while( !millTickOver(shmp, tick) ){
+        if( tick > 0 ){
+            fishEngineStep( fishPool ); // Every fish moves toward its closest pellet (they were put on the matrix on tick 0)
+        }
+        millTickFishDone( shmp, tick ); // Lets the pellets take their step
+        tick = millTickArrive( shmp, tick );
     }
-    // Initializes semaphore as well as perform error detection
-    if( semctl(semid, 0, SETVAL, 1) == -1 ){
-        fprintf( stderr, "Error with semctl initialization %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
+    millTickLeave( shmp ); // Stops taking part in ticks
+    return NULL;
+}
+
+/* Puts the memory of row blocks first through last on the NUMA node of cpu (see millBindBlocks), so it is local to
+ * the thread pinned there whichever thread first touches it
+ * Does nothing when threads aren't pinned or the system has no NUMA nodes to speak of
+ */
+void bindBand( int first, int last, int cpu ){
+    int node = (cpu >= 0) ? millCpuNode( cpu ) : -1;
+    if( node >= 0 && !millBindBlocks(shmp, first, last, node) ){
+        fprintf( stderr, "Couldn't place row blocks %d to %d on NUMA node %d: %s\n", first, last, node, strerror(errno) );
     }
 }
 
-/* Perform lock/unlock operations on the opened semaphore set
+/* Writes a checkpoint of the run that picks up on tick, while every actor waits at the tick barrier
+ * Only the shared segment is copied here, a forked child writes the file from its copy-on-write view of the copy
+ * and the engines so the run goes on right away
+ * Skipped if the previous checkpoint is still being written
  */
-void semopErrorDet( bool lock ){
-    struct sembuf sops; // struct with data members needed for semop system call
-    // Locking blocks any other process from accessing critical region (shared 2D array)
-    if( lock ){
-        sops.sem_num = 0;
-        sops.sem_op = -1;
-        sops.sem_flg = 0;
-        if( semop(semid, &sops, 1) == -1 ){
-            fprintf( stderr, "Error with semop lock operation. %s\n", strerror(errno) );
-        }
-    // Unlocking gives back access to critical region (shared 2D array) to other processes
-    } else if( !lock ){
-        sops.sem_num = 0;
-        sops.sem_op = 1;
-        sops.sem_flg = 0;
-        if( semop(semid, &sops, 1) == -1 ){
-            fprintf( stderr, "Error with semop unlock operation. %s\n", strerror(errno) );
-        }
-    // Should not get to this else statement (debugging)
+void saveCheckpoint( uint32_t tick, long ticks ){
+    if( __atomic_load_n(&checkpointWriter, __ATOMIC_ACQUIRE) != 0 ){
+        return;
+    }
+    // Anonymous memory reads back as zeros until written, so the copy only takes memory for the tiles with pellets
+    struct millHeader *copy = mmap( NULL, shmp->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( copy == MAP_FAILED ){
+        fprintf( stderr, "Error allocating the checkpoint copy: %s\n", strerror(errno) );
+        return;
+    }
+    millCopy( copy, shmp );
+    copy->tick = tick; // The tick millTickStart is about to start
+    struct millCheckpoint checkpoint = { 0 };
+    checkpoint.mode = engineMode ? MILL_CHECKPOINT_ENGINE : MILL_CHECKPOINT_PLANES;
+    checkpoint.tick = tick;
+    checkpoint.ticks = ticks;
+    checkpoint.spawner = spawnerRng;
+    checkpoint.horizon = horizon;
+    checkpoint.bursting = feed.bursting;
+    strcpy( checkpoint.feed, feed.spec );
+    checkpoint.workers = engineMode ? engine->workers : planes->workers;
+    checkpoint.capacity = engineMode ? engine->capacity : ENGINE_CAPACITY;
+    if( engineMode ){
+        checkpoint.placer = engine->rng;
+        checkpoint.nextId = engine->nextId;
+    }
+    __atomic_add_fetch( &processCounter, 1, __ATOMIC_RELAXED );
+    pid_t writer = fork();
+    if( writer < 0 ){
+        fprintf( stderr, "Checkpoint writer was not created: %s\n", strerror(errno) );
+        __atomic_sub_fetch( &processCounter, 1, __ATOMIC_RELAXED );
+    } else if( writer == 0 ){
+        bool written = millCheckpointWrite( checkpointPath, &checkpoint, copy, engineMode ? engine : NULL, fishPool );
+        _exit( written ? EXIT_SUCCESS : EXIT_FAILURE ); // Leaves the parent's stdio buffers and threads alone
     } else {
-        printf( "How did you wind up here?\n" );
+        __atomic_store_n( &checkpointWriter, writer, __ATOMIC_RELEASE );
+        watchChild( writer ); // The reaper lets the next checkpoint go ahead once this one is written
     }
+    munmap( copy, shmp->size ); // The writer has its own copy-on-write view of it
 }
 
-/* Removes the semaphore set
+/* Hands the memory of tiles without a pellet back to the system, while every actor waits at the tick barrier
+ * A pellet process forked since then may be placing itself, so every row is locked around it, and with
+ * MILL_LOCK_CAS (which has no locks) it is only done when no pellet is a process
  */
-void semctlErrorDet( void ){
-    // Removes semaphore set with error detection
-    if( semctl(semid, 0, IPC_RMID) == -1 ){
-        fprintf( stderr, "Error with semctl removiving semaphore %s\n", strerror(errno) );
-        exit(EXIT_FAILURE);
+void releaseTiles( void ){
+    if( shmp->lockMode == MILL_LOCK_CAS && !engineMode && !planeMode ){
+        return;
+    }
+    lockRows( 0, rows - 1, true ); // Lock acccess to the shared memory 2D char array
+    millReleaseEmpty( shmp );
+    lockRows( 0, rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+}
+
+/* Logs the fate of a finished pellet (its exit code, and with the pellet engine the fish that ate it and where)
+ * Only copies the event into the log's ring buffer, the file is written by the log's own thread
+ */
+void reportPellet( const struct pelletExit *done ){
+    struct eventRecord record;
+    record.tick = millTickNow( shmp );
+    record.actor = (int32_t)done->id;
+    record.high = (uint32_t)(done->id >> 32);
+    record.type = done->code;
+    record.fish = done->fish;
+    record.row = done->row;
+    record.col = done->col;
+    eventLogWrite( events, &record );
+    if( metrics != NULL ){
+        millMetricsCount( metrics, done->code, 1 );
+    }
+}
+
+/* Locks/unlocks rows first through last of the shared memory 2D char array with whatever the mill's lock mode is
+ * Also handed to the pellet engine
+ */
+void lockRows( int first, int last, bool lock ){
+    MILL_STAT_START( start );
+    if( shmp->lockMode == MILL_LOCK_GLOBAL ){
+        if( lock ){
+            millLockGlobal( shmp );
+        } else {
+            millUnlockGlobal( shmp );
+        }
+    } else if( shmp->lockMode == MILL_LOCK_STRIPED ){
+        if( lock ){
+            millLockRows( shmp, first, last );
+        } else {
+            millUnlockRows( shmp, first, last );
+        }
+    }
+    // MILL_LOCK_CAS has nothing to lock, cells change with compare and swap
+    if( lock && shmp->lockMode != MILL_LOCK_CAS ){
+        MILL_STAT_END( MILL_STAT_LOCK_WAIT, start ); // How long it took to get the lock
     }
 }
+
+/* SIGUSR1 Signal Handler, asks the main loop to print the hot path timings at the end of the tick
+ */
+void SIGUSR1_Handler( int ignore ){
+    statsRequested = 1;
+}
+
+/* CTRL C Signal Handler, asks the main loop to stop the run at the end of the tick and shut down like a run that
+ * ended on its own (every child is stopped and reaped, and the shared memory and the log are cleaned up)
+ */
+void SIGINT_Handler( int ignore ){
+    interrupted = 1;
+    signal( SIGINT, SIG_DFL ); // A second CTRL C ends swim_mill right away
+}
+
+/* Initializes the characters in a shared memory 2D array
+ */
+void initializeMatrix( void ){
+    lockRows( 0, rows - 1, true ); // Lock acccess to the shared memory 2D char array
+    millClear( shmp ); // Every cell starts as 'x' and free for a pellet (the segment is still all holes, so this is free)
+    lockRows( 0, rows - 1, false ); // Unlock acccess to the shared memory 2D char array
+}
+
+/* Prints the current characters located in the shared memory 2D array
+ * Publishes a new snapshot (which never takes the matrix lock, so the actors keep going while it's copied
+ * and printed) and prints the whole frame with a single write
+ */
+void printMatrix( void ){
+    millSnapshotPublish( snapshot, shmp );
+    fflush( stdout ); // Whatever was printed before goes out before the frame
+    const char *frame = millSnapshotFrame( snapshot );
+    size_t left = snapshot->frameSize;
+    while( left > 0 ){
+        ssize_t written = write( STDOUT_FILENO, frame, left );
+        if( written == -1 && errno == EINTR ){
+            continue;
+        }
+        if( written == -1 ){
+            fprintf( stderr, "Error printing the matrix: %s\n", strerror(errno) );
+            break;
+        }
+        frame += written;
+        left -= written;
+    }
+}
+